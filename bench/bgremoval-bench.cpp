@@ -0,0 +1,927 @@
+/*
+ * bgremoval-bench: run the plugin's models outside of OBS and report per-stage
+ * latency as JSON.
+ *
+ *   bgremoval-bench [--data <dir>] [--models <name,...>] [--providers <cpu,...>]
+ *                   [--threads <n,...>] [--warmup <n>] [--iterations <n>]
+ *                   [--size <width>x<height>] [--output <file>] [--verbose]
+ *
+ * Replay mode feeds a recorded raw BGRA stream of --size frames through the
+ * background filter's frame pipeline instead, and reports per-frame latency,
+ * allocations per frame and the mask IoU against a reference run:
+ *
+ *   bgremoval-bench --replay <file> --size <width>x<height> [--fps <n>]
+ *                   [--roi <0|1>] [--similarity <0|1>] [--adaptive <0|1>]
+ *                   [--mask-every <n>] [--warp <0|1>] [--cascade <name>]
+ *                   [--save-masks <file>]
+ *                   [--reference <file>] [--models <name>] ...
+ */
+
+#include <obs-module.h>
+
+#include <onnxruntime_cxx_api.h>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <plugin-support.h>
+#include "FilterData.h"
+#include "consts.h"
+#include "ort-utils/ort-session-utils.h"
+#include "background-mask.h"
+#include "image-utils/mask-refinement.h"
+#include "image-utils/postprocess.h"
+#include "image-utils/change-detection.h"
+#include "perf-utils/allocation-counter.h"
+#include "models/ModelSINET.h"
+#include "models/ModelMediapipe.h"
+#include "models/ModelSelfie.h"
+#include "models/ModelRVM.h"
+#include "models/ModelPPHumanSeg.h"
+#include "models/ModelTCMonoDepth.h"
+#include "models/ModelRMBG.h"
+#include "models/ModelTBEFN.h"
+#include "models/ModelZeroDCE.h"
+#include "models/ModelURetinex.h"
+
+// Heap allocations since start, counted by the global operator new. The
+// cv::Mat buffers are counted by perf-utils/allocation-counter in replay mode.
+static std::atomic<uint64_t> allocationCount{0};
+
+void *operator new(std::size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void *ptr = std::malloc(size ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+namespace {
+
+struct BenchModel {
+	const char *name;
+	const char *path;
+	// Segmentation models produce a mask, the others an enhanced image
+	bool segmentation;
+	std::function<Model *()> create;
+};
+
+// Same model to class mapping as the filters' update functions
+const std::vector<BenchModel> benchModels = {
+	{"sinet", MODEL_SINET, true, [] { return new ModelSINET; }},
+	{"mediapipe", MODEL_MEDIAPIPE, true,
+	 [] { return new ModelMediaPipe; }},
+	{"selfie", MODEL_SELFIE, true, [] { return new ModelSelfie; }},
+	{"pphumanseg", MODEL_PPHUMANSEG, true,
+	 [] { return new ModelPPHumanSeg; }},
+	{"rvm", MODEL_RVM, true, [] { return new ModelRVM; }},
+	{"tcmonodepth", MODEL_DEPTH_TCMONODEPTH, true,
+	 [] { return new ModelTCMonoDepth; }},
+	{"rmbg", MODEL_RMBG, true, [] { return new ModelRMBG; }},
+	{"tbefn", MODEL_ENHANCE_TBEFN, false, [] { return new ModelTBEFN; }},
+	{"uretinex", MODEL_ENHANCE_URETINEX, false,
+	 [] { return new ModelURetinex; }},
+	{"sgllie", MODEL_ENHANCE_SGLLIE, false,
+	 [] { return new ModelBCHW; }},
+	{"zerodce", MODEL_ENHANCE_ZERODCE, false,
+	 [] { return new ModelZeroDCE; }},
+};
+
+struct BenchOptions {
+	std::string dataPath = BENCH_DATA_DIR;
+	std::vector<std::string> models;
+	std::vector<std::string> providers;
+	std::vector<uint32_t> threads = {1, 2, 4};
+	int warmup = 10;
+	int iterations = 100;
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	std::string outputPath;
+
+	// Replay mode, see runReplay
+	std::string replayPath;
+	std::string referencePath;
+	std::string saveMasksPath;
+	double fps = 30.0;
+	// The background filter's defaults
+	bool enableRoi = false;
+	bool enableSimilarity = true;
+	bool adaptiveMaskRate = true;
+	int maskEveryXFrames = 1;
+	bool warpMask = false;
+	// The refinement model of cascade mode, none if empty
+	std::string cascadeModel;
+};
+
+struct StageSamples {
+	std::vector<double> preprocess;
+	std::vector<double> sessionRun;
+	std::vector<double> postprocess;
+	std::vector<double> maskRefinement;
+	std::vector<double> total;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double millisecondsBetween(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+/**
+  * @brief Nearest-rank percentile
+*/
+double percentile(std::vector<double> values, double q)
+{
+	if (values.empty()) {
+		return 0.0;
+	}
+	std::sort(values.begin(), values.end());
+	size_t rank = (size_t)std::ceil(q * (double)values.size());
+	rank = std::min(std::max<size_t>(rank, 1), values.size());
+	return values[rank - 1];
+}
+
+size_t peakRssBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+				  sizeof(counters))) {
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	// Bytes on macOS
+	return (size_t)usage.ru_maxrss;
+#else
+	// Kilobytes on Linux
+	return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+std::vector<std::string> availableProviders()
+{
+	// Mirrors the providers createOrtSession can append on this platform
+	std::vector<std::string> providers = {USEGPU_CPU};
+#if defined(__linux__) && defined(__x86_64__) && \
+	!defined(DISABLE_ONNXRUNTIME_GPU)
+	providers.push_back(USEGPU_CUDA);
+	providers.push_back(USEGPU_TENSORRT);
+#endif
+#ifdef _WIN32
+	providers.push_back(USEGPU_DML);
+#endif
+#if defined(__APPLE__)
+	providers.push_back(USEGPU_COREML);
+#endif
+	return providers;
+}
+
+std::string jsonEscape(const std::string &text)
+{
+	std::string escaped;
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		} else if ((unsigned char)c < 0x20) {
+			escaped += ' ';
+		} else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+std::vector<std::string> splitList(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		if (!item.empty()) {
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+/**
+  * @brief Synthetic camera frames: a noisy gradient with a moving blob
+*/
+std::vector<cv::Mat> makeFrames(uint32_t width, uint32_t height, int count)
+{
+	std::vector<cv::Mat> frames;
+	cv::RNG rng(0x5eed);
+	for (int i = 0; i < count; i++) {
+		cv::Mat frame(height, width, CV_8UC4);
+		for (uint32_t y = 0; y < height; y++) {
+			uint8_t *row = frame.ptr<uint8_t>(y);
+			for (uint32_t x = 0; x < width; x++) {
+				row[x * 4 + 0] = (uint8_t)(x * 255 / width);
+				row[x * 4 + 1] = (uint8_t)(y * 255 / height);
+				row[x * 4 + 2] = 128;
+				row[x * 4 + 3] = 255;
+			}
+		}
+		cv::Mat noise(height, width, CV_8UC4);
+		rng.fill(noise, cv::RNG::UNIFORM, 0, 32);
+		frame += noise;
+		const cv::Point center((int)(width / 2 + (i - count / 2) * 8),
+				       (int)(height / 2));
+		cv::ellipse(frame, center,
+			    cv::Size((int)width / 6, (int)height / 3), 0, 0,
+			    360, cv::Scalar(60, 90, 200, 255), -1);
+		frames.push_back(frame);
+	}
+	return frames;
+}
+
+void writeStage(std::ostream &out, const char *name,
+		const std::vector<double> &samples, bool last)
+{
+	double mean = 0.0;
+	for (double sample : samples) {
+		mean += sample;
+	}
+	if (!samples.empty()) {
+		mean /= (double)samples.size();
+	}
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer),
+		 "        \"%s\": {\"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+		 "\"mean_ms\": %.3f}%s\n",
+		 name, percentile(samples, 0.50), percentile(samples, 0.99),
+		 mean, last ? "" : ",");
+	out << buffer;
+}
+
+/**
+  * @brief Run one model / provider / thread count combination and write its JSON
+  * result object
+*/
+void runBenchmark(const BenchModel &benchModel, const std::string &provider,
+		  uint32_t numThreads, const BenchOptions &options,
+		  std::ostream &out)
+{
+	out << "    {\n";
+	out << "      \"model\": \"" << benchModel.name << "\",\n";
+	out << "      \"model_path\": \"" << benchModel.path << "\",\n";
+	out << "      \"provider\": \"" << provider << "\",\n";
+	out << "      \"num_threads\": " << numThreads << ",\n";
+
+	std::unique_ptr<filter_data> tf(new filter_data());
+	tf->useGPU = provider;
+	tf->numThreads = numThreads;
+	tf->modelSelection = benchModel.path;
+	tf->model.reset(benchModel.create());
+
+	const int result = createOrtSession(tf.get());
+	if (result != OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+		out << "      \"error\": \"createOrtSession failed (" << result
+		    << ")\"\n";
+		out << "    }";
+		return;
+	}
+
+	uint32_t inputWidth, inputHeight;
+	tf->model->getNetworkInputSize(tf->inputDims, inputWidth, inputHeight);
+
+	// Frames arrive already shrunk to the model input size, as they do
+	// from the GPU readback
+	std::vector<cv::Mat> frames =
+		makeFrames(options.width, options.height, 8);
+	const uint32_t readbackWidth = tf->readbackWidth;
+	const uint32_t readbackHeight = tf->readbackHeight;
+	if (readbackWidth > 0 && readbackHeight > 0 &&
+	    readbackWidth <= options.width &&
+	    readbackHeight <= options.height) {
+		for (cv::Mat &frame : frames) {
+			cv::resize(frame, frame,
+				   cv::Size(readbackWidth, readbackHeight));
+		}
+	}
+
+	StageSamples samples;
+	MaskRefinement refinement;
+	MaskRefinementScratch refinementScratch;
+	cv::Mat backgroundMask, lastBackgroundMask, outputImage;
+	try {
+		for (int i = 0; i < options.warmup + options.iterations; i++) {
+			const cv::Mat &frame = frames[i % frames.size()];
+
+			// The same steps as runFilterModelInference and
+			// runFilterModelInferenceToMask, timed one by one
+			const Clock::time_point start = Clock::now();
+			loadNetworkInput(tf.get(), frame);
+			const Clock::time_point preprocessed = Clock::now();
+			runLoadedNetwork(tf.get());
+			const Clock::time_point inferred = Clock::now();
+			if (benchModel.segmentation) {
+				postprocessTensorToMask(
+					tf->outputTensorValues[0].data(),
+					tf->model->getOutputPostprocessing(
+						tf->outputDims),
+					refinement.enableThreshold,
+					(uint8_t)(refinement.threshold * 255.0f),
+					backgroundMask);
+			} else {
+				const cv::Mat networkOutput =
+					tf->model->getNetworkOutput(
+						tf->outputDims,
+						tf->outputTensorValues);
+				tf->model->postprocessOutput(
+					networkOutput, tf->scratch.output);
+				tf->scratch.output.convertTo(outputImage,
+							     CV_8U, 255.0);
+			}
+			const Clock::time_point postprocessed = Clock::now();
+			if (benchModel.segmentation &&
+			    !backgroundMask.empty()) {
+				refineBackgroundMask(refinement, options.width,
+						     options.height,
+						     backgroundMask,
+						     lastBackgroundMask,
+						     refinementScratch);
+			}
+			const Clock::time_point refined = Clock::now();
+
+			if (i < options.warmup) {
+				continue;
+			}
+			samples.preprocess.push_back(
+				millisecondsBetween(start, preprocessed));
+			samples.sessionRun.push_back(
+				millisecondsBetween(preprocessed, inferred));
+			samples.postprocess.push_back(
+				millisecondsBetween(inferred, postprocessed));
+			samples.maskRefinement.push_back(
+				millisecondsBetween(postprocessed, refined));
+			samples.total.push_back(
+				millisecondsBetween(start, refined));
+		}
+	} catch (const std::exception &e) {
+		out << "      \"error\": \"" << jsonEscape(e.what())
+		    << "\"\n";
+		out << "    }";
+		return;
+	}
+
+	out << "      \"input_width\": " << inputWidth << ",\n";
+	out << "      \"input_height\": " << inputHeight << ",\n";
+	out << "      \"stages\": {\n";
+	writeStage(out, "preprocess", samples.preprocess, false);
+	writeStage(out, "session_run", samples.sessionRun, false);
+	writeStage(out, "postprocess", samples.postprocess, false);
+	writeStage(out, "mask_refinement", samples.maskRefinement, false);
+	writeStage(out, "total", samples.total, true);
+	out << "      },\n";
+	out << "      \"peak_rss_bytes\": " << peakRssBytes() << "\n";
+	out << "    }";
+}
+
+// Masks are compared and saved at most this wide
+static const uint32_t REPLAY_MASK_WIDTH = 320;
+
+/**
+  * @brief The mask of the whole source as drawn by render, binarized at 0.5:
+  * 0 for the foreground, 255 for the background, which also fills the source
+  * outside the mask's region
+*/
+void composeSourceMask(const cv::Mat &mask, const cv::Rect &roi,
+		       uint32_t sourceWidth, uint32_t sourceHeight,
+		       cv::Mat &sourceMask)
+{
+	sourceMask.setTo(255);
+	if (mask.empty()) {
+		return;
+	}
+	const double scaleX = (double)sourceMask.cols / (double)sourceWidth;
+	const double scaleY = (double)sourceMask.rows / (double)sourceHeight;
+	const cv::Rect region =
+		cv::Rect(cvRound(roi.x * scaleX), cvRound(roi.y * scaleY),
+			 cvRound(roi.width * scaleX),
+			 cvRound(roi.height * scaleY)) &
+		cv::Rect(0, 0, sourceMask.cols, sourceMask.rows);
+	if (region.empty()) {
+		return;
+	}
+	cv::Mat target = sourceMask(region);
+	cv::resize(mask, target, region.size(), 0, 0, cv::INTER_LINEAR);
+	cv::threshold(target, target, 127, 255, cv::THRESH_BINARY);
+}
+
+/**
+  * @brief Intersection over union of the foregrounds of two source masks, 1
+  * if both are empty
+*/
+double maskIou(const cv::Mat &mask, const cv::Mat &reference)
+{
+	uint64_t intersection = 0;
+	uint64_t united = 0;
+	for (int y = 0; y < mask.rows; y++) {
+		const uint8_t *maskRow = mask.ptr<uint8_t>(y);
+		const uint8_t *referenceRow = reference.ptr<uint8_t>(y);
+		for (int x = 0; x < mask.cols; x++) {
+			const bool a = maskRow[x] < 128;
+			const bool b = referenceRow[x] < 128;
+			intersection += a && b;
+			united += a || b;
+		}
+	}
+	return united == 0 ? 1.0 : (double)intersection / (double)united;
+}
+
+/**
+  * @brief Load a replayed segmentation model into tf and create its session
+  *
+  * @return false if the model is unknown, not a segmentation model or its
+  * session failed
+*/
+bool loadReplayModel(filter_data *tf, const std::string &name,
+		     const BenchOptions &options)
+{
+	auto benchModel = std::find_if(
+		benchModels.begin(), benchModels.end(),
+		[&](const BenchModel &m) { return name == m.name; });
+	if (benchModel == benchModels.end() || !benchModel->segmentation) {
+		fprintf(stderr, "Replay needs a segmentation model, not %s\n",
+			name.c_str());
+		return false;
+	}
+
+	tf->useGPU = options.providers[0];
+	tf->numThreads = options.threads[0];
+	tf->modelSelection = benchModel->path;
+	tf->model.reset(benchModel->create());
+	const int result = createOrtSession(tf);
+	if (result != OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+		fprintf(stderr, "createOrtSession failed (%d)\n", result);
+		return false;
+	}
+	tf->modelInstalled = true;
+	return true;
+}
+
+/**
+  * @brief Feed a recorded raw BGRA stream through the background filter's frame
+  * pipeline and write the JSON result
+  *
+  * Runs the filter's own steps from background-mask.h on every frame: the
+  * mask warp, the similarity gate, the mask scheduler, inference, the cascade
+  * refiner, the ROI tracker, temporal smoothing, contour filter and feather.
+  * The readback crop and shrink are done on the CPU. Inference runs inline
+  * instead of on the worker threads, the refiner before the mask of its frame,
+  * so every frame sees the mask of the last frame that was processed and runs
+  * are repeatable.
+  *
+  * @return The exit code
+*/
+int runReplay(const BenchOptions &options, std::ostream &out)
+{
+	const std::string modelName =
+		options.models.empty() ? "mediapipe" : options.models[0];
+
+	std::ifstream input(options.replayPath, std::ios::binary);
+	if (!input) {
+		fprintf(stderr, "Cannot read %s\n", options.replayPath.c_str());
+		return 1;
+	}
+	std::ifstream reference;
+	if (!options.referencePath.empty()) {
+		reference.open(options.referencePath, std::ios::binary);
+		if (!reference) {
+			fprintf(stderr, "Cannot read %s\n",
+				options.referencePath.c_str());
+			return 1;
+		}
+	}
+	std::ofstream savedMasks;
+	if (!options.saveMasksPath.empty()) {
+		savedMasks.open(options.saveMasksPath, std::ios::binary);
+		if (!savedMasks) {
+			fprintf(stderr, "Cannot write %s\n",
+				options.saveMasksPath.c_str());
+			return 1;
+		}
+	}
+
+	// The filter's settings are its defaults except for the options
+	std::unique_ptr<background_mask_pipeline> tf(
+		new background_mask_pipeline());
+	if (!loadReplayModel(tf.get(), modelName, options)) {
+		return 1;
+	}
+	tf->roiTracker.setEnabled(options.enableRoi);
+	tf->roiTracker.setFullFrameInterval(DEFAULT_ROI_FULL_FRAME_INTERVAL);
+	tf->enableImageSimilarity = options.enableSimilarity;
+	tf->adaptiveMaskRate = options.adaptiveMaskRate;
+	tf->maskEveryXFrames = options.maskEveryXFrames;
+	tf->warpMask = options.warpMask;
+	updateMaskSchedule(tf.get());
+	if (!options.cascadeModel.empty()) {
+		tf->refiner = std::make_shared<filter_data>();
+		if (!loadReplayModel(tf->refiner.get(), options.cascadeModel,
+				     options)) {
+			return 1;
+		}
+	}
+
+	const uint32_t width = options.width;
+	const uint32_t height = options.height;
+	const cv::Rect fullFrame(0, 0, (int)width, (int)height);
+	const double maskScale =
+		std::min(1.0, (double)REPLAY_MASK_WIDTH / (double)width);
+	const cv::Size maskSize(std::max(1, cvRound(width * maskScale)),
+				std::max(1, cvRound(height * maskScale)));
+
+	// Count the pixel buffers too from here on
+	setAllocationCounting(true);
+
+	cv::Mat source(height, width, CV_8UC4);
+	Frame frame;
+	frame.sourceWidth = width;
+	frame.sourceHeight = height;
+	cv::Mat publishedMask;
+	cv::Rect publishedRoi = fullFrame;
+	cv::Mat sourceMask(maskSize, CV_8UC1), referenceMask(maskSize, CV_8UC1);
+
+	std::vector<double> frameLatency, maskLatency, allocations, ious;
+	int frames = 0, masks = 0;
+	try {
+		while (input.read(reinterpret_cast<char *>(source.data),
+				  (std::streamsize)source.total() * 4)) {
+			const bool measured = frames >= options.warmup;
+
+			// Readback: the region of interest, shrunk to the
+			// larger model input as the GPU does. Not timed, the
+			// GPU does it in the filter.
+			uint32_t readbackWidth = tf->readbackWidth;
+			uint32_t readbackHeight = tf->readbackHeight;
+			if (tf->refiner) {
+				readbackWidth = std::max<uint32_t>(
+					readbackWidth,
+					tf->refiner->readbackWidth);
+				readbackHeight = std::max<uint32_t>(
+					readbackHeight,
+					tf->refiner->readbackHeight);
+			}
+			const bool shrink = readbackWidth > 0 &&
+					    readbackHeight > 0 &&
+					    readbackWidth <= width &&
+					    readbackHeight <= height;
+			frame.sourceRoi =
+				shrink ? tf->roiTracker.nextReadbackRoi(width,
+									height)
+				       : fullFrame;
+			if (shrink) {
+				cv::resize(source(frame.sourceRoi),
+					   frame.imageBGRA,
+					   cv::Size(readbackWidth,
+						    readbackHeight),
+					   0, 0, cv::INTER_AREA);
+			} else {
+				source.copyTo(frame.imageBGRA);
+			}
+
+			const uint64_t allocationsBefore =
+				allocationCount + getAllocationCount();
+			const Clock::time_point start = Clock::now();
+			makeThumbnail(frame.imageBGRA, frame.thumbnail);
+			tf->maskScheduler.addFrameInterval(
+				(float)(1.0 / options.fps));
+
+			const BackgroundFrameGate gate =
+				gateBackgroundFrame(tf.get(), frame);
+			if (gate.refine) {
+				calculateCascadeMask(tf.get(), frame);
+			}
+			const bool inferred =
+				gate.infer &&
+				calculateBackgroundMask(tf.get(), frame);
+			if (inferred) {
+				masks++;
+			}
+
+			const Clock::time_point end = Clock::now();
+			const uint64_t allocationsAfter =
+				allocationCount + getAllocationCount();
+			if (measured) {
+				const double latency =
+					millisecondsBetween(start, end);
+				frameLatency.push_back(latency);
+				if (inferred) {
+					maskLatency.push_back(latency);
+				}
+				allocations.push_back(
+					(double)(allocationsAfter -
+						 allocationsBefore));
+			}
+
+			// Quality, outside of the timed part. The mask render
+			// would upload, warped or not.
+			if (tf->backgroundMaskUpdated) {
+				tf->backgroundMaskUpdated = false;
+				tf->backgroundMask.copyTo(publishedMask);
+				const cv::Rect2f &region =
+					tf->backgroundMaskRegion;
+				publishedRoi = cv::Rect(
+					cvRound(region.x * (float)width),
+					cvRound(region.y * (float)height),
+					cvRound(region.width * (float)width),
+					cvRound(region.height *
+						(float)height));
+			}
+			composeSourceMask(publishedMask, publishedRoi, width,
+					  height, sourceMask);
+			if (savedMasks.is_open()) {
+				savedMasks.write(
+					reinterpret_cast<const char *>(
+						sourceMask.data),
+					(std::streamsize)sourceMask.total());
+			}
+			if (reference.is_open() &&
+			    reference.read(reinterpret_cast<char *>(
+						   referenceMask.data),
+					   (std::streamsize)
+						   referenceMask.total())) {
+				ious.push_back(
+					maskIou(sourceMask, referenceMask));
+			}
+			frames++;
+		}
+	} catch (const std::exception &e) {
+		setAllocationCounting(false);
+		fprintf(stderr, "Replay failed: %s\n", e.what());
+		return 1;
+	}
+	setAllocationCounting(false);
+
+	double allocationsMean = 0.0, allocationsMax = 0.0;
+	for (double count : allocations) {
+		allocationsMean += count;
+		allocationsMax = std::max(allocationsMax, count);
+	}
+	if (!allocations.empty()) {
+		allocationsMean /= (double)allocations.size();
+	}
+	double iouMean = 0.0, iouMin = 1.0;
+	for (double iou : ious) {
+		iouMean += iou;
+		iouMin = std::min(iouMin, iou);
+	}
+	if (!ious.empty()) {
+		iouMean /= (double)ious.size();
+	}
+
+	uint32_t inputWidth, inputHeight;
+	tf->model->getNetworkInputSize(tf->inputDims, inputWidth, inputHeight);
+	char buffer[256];
+	out << "  \"results\": [\n";
+	out << "    {\n";
+	out << "      \"replay\": \"" << jsonEscape(options.replayPath)
+	    << "\",\n";
+	out << "      \"model\": \"" << modelName << "\",\n";
+	out << "      \"provider\": \"" << tf->useGPU << "\",\n";
+	out << "      \"num_threads\": " << tf->numThreads << ",\n";
+	out << "      \"input_width\": " << inputWidth << ",\n";
+	out << "      \"input_height\": " << inputHeight << ",\n";
+	out << "      \"roi\": " << (options.enableRoi ? "true" : "false")
+	    << ",\n";
+	out << "      \"similarity\": "
+	    << (options.enableSimilarity ? "true" : "false") << ",\n";
+	out << "      \"adaptive_mask_rate\": "
+	    << (options.adaptiveMaskRate ? "true" : "false") << ",\n";
+	out << "      \"mask_every_x_frames\": " << options.maskEveryXFrames
+	    << ",\n";
+	out << "      \"warp_mask\": " << (options.warpMask ? "true" : "false")
+	    << ",\n";
+	out << "      \"cascade_model\": \"" << options.cascadeModel << "\",\n";
+	out << "      \"frames\": " << frames << ",\n";
+	out << "      \"masks\": " << masks << ",\n";
+	out << "      \"similarity_skips\": " << tf->stats.similaritySkips
+	    << ",\n";
+	out << "      \"scheduled_skips\": " << tf->stats.scheduledSkips
+	    << ",\n";
+	out << "      \"stages\": {\n";
+	writeStage(out, "frame", frameLatency, false);
+	writeStage(out, "mask_frame", maskLatency, true);
+	out << "      },\n";
+	snprintf(buffer, sizeof(buffer),
+		 "      \"allocations_per_frame\": {\"mean\": %.1f, "
+		 "\"max\": %.0f},\n",
+		 allocationsMean, allocationsMax);
+	out << buffer;
+	if (reference.is_open()) {
+		snprintf(buffer, sizeof(buffer),
+			 "      \"mask_iou\": {\"mean\": %.4f, \"min\": %.4f, "
+			 "\"frames\": %zu},\n",
+			 iouMean, iouMin, ious.size());
+		out << buffer;
+	}
+	out << "      \"peak_rss_bytes\": " << peakRssBytes() << "\n";
+	out << "    }\n";
+	out << "  ]\n";
+	return 0;
+}
+
+bool parseOptions(int argc, char **argv, BenchOptions &options)
+{
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--verbose") {
+			obs_shim_set_log_level(LOG_DEBUG);
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value for %s\n", arg.c_str());
+			return false;
+		}
+		const std::string value = argv[++i];
+		if (arg == "--data") {
+			options.dataPath = value;
+		} else if (arg == "--models") {
+			options.models = splitList(value);
+		} else if (arg == "--providers") {
+			options.providers = splitList(value);
+		} else if (arg == "--threads") {
+			options.threads.clear();
+			for (const std::string &item : splitList(value)) {
+				options.threads.push_back(
+					(uint32_t)std::stoul(item));
+			}
+		} else if (arg == "--warmup") {
+			options.warmup = std::stoi(value);
+		} else if (arg == "--iterations") {
+			options.iterations = std::stoi(value);
+		} else if (arg == "--size") {
+			if (sscanf(value.c_str(), "%ux%u", &options.width,
+				   &options.height) != 2) {
+				fprintf(stderr, "Invalid size %s\n",
+					value.c_str());
+				return false;
+			}
+		} else if (arg == "--output") {
+			options.outputPath = value;
+		} else if (arg == "--replay") {
+			options.replayPath = value;
+		} else if (arg == "--reference") {
+			options.referencePath = value;
+		} else if (arg == "--save-masks") {
+			options.saveMasksPath = value;
+		} else if (arg == "--fps") {
+			options.fps = std::stod(value);
+		} else if (arg == "--roi") {
+			options.enableRoi = std::stoi(value) != 0;
+		} else if (arg == "--similarity") {
+			options.enableSimilarity = std::stoi(value) != 0;
+		} else if (arg == "--adaptive") {
+			options.adaptiveMaskRate = std::stoi(value) != 0;
+		} else if (arg == "--mask-every") {
+			options.maskEveryXFrames = std::stoi(value);
+		} else if (arg == "--warp") {
+			options.warpMask = std::stoi(value) != 0;
+		} else if (arg == "--cascade") {
+			options.cascadeModel = value;
+		} else {
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+	if (options.providers.empty()) {
+		options.providers = availableProviders();
+	}
+	if (options.threads.empty() || options.iterations <= 0 ||
+	    options.warmup < 0 || options.width == 0 || options.height == 0 ||
+	    options.fps <= 0.0 || options.maskEveryXFrames < 1) {
+		fprintf(stderr, "Invalid options\n");
+		return false;
+	}
+	return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	try {
+		if (!parseOptions(argc, argv, options)) {
+			fprintf(stderr,
+				"Usage: %s [--data <dir>] [--models <name,...>] "
+				"[--providers <name,...>] [--threads <n,...>] "
+				"[--warmup <n>] [--iterations <n>] "
+				"[--size <w>x<h>] [--output <file>] "
+				"[--verbose]\n"
+				"       %s --replay <file> --size <w>x<h> "
+				"[--fps <n>] [--roi <0|1>] "
+				"[--similarity <0|1>] [--adaptive <0|1>] "
+				"[--mask-every <n>] [--warp <0|1>] "
+				"[--cascade <name>] [--save-masks <file>] "
+				"[--reference <file>] [--models <name>] "
+				"...\n",
+				argv[0],
+				argv[0]);
+			return 1;
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "Invalid option value: %s\n", e.what());
+		return 1;
+	}
+	obs_shim_set_data_path(options.dataPath.c_str());
+
+	std::ofstream outputFile;
+	if (!options.outputPath.empty()) {
+		outputFile.open(options.outputPath);
+		if (!outputFile) {
+			fprintf(stderr, "Cannot write %s\n",
+				options.outputPath.c_str());
+			return 1;
+		}
+	}
+	std::ostream &out = outputFile.is_open() ? outputFile : std::cout;
+
+	out << "{\n";
+	out << "  \"version\": \"" << PLUGIN_VERSION << "\",\n";
+	out << "  \"ort_version\": \"" << Ort::GetVersionString() << "\",\n";
+	out << "  \"source_width\": " << options.width << ",\n";
+	out << "  \"source_height\": " << options.height << ",\n";
+	out << "  \"warmup\": " << options.warmup << ",\n";
+	if (!options.replayPath.empty()) {
+		out << "  \"mode\": \"replay\",\n";
+		const int exitCode = runReplay(options, out);
+		out << "}\n";
+		return exitCode;
+	}
+	out << "  \"iterations\": " << options.iterations << ",\n";
+	out << "  \"results\": [\n";
+
+	bool first = true;
+	for (const BenchModel &benchModel : benchModels) {
+		if (!options.models.empty() &&
+		    std::find(options.models.begin(), options.models.end(),
+			      benchModel.name) == options.models.end()) {
+			continue;
+		}
+		for (const std::string &provider : options.providers) {
+			// The thread count only applies to the CPU provider
+			const size_t threadRuns =
+				(provider == USEGPU_CPU) ? options.threads.size()
+							 : 1;
+			for (size_t t = 0; t < threadRuns; t++) {
+				fprintf(stderr, "Running %s on %s, %u threads\n",
+					benchModel.name, provider.c_str(),
+					options.threads[t]);
+				if (!first) {
+					out << ",\n";
+				}
+				first = false;
+				runBenchmark(benchModel, provider,
+					     options.threads[t], options, out);
+			}
+		}
+	}
+
+	out << "\n  ]\n";
+	out << "}\n";
+	return 0;
+}
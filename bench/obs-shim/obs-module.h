@@ -0,0 +1,64 @@
+#ifndef OBS_SHIM_OBS_MODULE_H
+#define OBS_SHIM_OBS_MODULE_H
+
+/*
+ * Minimal stand-in for the parts of libobs that the model and ORT session code
+ * touches, so the benchmark can link them without OBS. Graphics and source
+ * handles are opaque and never dereferenced outside of the filters.
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	LOG_ERROR = 100,
+	LOG_WARNING = 200,
+	LOG_INFO = 300,
+	LOG_DEBUG = 400,
+};
+
+#define UNUSED_PARAMETER(param) (void)param
+
+typedef struct obs_source obs_source_t;
+typedef struct gs_texture_render gs_texrender_t;
+typedef struct gs_stage_surface gs_stagesurf_t;
+typedef struct gs_effect gs_effect_t;
+
+void blogva(int log_level, const char *format, va_list args);
+
+/**
+  * @brief Resolve a plugin data file against the benchmark data directory
+  *
+  * @return The path, to be freed with bfree, or NULL if the file does not exist
+*/
+char *obs_module_file(const char *file);
+
+/**
+  * @brief Resolve a plugin config file in a benchmark directory under the
+  * system temporary directory
+  *
+  * @return The path, to be freed with bfree
+*/
+char *obs_module_config_path(const char *file);
+
+void bfree(void *ptr);
+
+/**
+  * @brief Set the directory obs_module_file resolves against
+*/
+void obs_shim_set_data_path(const char *path);
+
+/**
+  * @brief Only print messages at or above this level
+*/
+void obs_shim_set_log_level(int log_level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OBS_SHIM_OBS_MODULE_H */
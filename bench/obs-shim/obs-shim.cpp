@@ -0,0 +1,80 @@
+#include <obs-module.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include "obs-utils/obs-config-utils.h"
+
+static std::string dataPath = ".";
+static int logLevel = LOG_WARNING;
+
+void obs_shim_set_data_path(const char *path)
+{
+	dataPath = path;
+}
+
+void obs_shim_set_log_level(int log_level)
+{
+	logLevel = log_level;
+}
+
+void blogva(int log_level, const char *format, va_list args)
+{
+	if (log_level > logLevel) {
+		return;
+	}
+	vfprintf(stderr, format, args);
+	fputc('\n', stderr);
+}
+
+char *obs_module_file(const char *file)
+{
+	const std::filesystem::path path =
+		std::filesystem::path(dataPath) / file;
+	if (!std::filesystem::exists(path)) {
+		return nullptr;
+	}
+	const std::string pathString = path.string();
+	char *result = (char *)malloc(pathString.size() + 1);
+	if (result) {
+		memcpy(result, pathString.c_str(), pathString.size() + 1);
+	}
+	return result;
+}
+
+char *obs_module_config_path(const char *file)
+{
+	const std::filesystem::path path =
+		std::filesystem::temp_directory_path() /
+		"obs-backgroundremoval-bench" / (file ? file : "");
+	const std::string pathString = path.string();
+	char *result = (char *)malloc(pathString.size() + 1);
+	if (result) {
+		memcpy(result, pathString.c_str(), pathString.size() + 1);
+	}
+	return result;
+}
+
+void bfree(void *ptr)
+{
+	free(ptr);
+}
+
+// The benchmark has no module config: every item takes its default
+
+int getFlagFromConfig(const char *name, bool *returnValue, bool defaultValue)
+{
+	UNUSED_PARAMETER(name);
+	*returnValue = defaultValue;
+	return OBS_BGREMOVAL_CONFIG_FAIL;
+}
+
+int getIntFromConfig(const char *name, int *returnValue, int defaultValue)
+{
+	UNUSED_PARAMETER(name);
+	*returnValue = defaultValue;
+	return OBS_BGREMOVAL_CONFIG_FAIL;
+}
@@ -3,8 +3,19 @@
 
 #include <obs-module.h>
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "models/Model.h"
 #include "ort-utils/ORTModelData.h"
+#include "image-utils/frame-ring.h"
+#include "image-utils/roi-tracker.h"
+#include "perf-utils/filter-stats.h"
+
+struct InferenceBatchMember;
+struct ModelSwapRequest;
 
 /**
   * @brief The filter_data struct
@@ -15,19 +26,91 @@
 struct filter_data : public ORTModelData {
 	std::string useGPU;
 	uint32_t numThreads;
+	// Threads for full-resolution image work, 0 for automatic
+	uint32_t postProcessThreads = 0;
+	// Set when the session's threads no longer match the filter's share of
+	// the CPU budget, see perf-utils/core-budget.h
+	std::atomic<bool> coreBudgetChanged{false};
 	std::string modelSelection;
 	std::unique_ptr<Model> model;
+	// Whether model holds a model with a session, for the threads that
+	// can't take modelMutex. Set with modelMutex held.
+	std::atomic<bool> modelInstalled{false};
 
 	obs_source_t *source;
 	gs_texrender_t *texrender;
-	gs_stagesurf_t *stagesurface;
+	// Ring of stage surfaces for pipelined GPU readback, see getRGBAFromStageSurface
+	std::vector<gs_stagesurf_t *> stagesurfaces;
+	std::vector<uint64_t> stagesurfaceFrames;
+	std::vector<cv::Rect> stagesurfaceRois;
+	size_t stagesurfaceIndex = 0;
+	uint64_t stagedFrameCount = 0;
+	uint64_t mappedFrame = 0;
+	uint32_t readbackDepth = 2;
+	// Model-sized target the source is scaled into before staging
+	gs_texrender_t *readbackTexrender = nullptr;
+	bool gpuDownscale = true;
+	// Also make a thumbnail of every frame, see change-detection.h
+	bool readbackThumbnail = false;
+	// Take frames from the readback of the unfiltered source when another
+	// filter of this plugin reads it, see obs-utils/shared-readback.h
+	bool shareReadback = false;
+	// Picks the region of the source to read back. Needs gpuDownscale.
+	RoiTracker roiTracker;
 
-	cv::Mat inputBGRA;
+	// Frames read back from the GPU, newest first. See getRGBAFromStageSurface
+	FrameRing frameRing;
+	// Size frames are downscaled to during readback, 0 to keep the source size
+	std::atomic<uint32_t> readbackWidth;
+	std::atomic<uint32_t> readbackHeight;
+	// Frames are read back at least this large, for a second model that
+	// consumes them, 0 for no minimum
+	std::atomic<uint32_t> readbackMinWidth{0};
+	std::atomic<uint32_t> readbackMinHeight{0};
 
-	bool isDisabled;
+	std::atomic<bool> isDisabled;
+	// Set by resetRecurrentState, see ort-utils/ort-session-utils.h
+	std::atomic<bool> recurrentStateResetPending{false};
 
-	std::mutex inputBGRALock;
 	std::mutex outputLock;
+	std::mutex modelMutex;
+
+	// Inference worker thread, see ort-utils/inference-worker.h
+	std::thread inferenceThread;
+	std::mutex inferenceThreadMutex;
+	std::condition_variable inferenceThreadCondition;
+	bool inferenceThreadStop = false;
+	FramePtr pendingFrame;
+
+	// Batch inference with other filters on the same session, see
+	// ort-utils/inference-batch.h
+	bool batchInference = false;
+	std::shared_ptr<InferenceBatchMember> inferenceBatchMember;
+
+	// Background model switches, see ort-utils/model-swap.h
+	std::thread modelSwapThread;
+	std::mutex modelSwapMutex;
+	std::condition_variable modelSwapCondition;
+	bool modelSwapStop = false;
+	bool modelSwapBuilding = false;
+	std::shared_ptr<ModelSwapRequest> pendingModelSwap;
+	// Set while the model is released, which keeps the model to load when
+	// the source is used again
+	std::atomic<bool> modelSwapReleased{false};
+	std::shared_ptr<ModelSwapRequest> releasedModelSwap;
+	// Set when a build failed and left the filter without a model, until
+	// a session is installed
+	std::atomic<bool> modelSwapFailed{false};
+	// Seconds the source may go unrendered before its model is released, 0
+	// to keep it loaded
+	std::atomic<uint32_t> releaseInactiveAfter{0};
+	std::atomic<uint64_t> lastUsedNs{0};
+	// The model and device last asked for by the settings, only used by the
+	// update callback
+	OrtSessionConfig requestedSession;
+
+	// Pipeline counters, reported by obs-utils/stats-handler.h
+	FilterStats stats;
 
 #if _WIN32
 	std::wstring modelFilepath;
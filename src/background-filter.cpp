@@ -8,6 +8,8 @@
 
 #include <opencv2/imgproc.hpp>
 
+#include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <memory>
 #include <exception>
@@ -26,39 +28,69 @@
 #include "models/ModelTCMonoDepth.h"
 #include "models/ModelRMBG.h"
 #include "FilterData.h"
+#include "background-mask.h"
 #include "ort-utils/ort-session-utils.h"
+#include "ort-utils/inference-worker.h"
+#include "ort-utils/inference-batch.h"
+#include "ort-utils/model-swap.h"
+#include "image-utils/background-plate.h"
+#include "perf-utils/stage-profiler.h"
+#include "perf-utils/mask-scheduler.h"
+#include "perf-utils/core-budget.h"
+#include "perf-utils/worker-pool.h"
 #include "obs-utils/obs-utils.h"
+#include "obs-utils/stats-handler.h"
 #include "consts.h"
 #include "update-checker/update-checker.h"
 
-struct background_removal_filter : public filter_data {
-	bool enableThreshold = true;
-	float threshold = 0.5f;
+// Deepest level of the dual filter blur, 1/64 of the source
+static const int DUAL_KAWASE_MAX_LEVELS = 6;
+// Runs in a row that may fail before a GPU session is given up for the CPU
+static const int CPU_FALLBACK_FAILURES = 3;
+
+// Input resolutions for models that accept any size, see setInputResolution
+struct QualityTier {
+	const char *name;
+	uint32_t width;
+	uint32_t height;
+};
+static const QualityTier QUALITY_TIERS[] = {
+	{"256x144", 256, 144},
+	{"320x192", 320, 192},
+	{"512x288", 512, 288},
+	{"768x432", 768, 432},
+};
+static const int DEFAULT_QUALITY_TIER = 1;
+
+struct background_removal_filter : public background_mask_pipeline {
 	cv::Scalar backgroundColor{0, 0, 0, 0};
-	float contourFilter = 0.05f;
-	float smoothContour = 0.5f;
-	float feather = 0.0f;
-
-	cv::Mat backgroundMask;
-	cv::Mat lastBackgroundMask;
-	cv::Mat lastImageBGRA;
-	float temporalSmoothFactor = 0.0f;
-	float imageSimilarityThreshold = 35.0f;
-	bool enableImageSimilarity = true;
-	int maskEveryXFrames = 1;
-	int maskEveryXFramesCount = 0;
+	int qualityTier = DEFAULT_QUALITY_TIER;
+	// Runs that threw in a row, used by the mask worker only
+	int inferenceFailures = 0;
 	int64_t blurBackground = 0;
 	bool enableFocalBlur = false;
+	bool fastBlur = false;
 	float blurFocusPoint = 0.1f;
 	float blurFocusDepth = 0.1f;
 
 	gs_effect_t *effect;
 	gs_effect_t *kawaseBlurEffect;
-
-	std::mutex modelMutex;
+	gs_texrender_t *maskTexrender = nullptr;
+	gs_texture_t *maskTexture = nullptr;
+	// The Kawase blur passes alternate between these
+	gs_texrender_t *blurTexrenders[2] = {nullptr, nullptr};
+	// Levels of the dual filter blur, 1/2, 1/4, ... of the source
+	gs_texrender_t *blurPyramid[DUAL_KAWASE_MAX_LEVELS] = {};
+	// The background plate, alternating between the two when refreshed
+	gs_texrender_t *plateTexrenders[2] = {nullptr, nullptr};
+	int plateIndex = 0;
+	gs_texture_t *plateRefreshTexture = nullptr;
 };
 
-void background_removal_thread(void *data); // Forward declaration
+static void calculateFilterMask(struct background_removal_filter *tf,
+				const Frame &frame);
+static void calculateFilterCascadeMask(struct background_removal_filter *tf,
+				       const Frame &frame);
 
 const char *background_filter_getname(void *unused)
 {
@@ -101,6 +133,61 @@ static bool enable_image_similarity(obs_properties_t *ppts, obs_property_t *p,
 			       "image_similarity_threshold");
 }
 
+static bool adaptive_mask_rate_modified(obs_properties_t *ppts,
+					obs_property_t *p,
+					obs_data_t *settings)
+{
+	UNUSED_PARAMETER(p);
+	const bool adaptive = obs_data_get_bool(settings, "adaptive_mask_rate");
+	obs_property_set_visible(obs_properties_get(ppts, "inference_budget"),
+				 adaptive);
+	obs_property_set_visible(
+		obs_properties_get(ppts, "mask_every_x_frames"), !adaptive);
+	return true;
+}
+
+static bool enable_roi_modified(obs_properties_t *ppts, obs_property_t *p,
+				obs_data_t *settings)
+{
+	UNUSED_PARAMETER(p);
+	return visible_on_bool(ppts, settings, "enable_roi",
+			       "roi_full_frame_interval");
+}
+
+static bool enable_profiling_modified(obs_properties_t *ppts, obs_property_t *p,
+				      obs_data_t *settings)
+{
+	UNUSED_PARAMETER(p);
+	return visible_on_bool(ppts, settings, "enable_profiling",
+			       "profiling_group");
+}
+
+static bool model_select_modified(obs_properties_t *ppts, obs_property_t *p,
+				  obs_data_t *settings)
+{
+	UNUSED_PARAMETER(p);
+	// Only models that accept any input size have quality tiers
+	const bool advanced = obs_data_get_bool(settings, "advanced");
+	const std::string model = obs_data_get_string(settings, "model_select");
+	obs_property_set_visible(obs_properties_get(ppts, "quality_tier"),
+				 advanced && model == MODEL_RVM);
+	return true;
+}
+
+static bool refresh_stage_timings(obs_properties_t *ppts, obs_property_t *p,
+				  void *data)
+{
+	UNUSED_PARAMETER(p);
+	struct background_removal_filter *tf =
+		reinterpret_cast<background_removal_filter *>(data);
+	obs_property_t *timings = obs_properties_get(ppts, "stage_timings");
+	const std::string summary = tf->profiler.summary("\n");
+	obs_property_set_description(
+		timings, summary.empty() ? obs_module_text("NoStageTimings")
+					 : summary.c_str());
+	return true;
+}
+
 static bool enable_advanced_settings(obs_properties_t *ppts, obs_property_t *p,
 				     obs_data_t *settings)
 {
@@ -109,18 +196,31 @@ static bool enable_advanced_settings(obs_properties_t *ppts, obs_property_t *p,
 	obs_property_set_visible(p, true);
 
 	for (const char *prop_name :
-	     {"model_select", "useGPU", "mask_every_x_frames", "numThreads",
+	     {"model_select", "cascade_model", "cascade_every_x_masks",
+	      "useGPU", "adaptive_mask_rate", "inference_budget",
+	      "mask_every_x_frames", "warp_mask",
+	      "numThreads",
+	      "post_process_threads", "readback_depth",
+	      "release_inactive_after", "gpu_downscale", "batch_inference",
+	      "quality_tier", "enable_roi",
+	      "roi_full_frame_interval", "fast_blur", "cache_background",
 	      "enable_focal_blur", "enable_threshold", "threshold_group",
 	      "focal_blur_group", "temporal_smooth_factor",
-	      "image_similarity_threshold", "enable_image_similarity"}) {
+	      "image_similarity_threshold", "enable_image_similarity",
+	      "enable_profiling", "profiling_group"}) {
 		p = obs_properties_get(ppts, prop_name);
 		obs_property_set_visible(p, enabled);
 	}
 
+	model_select_modified(ppts, p, settings);
+
 	if (enabled) {
 		enable_threshold_modified(ppts, p, settings);
 		enable_focal_blur(ppts, p, settings);
 		enable_image_similarity(ppts, p, settings);
+		enable_profiling_modified(ppts, p, settings);
+		adaptive_mask_rate_modified(ppts, p, settings);
+		enable_roi_modified(ppts, p, settings);
 	}
 
 	return true;
@@ -188,11 +288,40 @@ obs_properties_t *background_filter_properties(void *data)
 				     USEGPU_COREML);
 #endif
 
+	obs_property_t *p_adaptive_mask_rate = obs_properties_add_bool(
+		props, "adaptive_mask_rate",
+		obs_module_text("AdaptiveMaskRate"));
+	obs_property_set_modified_callback(p_adaptive_mask_rate,
+					   adaptive_mask_rate_modified);
+	obs_property_t *p_inference_budget = obs_properties_add_int_slider(
+		props, "inference_budget", obs_module_text("InferenceBudget"),
+		10, 100, 5);
+	obs_property_int_set_suffix(p_inference_budget, "%");
 	obs_properties_add_int(props, "mask_every_x_frames",
 			       obs_module_text("CalculateMaskEveryXFrame"), 1,
 			       300, 1);
+	obs_properties_add_bool(props, "warp_mask",
+				obs_module_text("WarpMask"));
 	obs_properties_add_int_slider(props, "numThreads",
 				      obs_module_text("NumThreads"), 0, 8, 1);
+	obs_properties_add_int_slider(props, "post_process_threads",
+				      obs_module_text("PostProcessThreads"), 0,
+				      8, 1);
+	obs_properties_add_int_slider(props, "readback_depth",
+				      obs_module_text("ReadbackDepth"), 1, 4, 1);
+	obs_properties_add_int_slider(props, "release_inactive_after",
+				      obs_module_text("ReleaseInactiveAfter"),
+				      0, 600, 10);
+	obs_properties_add_bool(props, "gpu_downscale",
+				obs_module_text("GPUDownscale"));
+	obs_properties_add_bool(props, "batch_inference",
+				obs_module_text("BatchInference"));
+	obs_property_t *p_enable_roi = obs_properties_add_bool(
+		props, "enable_roi", obs_module_text("EnableROI"));
+	obs_property_set_modified_callback(p_enable_roi, enable_roi_modified);
+	obs_properties_add_int(props, "roi_full_frame_interval",
+			       obs_module_text("ROIFullFrameInterval"), 2, 300,
+			       1);
 
 	/* Model selection Props */
 	obs_property_t *p_model_select = obs_properties_add_list(
@@ -217,6 +346,31 @@ obs_properties_t *background_filter_properties(void *data)
 				     MODEL_DEPTH_TCMONODEPTH);
 	obs_property_list_add_string(p_model_select, obs_module_text("RMBG"),
 				     MODEL_RMBG);
+	obs_property_set_modified_callback(p_model_select,
+					   model_select_modified);
+
+	obs_property_t *p_cascade_model = obs_properties_add_list(
+		props, "cascade_model", obs_module_text("CascadeModel"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(p_cascade_model,
+				     obs_module_text("CascadeNone"), "");
+	obs_property_list_add_string(p_cascade_model,
+				     obs_module_text("Robust Video Matting"),
+				     MODEL_RVM);
+	obs_property_list_add_string(p_cascade_model, obs_module_text("RMBG"),
+				     MODEL_RMBG);
+	obs_properties_add_int_slider(props, "cascade_every_x_masks",
+				      obs_module_text("CascadeEveryXMasks"), 1,
+				      60, 1);
+
+	obs_property_t *p_quality_tier = obs_properties_add_list(
+		props, "quality_tier", obs_module_text("QualityTier"),
+		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	for (int i = 0; i < (int)(sizeof(QUALITY_TIERS) / sizeof(QualityTier));
+	     i++) {
+		obs_property_list_add_int(p_quality_tier, QUALITY_TIERS[i].name,
+					  i);
+	}
 
 	obs_properties_add_float_slider(props, "temporal_smooth_factor",
 					obs_module_text("TemporalSmoothFactor"),
@@ -238,6 +392,11 @@ obs_properties_t *background_filter_properties(void *data)
 		obs_module_text("BlurBackgroundFactor0NoBlurUseColor"), 0, 20,
 		1);
 
+	obs_properties_add_bool(props, "fast_blur",
+				obs_module_text("FastBlur"));
+	obs_properties_add_bool(props, "cache_background",
+				obs_module_text("CacheBackground"));
+
 	obs_property_t *p_enable_focal_blur = obs_properties_add_bool(
 		props, "enable_focal_blur", obs_module_text("EnableFocalBlur"));
 	obs_property_set_modified_callback(p_enable_focal_blur,
@@ -256,6 +415,31 @@ obs_properties_t *background_filter_properties(void *data)
 				 obs_module_text("FocalBlurGroup"),
 				 OBS_GROUP_NORMAL, focal_blur_props);
 
+	/* Stage timing Props */
+	obs_property_t *p_enable_profiling = obs_properties_add_bool(
+		props, "enable_profiling", obs_module_text("EnableProfiling"));
+	obs_property_set_modified_callback(p_enable_profiling,
+					   enable_profiling_modified);
+
+	obs_properties_t *profiling_props = obs_properties_create();
+
+	struct background_removal_filter *tf =
+		reinterpret_cast<background_removal_filter *>(data);
+	const std::string stage_timings =
+		tf ? tf->profiler.summary("\n") : std::string();
+	obs_properties_add_text(profiling_props, "stage_timings",
+				stage_timings.empty()
+					? obs_module_text("NoStageTimings")
+					: stage_timings.c_str(),
+				OBS_TEXT_INFO);
+	obs_properties_add_button(profiling_props, "refresh_stage_timings",
+				  obs_module_text("RefreshStageTimings"),
+				  refresh_stage_timings);
+
+	obs_properties_add_group(props, "profiling_group",
+				 obs_module_text("StageTimingsGroup"),
+				 OBS_GROUP_NORMAL, profiling_props);
+
 	// Add a informative text about the plugin
 	// replace the placeholder with the current version
 	// use std::regex_replace instead of QString::arg because the latter doesn't work on Linux
@@ -270,7 +454,6 @@ obs_properties_t *background_filter_properties(void *data)
 	obs_properties_add_text(props, "info", basic_info.c_str(),
 				OBS_TEXT_INFO);
 
-	UNUSED_PARAMETER(data);
 	return props;
 }
 
@@ -291,18 +474,156 @@ void background_filter_defaults(obs_data_t *settings)
 	obs_data_set_default_string(settings, "useGPU", USEGPU_CPU);
 #endif
 	obs_data_set_default_string(settings, "model_select", MODEL_MEDIAPIPE);
+	obs_data_set_default_int(settings, "quality_tier",
+				 DEFAULT_QUALITY_TIER);
 	obs_data_set_default_int(settings, "mask_every_x_frames", 1);
+	obs_data_set_default_bool(settings, "adaptive_mask_rate", true);
+	obs_data_set_default_bool(settings, "warp_mask", false);
+	obs_data_set_default_string(settings, "cascade_model", "");
+	obs_data_set_default_int(settings, "cascade_every_x_masks",
+				 DEFAULT_CASCADE_EVERY_X_MASKS);
+	obs_data_set_default_int(settings, "inference_budget",
+				 DEFAULT_INFERENCE_BUDGET);
 	obs_data_set_default_int(settings, "blur_background", 0);
+	obs_data_set_default_bool(settings, "fast_blur", false);
+	obs_data_set_default_bool(settings, "cache_background", false);
 	obs_data_set_default_int(settings, "numThreads", 1);
+	obs_data_set_default_int(settings, "post_process_threads", 0);
+	obs_data_set_default_int(settings, "readback_depth", 2);
+	obs_data_set_default_int(settings, "release_inactive_after", 60);
+	obs_data_set_default_bool(settings, "gpu_downscale", true);
+	obs_data_set_default_bool(settings, "batch_inference", false);
+	obs_data_set_default_bool(settings, "enable_roi", false);
+	obs_data_set_default_int(settings, "roi_full_frame_interval",
+				 DEFAULT_ROI_FULL_FRAME_INTERVAL);
+	obs_data_set_default_bool(settings, "enable_profiling", false);
 	obs_data_set_default_bool(settings, "enable_focal_blur", false);
-	obs_data_set_default_double(settings, "temporal_smooth_factor", 0.85);
+	obs_data_set_default_double(settings, "temporal_smooth_factor",
+				    DEFAULT_TEMPORAL_SMOOTH_FACTOR);
 	obs_data_set_default_double(settings, "image_similarity_threshold",
-				    35.0);
+				    DEFAULT_IMAGE_SIMILARITY_THRESHOLD);
 	obs_data_set_default_bool(settings, "enable_image_similarity", true);
 	obs_data_set_default_double(settings, "blur_focus_point", 0.1);
 	obs_data_set_default_double(settings, "blur_focus_depth", 0.0);
 }
 
+/**
+  * @brief The model object for a model_select value
+*/
+static std::unique_ptr<Model> createBackgroundModel(const std::string &name)
+{
+	if (name == MODEL_SINET) {
+		return std::make_unique<ModelSINET>();
+	}
+	if (name == MODEL_SELFIE) {
+		return std::make_unique<ModelSelfie>();
+	}
+	if (name == MODEL_RVM) {
+		return std::make_unique<ModelRVM>();
+	}
+	if (name == MODEL_PPHUMANSEG) {
+		return std::make_unique<ModelPPHumanSeg>();
+	}
+	if (name == MODEL_DEPTH_TCMONODEPTH) {
+		return std::make_unique<ModelTCMonoDepth>();
+	}
+	if (name == MODEL_RMBG) {
+		return std::make_unique<ModelRMBG>();
+	}
+	return std::make_unique<ModelMediaPipe>();
+}
+
+/**
+  * @brief Stop the refinement model of cascade mode, if running
+*/
+static void stopCascade(struct background_removal_filter *tf)
+{
+	std::shared_ptr<filter_data> refiner;
+	{
+		std::lock_guard<std::mutex> lock(tf->cascadeLock);
+		refiner = std::move(tf->refiner);
+		tf->cascadeMask.release();
+		tf->cascadeThumbnail.release();
+	}
+	if (!refiner) {
+		return;
+	}
+	tf->readbackMinWidth = 0;
+	tf->readbackMinHeight = 0;
+
+	stopModelSwapWorker(refiner.get());
+	stopInferenceWorker(refiner.get());
+	leaveCoreBudget(refiner.get());
+}
+
+/**
+  * @brief Start the refinement model of cascade mode
+  *
+  * The refiner is a filter_data of its own, with its own session, model swap
+  * thread and inference worker, fed a frame every cascadeEveryXMasks masks.
+  * Its model is loaded once update requests it.
+*/
+static std::shared_ptr<filter_data>
+startCascade(struct background_removal_filter *tf)
+{
+	std::shared_ptr<filter_data> refiner = std::make_shared<filter_data>();
+	refiner->source = tf->source;
+	refiner->isDisabled = false;
+
+	deferModelLoad(refiner.get());
+	startInferenceWorker(refiner.get(), [tf](const Frame &frame) {
+		calculateFilterCascadeMask(tf, frame);
+	});
+
+	{
+		std::lock_guard<std::mutex> lock(tf->cascadeLock);
+		tf->refiner = refiner;
+		tf->cascadeMaskCount = 0;
+	}
+	// Active with its filter. Joined once published, so an activate
+	// racing with this either sees the refiner or is seen here.
+	joinCoreBudget(refiner.get(), isCoreBudgetActive(tf));
+	return refiner;
+}
+
+/**
+  * @brief Start, stop or switch the refinement model for the settings
+*/
+static void updateCascade(struct background_removal_filter *tf,
+			  const std::string &cascadeModel,
+			  const OrtSessionConfig &session)
+{
+	// A depth map can't be refined with a mask, and refining a model
+	// with itself gains nothing
+	if (cascadeModel.empty() ||
+	    session.modelSelection == MODEL_DEPTH_TCMONODEPTH ||
+	    session.modelSelection == cascadeModel) {
+		stopCascade(tf);
+		return;
+	}
+
+	std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (!refiner) {
+		refiner = startCascade(tf);
+	}
+	refiner->releaseInactiveAfter = (uint32_t)tf->releaseInactiveAfter;
+
+	OrtSessionConfig refinerSession = session;
+	refinerSession.modelSelection = cascadeModel;
+	if (refiner->requestedSession == refinerSession &&
+	    !hasModelSwapFailed(refiner.get())) {
+		return;
+	}
+	refiner->requestedSession = refinerSession;
+
+	// The refiner only runs on some frames, it can afford the finest tier
+	const int tier = (int)(sizeof(QUALITY_TIERS) / sizeof(QualityTier)) - 1;
+	std::unique_ptr<Model> model = createBackgroundModel(cascadeModel);
+	model->setInputResolution(QUALITY_TIERS[tier].width,
+				  QUALITY_TIERS[tier].height);
+	requestModelSwap(refiner.get(), refinerSession, std::move(model));
+}
+
 void background_filter_update(void *data, obs_data_t *settings)
 {
 	obs_log(LOG_INFO, "Background filter updated");
@@ -322,8 +643,14 @@ void background_filter_update(void *data, obs_data_t *settings)
 	tf->feather = (float)obs_data_get_double(settings, "feather");
 	tf->maskEveryXFrames =
 		(int)obs_data_get_int(settings, "mask_every_x_frames");
-	tf->maskEveryXFramesCount = (int)(0);
+	tf->adaptiveMaskRate =
+		obs_data_get_bool(settings, "adaptive_mask_rate");
+	tf->warpMask = obs_data_get_bool(settings, "warp_mask");
+	tf->inferenceBudget =
+		(int)obs_data_get_int(settings, "inference_budget");
+	updateMaskSchedule(tf);
 	tf->blurBackground = obs_data_get_int(settings, "blur_background");
+	tf->fastBlur = obs_data_get_bool(settings, "fast_blur");
 	tf->enableFocalBlur =
 		(float)obs_data_get_bool(settings, "enable_focal_blur");
 	tf->blurFocusPoint =
@@ -336,79 +663,143 @@ void background_filter_update(void *data, obs_data_t *settings)
 		settings, "image_similarity_threshold");
 	tf->enableImageSimilarity =
 		(float)obs_data_get_bool(settings, "enable_image_similarity");
+	tf->readbackDepth =
+		(uint32_t)obs_data_get_int(settings, "readback_depth");
+	tf->releaseInactiveAfter = (uint32_t)obs_data_get_int(
+		settings, "release_inactive_after");
+	tf->postProcessThreads =
+		(uint32_t)obs_data_get_int(settings, "post_process_threads");
+	tf->gpuDownscale = obs_data_get_bool(settings, "gpu_downscale");
+	tf->roiTracker.setEnabled(obs_data_get_bool(settings, "enable_roi"));
+	tf->roiTracker.setFullFrameInterval(
+		(int)obs_data_get_int(settings, "roi_full_frame_interval"));
+	tf->profiler.setEnabled(
+		obs_data_get_bool(settings, "enable_profiling"));
+	// The plate was blurred with the previous settings
+	tf->backgroundPlate.setEnabled(
+		obs_data_get_bool(settings, "cache_background"));
+	tf->backgroundPlate.invalidate();
 
 	const std::string newUseGpu = obs_data_get_string(settings, "useGPU");
 	const std::string newModel =
 		obs_data_get_string(settings, "model_select");
 	const uint32_t newNumThreads =
 		(uint32_t)obs_data_get_int(settings, "numThreads");
+	const bool newBatchInference =
+		obs_data_get_bool(settings, "batch_inference");
+	int newQualityTier = (int)obs_data_get_int(settings, "quality_tier");
+	if (newQualityTier < 0 ||
+	    newQualityTier >=
+		    (int)(sizeof(QUALITY_TIERS) / sizeof(QualityTier))) {
+		newQualityTier = DEFAULT_QUALITY_TIER;
+	}
 
-	if (tf->modelSelection.empty() || tf->modelSelection != newModel ||
-	    tf->useGPU != newUseGpu || tf->numThreads != newNumThreads) {
-		// lock modelMutex
+	OrtSessionConfig newSession;
+	newSession.modelSelection = newModel;
+	newSession.useGPU = newUseGpu;
+	newSession.numThreads = newNumThreads;
+
+	// A model still building was sized for the previous tier
+	// After a failed build, any update tries again
+	const bool sessionChanged =
+		tf->requestedSession != newSession || hasModelSwapFailed(tf) ||
+		(tf->qualityTier != newQualityTier && isModelSwapPending(tf));
+	if (sessionChanged) {
+		{
+			std::unique_lock<std::mutex> lock(tf->modelMutex);
+			tf->batchInference = newBatchInference;
+			tf->qualityTier = newQualityTier;
+		}
+		tf->requestedSession = newSession;
+
+		// Re-initialize model if it's not already the selected one or
+		// switching inference device. The current model keeps running
+		// until the new session is built.
+		std::unique_ptr<Model> model = createBackgroundModel(newModel);
+		model->setInputResolution(
+			QUALITY_TIERS[newQualityTier].width,
+			QUALITY_TIERS[newQualityTier].height);
+		requestModelSwap(tf, newSession, std::move(model));
+	} else if (tf->qualityTier != newQualityTier ||
+		   tf->batchInference != newBatchInference) {
 		std::unique_lock<std::mutex> lock(tf->modelMutex);
 
-		// Re-initialize model if it's not already the selected one or switching inference device
-		tf->modelSelection = newModel;
-		tf->useGPU = newUseGpu;
-		tf->numThreads = newNumThreads;
-
-		if (tf->modelSelection == MODEL_SINET) {
-			tf->model.reset(new ModelSINET);
-		}
-		if (tf->modelSelection == MODEL_SELFIE) {
-			tf->model.reset(new ModelSelfie);
-		}
-		if (tf->modelSelection == MODEL_MEDIAPIPE) {
-			tf->model.reset(new ModelMediaPipe);
-		}
-		if (tf->modelSelection == MODEL_RVM) {
-			tf->model.reset(new ModelRVM);
-		}
-		if (tf->modelSelection == MODEL_PPHUMANSEG) {
-			tf->model.reset(new ModelPPHumanSeg);
-		}
-		if (tf->modelSelection == MODEL_DEPTH_TCMONODEPTH) {
-			tf->model.reset(new ModelTCMonoDepth);
-		}
-		if (tf->modelSelection == MODEL_RMBG) {
-			tf->model.reset(new ModelRMBG);
+		if (tf->qualityTier != newQualityTier) {
+			tf->qualityTier = newQualityTier;
+			// Same session, only the tensors change size
+			if (tf->model && tf->session &&
+			    tf->model->setInputResolution(
+				    QUALITY_TIERS[tf->qualityTier].width,
+				    QUALITY_TIERS[tf->qualityTier].height)) {
+				if (allocateOrtSessionTensors(tf) !=
+				    OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+					obs_log(LOG_ERROR,
+						"Failed to resize the model tensors");
+					tf->isDisabled = true;
+					tf->model.reset();
+					tf->modelInstalled = false;
+					return;
+				}
+			}
 		}
 
-		int ortSessionResult = createOrtSession(tf);
-		if (ortSessionResult != OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
-			obs_log(LOG_ERROR,
-				"Failed to create ONNXRuntime session. Error code: %d",
-				ortSessionResult);
-			// disable filter
-			tf->isDisabled = true;
-			tf->model.reset();
-			return;
-		}
+		tf->batchInference = newBatchInference;
+		updateInferenceBatch(tf);
 	}
 
-	obs_enter_graphics();
+	tf->cascadeEveryXMasks =
+		(int)obs_data_get_int(settings, "cascade_every_x_masks");
+	updateCascade(tf, obs_data_get_string(settings, "cascade_model"),
+		      newSession);
 
-	char *effect_path = obs_module_file(EFFECT_PATH);
-	gs_effect_destroy(tf->effect);
-	tf->effect = gs_effect_create_from_file(effect_path, NULL);
-	bfree(effect_path);
+	// The effects do not depend on the settings, compile them once
+	if (!tf->effect || !tf->kawaseBlurEffect) {
+		obs_enter_graphics();
 
-	char *kawaseBlurEffectPath = obs_module_file(KAWASE_BLUR_EFFECT_PATH);
-	gs_effect_destroy(tf->kawaseBlurEffect);
-	tf->kawaseBlurEffect =
-		gs_effect_create_from_file(kawaseBlurEffectPath, NULL);
-	bfree(kawaseBlurEffectPath);
+		char *effect_path = obs_module_file(EFFECT_PATH);
+		gs_effect_destroy(tf->effect);
+		tf->effect = gs_effect_create_from_file(effect_path, NULL);
+		bfree(effect_path);
 
-	obs_leave_graphics();
+		char *kawaseBlurEffectPath =
+			obs_module_file(KAWASE_BLUR_EFFECT_PATH);
+		gs_effect_destroy(tf->kawaseBlurEffect);
+		tf->kawaseBlurEffect =
+			gs_effect_create_from_file(kawaseBlurEffectPath, NULL);
+		bfree(kawaseBlurEffectPath);
+
+		obs_leave_graphics();
+	}
 
 	// Log the currently selected options
 	obs_log(LOG_INFO, "Background Removal Filter Options:");
 	// name of the source that the filter is attached to
 	obs_log(LOG_INFO, "  Source: %s", obs_source_get_name(tf->source));
-	obs_log(LOG_INFO, "  Model: %s", tf->modelSelection.c_str());
-	obs_log(LOG_INFO, "  Inference Device: %s", tf->useGPU.c_str());
-	obs_log(LOG_INFO, "  Num Threads: %d", tf->numThreads);
+	obs_log(LOG_INFO, "  Model: %s",
+		tf->requestedSession.modelSelection.c_str());
+	obs_log(LOG_INFO, "  Quality Tier: %s",
+		QUALITY_TIERS[tf->qualityTier].name);
+	const std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	obs_log(LOG_INFO, "  Refinement Model: %s",
+		refiner ? refiner->requestedSession.modelSelection.c_str()
+			: "none");
+	obs_log(LOG_INFO, "  Refine Every X Masks: %d", tf->cascadeEveryXMasks);
+	obs_log(LOG_INFO, "  Inference Device: %s",
+		tf->requestedSession.useGPU.c_str());
+	obs_log(LOG_INFO, "  Num Threads: %d",
+		tf->requestedSession.numThreads);
+	obs_log(LOG_INFO, "  Post-process Threads: %u",
+		resolvePostProcessThreads(tf->postProcessThreads,
+					  tf->requestedSession.numThreads));
+	obs_log(LOG_INFO, "  Readback Depth: %u", tf->readbackDepth);
+	obs_log(LOG_INFO, "  Release Unused Model After: %u s",
+		(uint32_t)tf->releaseInactiveAfter);
+	obs_log(LOG_INFO, "  GPU Downscale: %s",
+		tf->gpuDownscale ? "true" : "false");
+	obs_log(LOG_INFO, "  Region of Interest: %s",
+		tf->roiTracker.isEnabled() ? "true" : "false");
+	obs_log(LOG_INFO, "  Batch Inference: %s",
+		tf->inferenceBatchMember ? "true" : "false");
 	obs_log(LOG_INFO, "  Enable Threshold: %s",
 		tf->enableThreshold ? "true" : "false");
 	obs_log(LOG_INFO, "  Threshold: %f", tf->threshold);
@@ -416,21 +807,25 @@ void background_filter_update(void *data, obs_data_t *settings)
 	obs_log(LOG_INFO, "  Smooth Contour: %f", tf->smoothContour);
 	obs_log(LOG_INFO, "  Feather: %f", tf->feather);
 	obs_log(LOG_INFO, "  Mask Every X Frames: %d", tf->maskEveryXFrames);
+	obs_log(LOG_INFO, "  Adaptive Mask Rate: %s",
+		tf->adaptiveMaskRate ? "true" : "false");
+	obs_log(LOG_INFO, "  Inference Budget: %d%%", tf->inferenceBudget);
+	obs_log(LOG_INFO, "  Warp Mask: %s", tf->warpMask ? "true" : "false");
 	obs_log(LOG_INFO, "  Enable Image Similarity: %s",
 		tf->enableImageSimilarity ? "true" : "false");
 	obs_log(LOG_INFO, "  Image Similarity Threshold: %f",
 		tf->imageSimilarityThreshold);
 	obs_log(LOG_INFO, "  Blur Background: %d", tf->blurBackground);
+	obs_log(LOG_INFO, "  Fast Blur: %s", tf->fastBlur ? "true" : "false");
+	obs_log(LOG_INFO, "  Cache Background: %s",
+		tf->backgroundPlate.isEnabled() ? "true" : "false");
 	obs_log(LOG_INFO, "  Enable Focal Blur: %s",
 		tf->enableFocalBlur ? "true" : "false");
 	obs_log(LOG_INFO, "  Blur Focus Point: %f", tf->blurFocusPoint);
 	obs_log(LOG_INFO, "  Blur Focus Depth: %f", tf->blurFocusDepth);
+	obs_log(LOG_INFO, "  Stage Timings: %s",
+		tf->profiler.isEnabled() ? "true" : "false");
 	obs_log(LOG_INFO, "  Disabled: %s", tf->isDisabled ? "true" : "false");
-#ifdef _WIN32
-	obs_log(LOG_INFO, "  Model file path: %S", tf->modelFilepath.c_str());
-#else
-	obs_log(LOG_INFO, "  Model file path: %s", tf->modelFilepath.c_str());
-#endif
 
 	// enable
 	tf->isDisabled = false;
@@ -441,7 +836,21 @@ void background_filter_activate(void *data)
 	obs_log(LOG_INFO, "Background filter activated");
 	struct background_removal_filter *tf =
 		reinterpret_cast<background_removal_filter *>(data);
+	// The recurrent state, the subject region and the background plate are
+	// stale after the source was inactive
+	resetRecurrentState(tf);
+	tf->roiTracker.reset();
+	tf->backgroundPlate.invalidate();
 	tf->isDisabled = false;
+	setCoreBudgetActive(tf, true);
+
+	std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (refiner) {
+		resetRecurrentState(refiner.get());
+		setCoreBudgetActive(refiner.get(), true);
+		std::lock_guard<std::mutex> lock(tf->cascadeLock);
+		tf->cascadeMask.release();
+	}
 }
 
 void background_filter_deactivate(void *data)
@@ -450,10 +859,75 @@ void background_filter_deactivate(void *data)
 	struct background_removal_filter *tf =
 		reinterpret_cast<background_removal_filter *>(data);
 	tf->isDisabled = true;
+	setCoreBudgetActive(tf, false);
+
+	std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (refiner) {
+		setCoreBudgetActive(refiner.get(), false);
+	}
+}
+
+void background_filter_show(void *data)
+{
+	struct background_removal_filter *tf =
+		reinterpret_cast<background_removal_filter *>(data);
+	// Previewed or about to go live: start loading before the first frame
+	markModelUsed(tf);
+	std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (refiner) {
+		markModelUsed(refiner.get());
+	}
 }
 
 /**                   FILTER CORE                     */
 
+/**
+  * @brief The background filter's part of its stats, see
+  * obs-utils/stats-handler.h
+*/
+static void writeBackgroundStats(filter_data *data, obs_data_t *stats)
+{
+	struct background_removal_filter *tf =
+		static_cast<background_removal_filter *>(data);
+	const int maskEveryXFrames = std::max(1, tf->maskEveryXFrames);
+	obs_data_set_double(stats, "requested_fps",
+			    getVideoFrameRate() / maskEveryXFrames);
+	obs_data_set_int(stats, "mask_every_x_frames", maskEveryXFrames);
+	obs_data_set_bool(stats, "adaptive_mask_rate", tf->adaptiveMaskRate);
+	obs_data_set_bool(stats, "similarity_gate", tf->enableImageSimilarity);
+	const std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (refiner) {
+		obs_data_set_int(stats, "cascade_inferences",
+				 (long long)refiner->stats.inferences.load());
+		obs_data_set_double(stats, "cascade_fps",
+				    refiner->stats.inferenceRate());
+	}
+	writeStageLatency(tf->profiler, stats);
+}
+
+/**
+  * @brief The bytes of the textures render creates on demand. Call in the
+  * graphics context.
+*/
+static uint64_t getBackgroundTextureBytes(filter_data *data)
+{
+	struct background_removal_filter *tf =
+		static_cast<background_removal_filter *>(data);
+	uint64_t bytes = getTexrenderBytes(tf->maskTexrender) +
+			 getTextureBytes(tf->maskTexture) +
+			 getTextureBytes(tf->plateRefreshTexture);
+	for (gs_texrender_t *blur : tf->blurTexrenders) {
+		bytes += getTexrenderBytes(blur);
+	}
+	for (gs_texrender_t *level : tf->blurPyramid) {
+		bytes += getTexrenderBytes(level);
+	}
+	for (gs_texrender_t *plate : tf->plateTexrenders) {
+		bytes += getTexrenderBytes(plate);
+	}
+	return bytes;
+}
+
 void *background_filter_create(obs_data_t *settings, obs_source_t *source)
 {
 	obs_log(LOG_INFO, "Background filter created");
@@ -463,17 +937,85 @@ void *background_filter_create(obs_data_t *settings, obs_source_t *source)
 
 	tf->source = source;
 	tf->texrender = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
+	tf->readbackThumbnail = true;
+	// The mask does not depend on the filters before this one
+	tf->shareReadback = true;
 
-	std::string instanceName{"background-removal-inference"};
-	tf->env.reset(new Ort::Env(OrtLoggingLevel::ORT_LOGGING_LEVEL_ERROR,
-				   instanceName.c_str()));
-
-	tf->modelSelection = MODEL_MEDIAPIPE;
+	deferModelLoad(tf);
+	// Counts toward the CPU split once OBS activates it
+	joinCoreBudget(tf, false);
 	background_filter_update(tf, settings);
 
+	startInferenceWorker(tf, [tf](const Frame &frame) {
+		calculateFilterMask(tf, frame);
+	});
+
+	FilterStatsHandler statsHandler;
+	statsHandler.write = writeBackgroundStats;
+	statsHandler.textureBytes = getBackgroundTextureBytes;
+	registerFilterStats(tf, statsHandler);
+
 	return tf;
 }
 
+/**
+  * @brief Destroy the textures render creates on demand. Call in the graphics
+  * context.
+*/
+static void destroyFrameTextures(struct background_removal_filter *tf)
+{
+	gs_texrender_destroy(tf->readbackTexrender);
+	tf->readbackTexrender = nullptr;
+	gs_texrender_destroy(tf->maskTexrender);
+	tf->maskTexrender = nullptr;
+	gs_texture_destroy(tf->maskTexture);
+	tf->maskTexture = nullptr;
+	for (gs_texrender_t *&blur : tf->blurTexrenders) {
+		gs_texrender_destroy(blur);
+		blur = nullptr;
+	}
+	for (gs_texrender_t *&level : tf->blurPyramid) {
+		gs_texrender_destroy(level);
+		level = nullptr;
+	}
+	for (gs_texrender_t *&plate : tf->plateTexrenders) {
+		gs_texrender_destroy(plate);
+		plate = nullptr;
+	}
+	gs_texture_destroy(tf->plateRefreshTexture);
+	tf->plateRefreshTexture = nullptr;
+	destroyStageSurfaces(tf);
+}
+
+/**
+  * @brief Free the frame buffers and textures once the model was released.
+  * The next frames create them again.
+*/
+static void releaseFrameBuffers(struct background_removal_filter *tf)
+{
+	{
+		std::lock_guard<std::mutex> lock(tf->outputLock);
+		tf->backgroundMask.release();
+		tf->backgroundMaskUpdated = false;
+		tf->inferredMask.release();
+		tf->inferredThumbnail.release();
+	}
+	{
+		std::lock_guard<std::mutex> lock(tf->cascadeLock);
+		tf->cascadeMask.release();
+		tf->cascadeThumbnail.release();
+	}
+	tf->lastThumbnail.release();
+	tf->changeMap.release();
+	tf->frameRing.releaseBuffers();
+	tf->roiTracker.reset();
+	tf->backgroundPlate.invalidate();
+
+	obs_enter_graphics();
+	destroyFrameTextures(tf);
+	obs_leave_graphics();
+}
+
 void background_filter_destroy(void *data)
 {
 	obs_log(LOG_INFO, "Background filter destroyed");
@@ -483,12 +1025,18 @@ void background_filter_destroy(void *data)
 
 	if (tf) {
 		tf->isDisabled = true;
+		unregisterFilterStats(tf);
+
+		// The refiner's worker publishes into this filter
+		stopCascade(tf);
+		// A swap in progress installs into the model the worker uses
+		stopModelSwapWorker(tf);
+		stopInferenceWorker(tf);
+		leaveCoreBudget(tf);
 
 		obs_enter_graphics();
 		gs_texrender_destroy(tf->texrender);
-		if (tf->stagesurface) {
-			gs_stagesurface_destroy(tf->stagesurface);
-		}
+		destroyFrameTextures(tf);
 		gs_effect_destroy(tf->effect);
 		gs_effect_destroy(tf->kawaseBlurEffect);
 		obs_leave_graphics();
@@ -497,209 +1045,362 @@ void background_filter_destroy(void *data)
 	}
 }
 
-static void processImageForBackground(struct background_removal_filter *tf,
-				      const cv::Mat &imageBGRA,
-				      cv::Mat &backgroundMask)
+/**
+  * @brief Rebuild the session on the CPU after the GPU provider failed
+  *
+  * Runs on the mask worker, after the provider reported a failure or
+  * CPU_FALLBACK_FAILURES runs failed in a row. The failing session stays
+  * installed until the CPU one is built, and the fallback is counted once it
+  * is. The settings keep the GPU, so choosing a model or device again tries
+  * it again.
+*/
+static void fallBackToCpu(struct background_removal_filter *tf)
 {
-	cv::Mat outputImage;
-	if (!runFilterModelInference(tf, imageBGRA, outputImage)) {
+	tf->inferenceFailures = 0;
+	OrtSessionConfig config;
+	int qualityTier;
+	{
+		std::unique_lock<std::mutex> lock(tf->modelMutex);
+		if (!tf->model || tf->useGPU == USEGPU_CPU) {
+			return;
+		}
+		config.modelSelection = tf->modelSelection;
+		config.useGPU = USEGPU_CPU;
+		config.numThreads = tf->numThreads;
+		qualityTier = tf->qualityTier;
+		obs_log(LOG_WARNING,
+			"Inference failed on %s, falling back to the CPU",
+			tf->useGPU.c_str());
+	}
+	if (isModelSwapPending(tf)) {
+		// Already switching, maybe to this same fallback
 		return;
 	}
-	// Assume outputImage is now a single channel, uint8 image with values between 0 and 255
 
-	// If we have a threshold, apply it. Otherwise, just use the output image as the mask
-	if (tf->enableThreshold) {
-		// We need to make tf->threshold (float [0,1]) be in that range
-		const uint8_t threshold_value =
-			(uint8_t)(tf->threshold * 255.0f);
-		backgroundMask = outputImage < threshold_value;
-	} else {
-		backgroundMask = 255 - outputImage;
+	std::unique_ptr<Model> model =
+		createBackgroundModel(config.modelSelection);
+	model->setInputResolution(QUALITY_TIERS[qualityTier].width,
+				  QUALITY_TIERS[qualityTier].height);
+	requestModelSwap(tf, config, std::move(model), true);
+}
+
+/**
+  * @brief Calculate the background mask of a frame on the mask worker, see
+  * calculateBackgroundMask
+  *
+  * Falls back to the CPU after the provider failed, or after
+  * CPU_FALLBACK_FAILURES runs failed in a row.
+*/
+static void calculateFilterMask(struct background_removal_filter *tf,
+				const Frame &frame)
+{
+	try {
+		if (calculateBackgroundMask(tf, frame)) {
+			tf->inferenceFailures = 0;
+		}
+	} catch (const Ort::Exception &e) {
+		obs_log(LOG_ERROR, "ONNXRuntime Exception: %s", e.what());
+		// A failed provider stays failed, other errors may be one-off
+		if (e.GetOrtErrorCode() == ORT_EP_FAIL ||
+		    ++tf->inferenceFailures >= CPU_FALLBACK_FAILURES) {
+			fallBackToCpu(tf);
+		}
+	} catch (const std::exception &e) {
+		obs_log(LOG_ERROR, "%s", e.what());
 	}
 }
 
-void background_filter_video_tick(void *data, float seconds)
+/**
+  * @brief Run the refinement model on the refiner's worker, see
+  * calculateCascadeMask
+*/
+static void calculateFilterCascadeMask(struct background_removal_filter *tf,
+				       const Frame &frame)
 {
-	UNUSED_PARAMETER(seconds);
+	try {
+		calculateCascadeMask(tf, frame);
+	} catch (const Ort::Exception &e) {
+		obs_log(LOG_ERROR, "ONNXRuntime Exception: %s", e.what());
+	} catch (const std::exception &e) {
+		obs_log(LOG_ERROR, "%s", e.what());
+	}
+}
 
+void background_filter_video_tick(void *data, float seconds)
+{
 	struct background_removal_filter *tf =
 		reinterpret_cast<background_removal_filter *>(data);
 
+	if (releaseUnusedModel(tf)) {
+		releaseFrameBuffers(tf);
+	}
+	const std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (refiner) {
+		releaseUnusedModel(refiner.get());
+		// Read back enough for the refiner's input too
+		tf->readbackMinWidth = (uint32_t)refiner->readbackWidth;
+		tf->readbackMinHeight = (uint32_t)refiner->readbackHeight;
+	}
+
 	if (tf->isDisabled) {
 		return;
 	}
 
-	if (!obs_source_enabled(tf->source)) {
-		return;
+	tf->maskScheduler.addFrameInterval(seconds);
+	tf->stats.maskInterval = tf->maskScheduler.currentInterval();
+
+	if (tf->profiler.shouldLog()) {
+		obs_log(LOG_INFO,
+			"Stage timings for %s: %s | mask every %d frames",
+			obs_source_get_name(tf->source),
+			tf->profiler.summary().c_str(),
+			tf->maskScheduler.currentInterval());
 	}
 
-	if (!tf->model) {
-		obs_log(LOG_ERROR, "Model is not initialized");
+	if (!obs_source_enabled(tf->source)) {
 		return;
 	}
 
-	cv::Mat imageBGRA;
-	{
-		std::unique_lock<std::mutex> lock(tf->inputBGRALock,
-						  std::try_to_lock);
-		if (!lock.owns_lock()) {
-			// No data to process
-			return;
-		}
-		if (tf->inputBGRA.empty()) {
-			// No data to process
-			return;
+	if (!tf->modelInstalled) {
+		// Still loading, or the build failed and swapModel logged it.
+		// Without a mask render shows the source as it is.
+		if (hasModelSwapFailed(tf)) {
+			std::lock_guard<std::mutex> lock(tf->outputLock);
+			tf->backgroundMask.release();
 		}
-		imageBGRA = tf->inputBGRA.clone();
+		return;
 	}
 
-	if (tf->enableImageSimilarity) {
-		if (!tf->lastImageBGRA.empty() && !imageBGRA.empty() &&
-		    tf->lastImageBGRA.size() == imageBGRA.size()) {
-			// calculate PSNR
-			double psnr = cv::PSNR(tf->lastImageBGRA, imageBGRA);
-
-			if (psnr > tf->imageSimilarityThreshold) {
-				// The image is almost the same as the previous one. Skip processing.
-				return;
-			}
-		}
-		tf->lastImageBGRA = imageBGRA.clone();
+	// Take ownership of the newest frame read back by render
+	FramePtr frame = tf->frameRing.takeLatest();
+	if (!frame) {
+		// No data to process
+		return;
+	}
+	const BackgroundFrameGate gate = gateBackgroundFrame(tf, *frame);
+	if (!gate.infer) {
+		// Render keeps using the background mask previously generated
+		return;
 	}
 
-	if (tf->backgroundMask.empty()) {
-		// First frame. Initialize the background mask.
-		tf->backgroundMask =
-			cv::Mat(imageBGRA.size(), CV_8UC1, cv::Scalar(255));
+	if (gate.refine && refiner) {
+		// The refiner shares the frame, it only reads it
+		submitFrameToInferenceWorker(refiner.get(), frame);
 	}
 
-	tf->maskEveryXFramesCount++;
-	tf->maskEveryXFramesCount %= tf->maskEveryXFrames;
+	// Inference runs on the worker thread. The video thread never waits for it.
+	submitFrameToInferenceWorker(tf, std::move(frame));
+}
 
-	try {
-		if (tf->maskEveryXFramesCount != 0 &&
-		    !tf->backgroundMask.empty()) {
-			// We are skipping processing of the mask for this frame.
-			// Get the background mask previously generated.
-			; // Do nothing
-		} else {
-			cv::Mat backgroundMask;
-
-			{
-				std::unique_lock<std::mutex> lock(
-					tf->modelMutex);
-				// Process the image to find the mask.
-				processImageForBackground(tf, imageBGRA,
-							  backgroundMask);
-			}
+/**
+  * @brief Upsample the model-resolution mask to the source on the GPU
+  *
+  * @param maskTexture  The model-resolution mask
+  * @param region  The region of the source the mask covers, normalized
+  * @param binarize  Threshold the upsampled mask at 0.5
+  * @return The source-sized mask, owned by tf->maskTexrender. nullptr on
+  * failure.
+*/
+static gs_texture_t *upsample_mask(struct background_removal_filter *tf,
+				   uint32_t width, uint32_t height,
+				   gs_texture_t *maskTexture,
+				   const cv::Rect2f &region, bool binarize)
+{
+	if (!tf->maskTexrender) {
+		tf->maskTexrender = gs_texrender_create(GS_R8, GS_ZS_NONE);
+	}
+	gs_texrender_reset(tf->maskTexrender);
+	if (!gs_texrender_begin(tf->maskTexrender, width, height)) {
+		obs_log(LOG_ERROR, "Could not open mask upsampling texrender");
+		return nullptr;
+	}
 
-			if (backgroundMask.empty()) {
-				// Something went wrong. Just use the previous mask.
-				obs_log(LOG_WARNING,
-					"Background mask is empty. This shouldn't happen. Using previous mask.");
-				return;
-			}
+	gs_eparam_t *image = gs_effect_get_param_by_name(tf->effect, "image");
+	gs_eparam_t *lowresmask =
+		gs_effect_get_param_by_name(tf->effect, "lowresmask");
+	gs_eparam_t *maskOffset =
+		gs_effect_get_param_by_name(tf->effect, "maskOffset");
+	gs_eparam_t *maskScale =
+		gs_effect_get_param_by_name(tf->effect, "maskScale");
+	gs_eparam_t *maskTexelSize =
+		gs_effect_get_param_by_name(tf->effect, "maskTexelSize");
+	gs_eparam_t *binarizeParam =
+		gs_effect_get_param_by_name(tf->effect, "binarize");
+
+	struct vec2 offset, scale, texelSize;
+	vec2_set(&offset, region.x, region.y);
+	vec2_set(&scale, region.width, region.height);
+	vec2_set(&texelSize, 1.0f / (float)gs_texture_get_width(maskTexture),
+		 1.0f / (float)gs_texture_get_height(maskTexture));
+
+	// The color image guides the upsampling
+	gs_effect_set_texture(image, gs_texrender_get_texture(tf->texrender));
+	gs_effect_set_texture(lowresmask, maskTexture);
+	gs_effect_set_vec2(maskOffset, &offset);
+	gs_effect_set_vec2(maskScale, &scale);
+	gs_effect_set_vec2(maskTexelSize, &texelSize);
+	gs_effect_set_bool(binarizeParam, binarize);
+
+	struct vec4 background;
+	vec4_zero(&background);
+	gs_clear(GS_CLEAR_COLOR, &background, 0.0f, 0);
+	gs_ortho(0.0f, static_cast<float>(width), 0.0f,
+		 static_cast<float>(height), -100.0f, 100.0f);
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+	while (gs_effect_loop(tf->effect, "UpsampleMask")) {
+		gs_draw_sprite(maskTexture, 0, width, height);
+	}
+	gs_blend_state_pop();
+	gs_texrender_end(tf->maskTexrender);
 
-			// Temporal smoothing
-			if (tf->temporalSmoothFactor > 0.0 &&
-			    tf->temporalSmoothFactor < 1.0 &&
-			    !tf->lastBackgroundMask.empty() &&
-			    tf->lastBackgroundMask.size() ==
-				    backgroundMask.size()) {
-
-				float temporalSmoothFactor =
-					tf->temporalSmoothFactor;
-				if (tf->enableThreshold) {
-					// The temporal smooth factor can't be smaller than the threshold
-					temporalSmoothFactor =
-						std::max(temporalSmoothFactor,
-							 tf->threshold);
-				}
+	return gs_texrender_get_texture(tf->maskTexrender);
+}
 
-				cv::addWeighted(backgroundMask,
-						temporalSmoothFactor,
-						tf->lastBackgroundMask,
-						1.0 - temporalSmoothFactor, 0.0,
-						backgroundMask);
-			}
+/**
+  * @brief Draw one pass of kawaseBlurEffect over a texture into a texrender
+*/
+static bool draw_blur_pass(struct background_removal_filter *tf,
+			   gs_texrender_t *target, uint32_t width,
+			   uint32_t height, gs_texture_t *input,
+			   const char *technique)
+{
+	gs_texrender_reset(target);
+	if (!gs_texrender_begin(target, width, height)) {
+		obs_log(LOG_INFO, "Could not open background blur texrender!");
+		return false;
+	}
 
-			tf->lastBackgroundMask = backgroundMask.clone();
-
-			// Contour processing
-			// Only applicable if we are thresholding (and get a binary image)
-			if (tf->enableThreshold) {
-				if (tf->contourFilter > 0.0 &&
-				    tf->contourFilter < 1.0) {
-					std::vector<std::vector<cv::Point>>
-						contours;
-					findContours(backgroundMask, contours,
-						     cv::RETR_EXTERNAL,
-						     cv::CHAIN_APPROX_SIMPLE);
-					std::vector<std::vector<cv::Point>>
-						filteredContours;
-					const double contourSizeThreshold =
-						(double)(backgroundMask.total()) *
-						tf->contourFilter;
-					for (auto &contour : contours) {
-						if (cv::contourArea(contour) >
-						    (double)contourSizeThreshold) {
-							filteredContours
-								.push_back(
-									contour);
-						}
-					}
-					backgroundMask.setTo(0);
-					drawContours(backgroundMask,
-						     filteredContours, -1,
-						     cv::Scalar(255), -1);
-				}
+	gs_effect_set_texture(
+		gs_effect_get_param_by_name(tf->kawaseBlurEffect, "image"),
+		input);
 
-				if (tf->smoothContour > 0.0) {
-					int k_size =
-						(int)(3 +
-						      11 * tf->smoothContour);
-					k_size += k_size % 2 == 0 ? 1 : 0;
-					cv::stackBlur(backgroundMask,
-						      backgroundMask,
-						      cv::Size(k_size, k_size));
-				}
+	struct vec4 background;
+	vec4_zero(&background);
+	gs_clear(GS_CLEAR_COLOR, &background, 0.0f, 0);
+	gs_ortho(0.0f, static_cast<float>(width), 0.0f,
+		 static_cast<float>(height), -100.0f, 100.0f);
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
 
-				// Resize the size of the mask back to the size of the original input.
-				cv::resize(backgroundMask, backgroundMask,
-					   imageBGRA.size());
+	while (gs_effect_loop(tf->kawaseBlurEffect, technique)) {
+		gs_draw_sprite(input, 0, width, height);
+	}
+	gs_blend_state_pop();
+	gs_texrender_end(target);
+	return true;
+}
 
-				// Additional contour processing at full resolution
-				if (tf->smoothContour > 0.0) {
-					// If the mask was smoothed, apply a threshold to get a binary mask
-					backgroundMask = backgroundMask > 128;
-				}
+/**
+  * @brief Number of dual filter levels reaching the radius of a Kawase blur
+  *
+  * @param kawasePasses  The number of full resolution Kawase passes
+*/
+static int dualKawaseLevels(int64_t kawasePasses, uint32_t width,
+			    uint32_t height)
+{
+	// Kawase pass i reaches i + 0.5 pixels further. Each dual filter level
+	// doubles the radius.
+	const double radius = (double)(kawasePasses * kawasePasses) / 2.0;
+	int levels = (int)std::ceil(std::log2(std::max(radius, 2.0))) - 1;
+	levels = std::clamp(levels, 1, DUAL_KAWASE_MAX_LEVELS);
+	while (levels > 1 &&
+	       ((width >> levels) < 2 || (height >> levels) < 2)) {
+		levels--;
+	}
+	return levels;
+}
 
-				if (tf->feather > 0.0) {
-					// Feather (blur) the mask
-					int k_size = (int)(40 * tf->feather);
-					k_size += k_size % 2 == 0 ? 1 : 0;
-					cv::dilate(backgroundMask,
-						   backgroundMask, cv::Mat(),
-						   cv::Point(-1, -1),
-						   k_size / 3);
-					cv::boxFilter(
-						backgroundMask, backgroundMask,
-						tf->backgroundMask.depth(),
-						cv::Size(k_size, k_size));
-				}
-			}
+/**
+  * @brief Blur the source with a dual filter pyramid in tf->blurPyramid
+  *
+  * Downsamples to 1/2, 1/4, ... of the source and upsamples back, then
+  * composites the blur with the sharp source at full resolution: in the
+  * background for the mask aware blur, by distance to the focus point for the
+  * focal blur.
+  *
+  * @return The blurred source, owned by a texrender
+*/
+static gs_texture_t *dual_kawase_blur(struct background_removal_filter *tf,
+				      uint32_t width, uint32_t height,
+				      gs_texture_t *alphaTexture)
+{
+	gs_texture_t *source = gs_texrender_get_texture(tf->texrender);
+	gs_eparam_t *focalmask =
+		gs_effect_get_param_by_name(tf->kawaseBlurEffect, "focalmask");
+	gs_eparam_t *blurimage =
+		gs_effect_get_param_by_name(tf->kawaseBlurEffect, "blurimage");
+	gs_eparam_t *xOffset =
+		gs_effect_get_param_by_name(tf->kawaseBlurEffect, "xOffset");
+	gs_eparam_t *yOffset =
+		gs_effect_get_param_by_name(tf->kawaseBlurEffect, "yOffset");
+	gs_effect_set_texture(focalmask, alphaTexture);
+	gs_effect_set_float(gs_effect_get_param_by_name(tf->kawaseBlurEffect,
+							"blurFocusPoint"),
+			    tf->blurFocusPoint);
+	gs_effect_set_float(gs_effect_get_param_by_name(tf->kawaseBlurEffect,
+							"blurFocusDepth"),
+			    tf->blurFocusDepth);
+
+	const int levels = dualKawaseLevels(tf->blurBackground, width, height);
+
+	// Downsample, one texel offsets of the input level
+	gs_texture_t *level = source;
+	for (int i = 0; i < levels; i++) {
+		gs_texrender_t *&target = tf->blurPyramid[i];
+		if (!target) {
+			target = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
+		}
+		const char *technique = "DualDownsample";
+		if (i == 0) {
+			technique = tf->enableFocalBlur
+					    ? "DualDownsampleOpaque"
+					    : "DualDownsampleMasked";
+		}
+		gs_effect_set_float(xOffset, 1.0f / (float)(width >> i));
+		gs_effect_set_float(yOffset, 1.0f / (float)(height >> i));
+		if (!draw_blur_pass(tf, target, width >> (i + 1),
+				    height >> (i + 1), level, technique)) {
+			return source;
+		}
+		level = gs_texrender_get_texture(target);
+	}
 
-			// Save the mask for the next frame
-			backgroundMask.copyTo(tf->backgroundMask);
+	// Upsample back to the finest level, half texel offsets
+	for (int i = levels - 2; i >= 0; i--) {
+		gs_effect_set_float(xOffset, 0.5f / (float)(width >> (i + 2)));
+		gs_effect_set_float(yOffset, 0.5f / (float)(height >> (i + 2)));
+		if (!draw_blur_pass(tf, tf->blurPyramid[i], width >> (i + 1),
+				    height >> (i + 1), level, "DualUpsample")) {
+			return source;
 		}
-	} catch (const Ort::Exception &e) {
-		obs_log(LOG_ERROR, "ONNXRuntime Exception: %s", e.what());
-		// TODO: Fall back to CPU if it makes sense
-	} catch (const std::exception &e) {
-		obs_log(LOG_ERROR, "%s", e.what());
+		level = gs_texrender_get_texture(tf->blurPyramid[i]);
+	}
+
+	// The composite does the last upsample
+	gs_texrender_t *&target = tf->blurTexrenders[0];
+	if (!target) {
+		target = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
 	}
+	gs_effect_set_texture(blurimage, level);
+	gs_effect_set_float(xOffset, 0.5f / (float)(width >> 1));
+	gs_effect_set_float(yOffset, 0.5f / (float)(height >> 1));
+	if (!draw_blur_pass(tf, target, width, height, source,
+			    tf->enableFocalBlur ? "DualCompositeFocal"
+						: "DualComposite")) {
+		return source;
+	}
+	return gs_texrender_get_texture(target);
 }
 
+/**
+  * @brief Blur the source for the background
+  *
+  * Runs the dual filter pyramid when fastBlur is set. Otherwise Kawase blurs
+  * at full resolution, ping-ponging between tf->blurTexrenders.
+  *
+  * @return The blurred source, owned by a texrender. nullptr if blur is off.
+*/
 static gs_texture_t *blur_background(struct background_removal_filter *tf,
 				     uint32_t width, uint32_t height,
 				     gs_texture_t *alphaTexture)
@@ -707,12 +1408,12 @@ static gs_texture_t *blur_background(struct background_removal_filter *tf,
 	if (tf->blurBackground == 0 || !tf->kawaseBlurEffect) {
 		return nullptr;
 	}
-	gs_texture_t *blurredTexture =
-		gs_texture_create(width, height, GS_BGRA, 1, nullptr, 0);
-	gs_copy_texture(blurredTexture,
-			gs_texrender_get_texture(tf->texrender));
-	gs_eparam_t *image =
-		gs_effect_get_param_by_name(tf->kawaseBlurEffect, "image");
+	if (tf->fastBlur && width >= 4 && height >= 4) {
+		return dual_kawase_blur(tf, width, height, alphaTexture);
+	}
+
+	// Each pass reads the previous one's output, starting from the source
+	gs_texture_t *blurredTexture = gs_texrender_get_texture(tf->texrender);
 	gs_eparam_t *focalmask =
 		gs_effect_get_param_by_name(tf->kawaseBlurEffect, "focalmask");
 	gs_eparam_t *xOffset =
@@ -728,15 +1429,15 @@ static gs_texture_t *blur_background(struct background_removal_filter *tf,
 	gs_eparam_t *blurFocusDepthParam = gs_effect_get_param_by_name(
 		tf->kawaseBlurEffect, "blurFocusDepth");
 
+	const char *blur_type = (tf->enableFocalBlur) ? "DrawFocalBlur"
+						      : "Draw";
+
 	for (int i = 0; i < (int)tf->blurBackground; i++) {
-		gs_texrender_reset(tf->texrender);
-		if (!gs_texrender_begin(tf->texrender, width, height)) {
-			obs_log(LOG_INFO,
-				"Could not open background blur texrender!");
-			return blurredTexture;
+		gs_texrender_t *&target = tf->blurTexrenders[i % 2];
+		if (!target) {
+			target = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
 		}
 
-		gs_effect_set_texture(image, blurredTexture);
 		gs_effect_set_texture(focalmask, alphaTexture);
 		gs_effect_set_float(xOffset, ((float)i + 0.5f) / (float)width);
 		gs_effect_set_float(yOffset, ((float)i + 0.5f) / (float)height);
@@ -745,28 +1446,97 @@ static gs_texture_t *blur_background(struct background_removal_filter *tf,
 		gs_effect_set_float(blurFocusPointParam, tf->blurFocusPoint);
 		gs_effect_set_float(blurFocusDepthParam, tf->blurFocusDepth);
 
-		struct vec4 background;
-		vec4_zero(&background);
-		gs_clear(GS_CLEAR_COLOR, &background, 0.0f, 0);
-		gs_ortho(0.0f, static_cast<float>(width), 0.0f,
-			 static_cast<float>(height), -100.0f, 100.0f);
-		gs_blend_state_push();
-		gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
-
-		const char *blur_type = (tf->enableFocalBlur) ? "DrawFocalBlur"
-							      : "Draw";
-
-		while (gs_effect_loop(tf->kawaseBlurEffect, blur_type)) {
-			gs_draw_sprite(blurredTexture, 0, width, height);
+		if (!draw_blur_pass(tf, target, width, height, blurredTexture,
+				    blur_type)) {
+			return blurredTexture;
 		}
-		gs_blend_state_pop();
-		gs_texrender_end(tf->texrender);
-		gs_copy_texture(blurredTexture,
-				gs_texrender_get_texture(tf->texrender));
+		blurredTexture = gs_texrender_get_texture(target);
 	}
 	return blurredTexture;
 }
 
+/**
+  * @brief The cached blurred background, refreshed where it is stale
+  *
+  * Blurs the source only when tf->backgroundPlate has stale regions, and
+  * merges the background pixels of those regions into the plate.
+  *
+  * @return The plate, owned by a texrender. nullptr on failure.
+*/
+static gs_texture_t *cached_background(struct background_removal_filter *tf,
+				       uint32_t width, uint32_t height,
+				       gs_texture_t *alphaTexture)
+{
+	gs_texrender_t *&current = tf->plateTexrenders[tf->plateIndex];
+	gs_texture_t *plate = current ? gs_texrender_get_texture(current)
+				      : nullptr;
+	if (!plate || gs_texture_get_width(plate) != width ||
+	    gs_texture_get_height(plate) != height) {
+		// Start over from an empty plate
+		if (!current) {
+			current = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
+		}
+		gs_texrender_reset(current);
+		if (!gs_texrender_begin(current, width, height)) {
+			return nullptr;
+		}
+		struct vec4 empty;
+		vec4_zero(&empty);
+		gs_clear(GS_CLEAR_COLOR, &empty, 0.0f, 0);
+		gs_texrender_end(current);
+		plate = gs_texrender_get_texture(current);
+		tf->backgroundPlate.invalidate();
+	}
+
+	cv::Mat refreshMap;
+	if (!tf->backgroundPlate.takeRefresh(refreshMap)) {
+		return plate;
+	}
+
+	gs_texture_t *blurredTexture =
+		blur_background(tf, width, height, alphaTexture);
+	if (!blurredTexture ||
+	    !uploadToDynamicTexture(tf->plateRefreshTexture, refreshMap,
+				    GS_R8)) {
+		return plate;
+	}
+
+	const int next = 1 - tf->plateIndex;
+	gs_texrender_t *&target = tf->plateTexrenders[next];
+	if (!target) {
+		target = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
+	}
+	gs_texrender_reset(target);
+	if (!gs_texrender_begin(target, width, height)) {
+		return plate;
+	}
+
+	gs_effect_set_texture(gs_effect_get_param_by_name(tf->effect, "plate"),
+			      plate);
+	gs_effect_set_texture(
+		gs_effect_get_param_by_name(tf->effect, "refreshmap"),
+		tf->plateRefreshTexture);
+	gs_effect_set_texture(
+		gs_effect_get_param_by_name(tf->effect, "alphamask"),
+		alphaTexture);
+	gs_effect_set_texture(
+		gs_effect_get_param_by_name(tf->effect, "blurredBackground"),
+		blurredTexture);
+
+	gs_ortho(0.0f, static_cast<float>(width), 0.0f,
+		 static_cast<float>(height), -100.0f, 100.0f);
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+	while (gs_effect_loop(tf->effect, "UpdatePlate")) {
+		gs_draw_sprite(plate, 0, width, height);
+	}
+	gs_blend_state_pop();
+	gs_texrender_end(target);
+
+	tf->plateIndex = next;
+	return gs_texrender_get_texture(target);
+}
+
 void background_filter_video_render(void *data, gs_effect_t *_effect)
 {
 	UNUSED_PARAMETER(_effect);
@@ -774,6 +1544,12 @@ void background_filter_video_render(void *data, gs_effect_t *_effect)
 	struct background_removal_filter *tf =
 		reinterpret_cast<background_removal_filter *>(data);
 
+	markModelUsed(tf);
+	const std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (refiner) {
+		markModelUsed(refiner.get());
+	}
+
 	if (tf->isDisabled) {
 		if (tf->source) {
 			obs_source_skip_video_filter(tf->source);
@@ -782,7 +1558,12 @@ void background_filter_video_render(void *data, gs_effect_t *_effect)
 	}
 
 	uint32_t width, height;
-	if (!getRGBAFromStageSurface(tf, width, height)) {
+	bool readback;
+	{
+		ScopedStageTimer timer(tf->profiler, PROFILER_STAGE_READBACK);
+		readback = getRGBAFromStageSurface(tf, width, height);
+	}
+	if (!readback) {
 		if (tf->source) {
 			obs_source_skip_video_filter(tf->source);
 		}
@@ -797,32 +1578,74 @@ void background_filter_video_render(void *data, gs_effect_t *_effect)
 		return;
 	}
 
-	gs_texture_t *alphaTexture = nullptr;
+	cv::Rect2f maskRegion;
+	bool binarizeMask;
+	bool hasMask;
 	{
 		std::lock_guard<std::mutex> lock(tf->outputLock);
-		alphaTexture = gs_texture_create(
-			tf->backgroundMask.cols, tf->backgroundMask.rows, GS_R8,
-			1, (const uint8_t **)&tf->backgroundMask.data, 0);
-		if (!alphaTexture) {
-			obs_log(LOG_ERROR, "Failed to create alpha texture");
-			if (tf->source) {
-				obs_source_skip_video_filter(tf->source);
+		hasMask = !tf->backgroundMask.empty();
+		// Upload the mask only when the worker published a new one
+		if (hasMask &&
+		    (tf->backgroundMaskUpdated || !tf->maskTexture)) {
+			if (!uploadToDynamicTexture(tf->maskTexture,
+						    tf->backgroundMask,
+						    GS_R8)) {
+				obs_log(LOG_ERROR,
+					"Failed to upload the alpha texture");
+				if (tf->source) {
+					obs_source_skip_video_filter(
+						tf->source);
+				}
+				return;
 			}
-			return;
+			tf->backgroundMaskUpdated = false;
+			tf->backgroundPlate.maskUpdated();
 		}
+		maskRegion = tf->backgroundMaskRegion;
+		binarizeMask = tf->binarizeMask;
+	}
+	if (!hasMask) {
+		// No mask yet, the model is still loading. Show the source as
+		// it is until the first one.
+		if (tf->source) {
+			obs_source_skip_video_filter(tf->source);
+		}
+		return;
+	}
+
+	// Upsample, binarize and map the mask onto the source
+	gs_texture_t *alphaTexture = upsample_mask(
+		tf, width, height, tf->maskTexture, maskRegion, binarizeMask);
+	if (!alphaTexture) {
+		if (tf->source) {
+			obs_source_skip_video_filter(tf->source);
+		}
+		return;
 	}
 
 	// Output the masked image
-	gs_texture_t *blurredTexture =
-		blur_background(tf, width, height, alphaTexture);
+	// The focal blur depends on depth, not on a background to cache
+	const bool cachedBlur = tf->blurBackground > 0 &&
+				!tf->enableFocalBlur &&
+				tf->backgroundPlate.isEnabled();
+	gs_texture_t *blurredTexture = nullptr;
+	{
+		ScopedStageTimer timer(tf->profiler, PROFILER_STAGE_BLUR);
+		if (cachedBlur) {
+			blurredTexture = cached_background(tf, width, height,
+							   alphaTexture);
+		}
+		if (!blurredTexture) {
+			blurredTexture = blur_background(tf, width, height,
+							 alphaTexture);
+		}
+	}
 
 	if (!obs_source_process_filter_begin(tf->source, GS_RGBA,
 					     OBS_ALLOW_DIRECT_RENDERING)) {
 		if (tf->source) {
 			obs_source_skip_video_filter(tf->source);
 		}
-		gs_texture_destroy(alphaTexture);
-		gs_texture_destroy(blurredTexture);
 		return;
 	}
 
@@ -844,6 +1667,9 @@ void background_filter_video_render(void *data, gs_effect_t *_effect)
 	if (tf->blurBackground > 0) {
 		if (tf->enableFocalBlur)
 			techName = "DrawWithFocalBlur";
+		else if (cachedBlur)
+			// The plate has no foreground, blend in the source
+			techName = "DrawWithCachedBlur";
 		else
 			techName = "DrawWithBlur";
 	} else {
@@ -854,7 +1680,4 @@ void background_filter_video_render(void *data, gs_effect_t *_effect)
 					   techName);
 
 	gs_blend_state_pop();
-
-	gs_texture_destroy(alphaTexture);
-	gs_texture_destroy(blurredTexture);
 }
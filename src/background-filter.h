@@ -12,6 +12,7 @@ obs_properties_t *background_filter_properties(void *data);
 void background_filter_update(void *data, obs_data_t *settings);
 void background_filter_activate(void *data);
 void background_filter_deactivate(void *data);
+void background_filter_show(void *data);
 void background_filter_video_tick(void *data, float seconds);
 void background_filter_video_render(void *data, gs_effect_t *_effect);
 
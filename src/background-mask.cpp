@@ -0,0 +1,274 @@
+#include "background-mask.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <chrono>
+#include <limits>
+
+#include <plugin-support.h>
+#include "ort-utils/ort-session-utils.h"
+#include "image-utils/change-detection.h"
+
+void updateMaskSchedule(background_mask_pipeline *tf)
+{
+	tf->maskScheduler.setFixedInterval(tf->maskEveryXFrames);
+	tf->maskScheduler.setBudget(
+		tf->adaptiveMaskRate ? (float)tf->inferenceBudget / 100.0f
+				     : 0.0f);
+	tf->maskScheduler.reset();
+}
+
+std::shared_ptr<filter_data> getCascadeRefiner(background_mask_pipeline *tf)
+{
+	std::lock_guard<std::mutex> lock(tf->cascadeLock);
+	return tf->refiner;
+}
+
+/**
+  * @brief The region of the source a frame covers
+*/
+static cv::Rect getFrameRoi(const Frame &frame)
+{
+	return frame.sourceRoi.empty() ? cv::Rect(0, 0, (int)frame.sourceWidth,
+						  (int)frame.sourceHeight)
+				       : frame.sourceRoi;
+}
+
+/**
+  * @brief Move the last inferred mask along the motion from its frame to this
+  * frame, and publish it for rendering
+*/
+static void warpMaskToFrame(background_mask_pipeline *tf, const Frame &frame)
+{
+	if (frame.thumbnail.empty()) {
+		return;
+	}
+	const cv::Rect roi = getFrameRoi(frame);
+
+	std::lock_guard<std::mutex> lock(tf->outputLock);
+	// Thumbnails of different regions are not comparable
+	if (tf->inferredMask.empty() || tf->inferredMaskRoi != roi ||
+	    tf->inferredThumbnail.size() != frame.thumbnail.size()) {
+		return;
+	}
+	warpMaskWithMotion(tf->inferredMask, tf->inferredThumbnail,
+			   frame.thumbnail, tf->backgroundMask,
+			   tf->warpScratch);
+	tf->backgroundMaskUpdated = true;
+}
+
+BackgroundFrameGate gateBackgroundFrame(background_mask_pipeline *tf,
+					const Frame &frame)
+{
+	BackgroundFrameGate gate;
+	tf->stats.frames++;
+
+	if (tf->warpMask) {
+		// Follow the subject until the next mask is inferred
+		warpMaskToFrame(tf, frame);
+	}
+
+	// Compare the small thumbnails made during readback, not the frames
+	double psnr = std::numeric_limits<double>::infinity();
+	if (tf->enableImageSimilarity || tf->adaptiveMaskRate ||
+	    tf->backgroundPlate.isEnabled()) {
+		// Thumbnails of different regions are not comparable
+		if (!tf->lastThumbnail.empty() && !frame.thumbnail.empty() &&
+		    tf->lastThumbnailRoi == frame.sourceRoi) {
+			// calculate PSNR
+			psnr = cv::PSNR(tf->lastThumbnail, frame.thumbnail);
+			const int changedTiles = computeChangeMap(
+				tf->lastThumbnail, frame.thumbnail,
+				CHANGE_MAP_THRESHOLD, tf->changeMap);
+			tf->backgroundPlate.addChanges(tf->changeMap,
+						       frame.sourceRoi,
+						       frame.sourceWidth,
+						       frame.sourceHeight);
+
+			if (tf->enableImageSimilarity &&
+			    psnr > tf->imageSimilarityThreshold &&
+			    changedTiles == 0) {
+				// The image is almost the same as the previous one. Skip processing.
+				tf->stats.similaritySkips++;
+				return gate;
+			}
+			if (psnr < SCENE_CUT_PSNR) {
+				// Don't carry the previous shot's state over
+				resetRecurrentState(tf);
+				tf->backgroundPlate.invalidate();
+			}
+		}
+		frame.thumbnail.copyTo(tf->lastThumbnail);
+		tf->lastThumbnailRoi = frame.sourceRoi;
+	} else {
+		tf->lastThumbnail.release();
+		tf->changeMap.release();
+	}
+
+	if (!tf->maskScheduler.shouldRecompute(psnr)) {
+		// We are skipping processing of the mask for this frame.
+		// Render keeps using the background mask previously generated.
+		tf->stats.scheduledSkips++;
+		return gate;
+	}
+	gate.infer = true;
+
+	const std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (refiner && refiner->modelInstalled &&
+	    ++tf->cascadeMaskCount >= tf->cascadeEveryXMasks) {
+		tf->cascadeMaskCount = 0;
+		gate.refine = true;
+	}
+	return gate;
+}
+
+bool calculateBackgroundMask(background_mask_pipeline *tf, const Frame &frame)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const cv::Rect fullFrame(0, 0, (int)frame.sourceWidth,
+				 (int)frame.sourceHeight);
+	const cv::Rect roi = getFrameRoi(frame);
+
+	// The refiner's last mask, if it covers the same region.
+	// Copied, the refiner writes the next one into its buffers.
+	bool cascade = false;
+	{
+		std::lock_guard<std::mutex> lock(tf->cascadeLock);
+		if (!tf->cascadeMask.empty() && tf->cascadeRoi == roi) {
+			tf->cascadeMask.copyTo(tf->cascadeMaskCopy);
+			tf->cascadeThumbnail.copyTo(tf->cascadeThumbnailCopy);
+			cascade = true;
+		}
+	}
+
+	// If we have a threshold, apply it. Otherwise, just use the inverted
+	// model output as the mask. We need to make tf->threshold (float [0,1])
+	// be in [0,255]
+	const uint8_t threshold = (uint8_t)(tf->threshold * 255.0f);
+	{
+		std::unique_lock<std::mutex> lock(tf->modelMutex);
+		ScopedStageTimer timer(tf->profiler, PROFILER_STAGE_INFERENCE);
+		// Process the image to find the mask. The threshold is applied
+		// after fusing in cascade mode.
+		if (!runFilterModelInferenceToMask(
+			    tf, frame.imageBGRA,
+			    tf->enableThreshold && !cascade, threshold,
+			    tf->modelMask)) {
+			tf->modelMask.release();
+		}
+	}
+
+	if (tf->modelMask.empty()) {
+		// Something went wrong. Just use the previous mask.
+		obs_log(LOG_WARNING,
+			"Background mask is empty. This shouldn't happen. Using previous mask.");
+		return false;
+	}
+
+	// The mask refined and published below, a view of the buffer it was
+	// written to
+	cv::Mat backgroundMask = tf->modelMask;
+	if (cascade) {
+		// Move the refiner's mask to this frame, then let it replace
+		// the uncertain edges of the fast mask
+		const bool warp = !frame.thumbnail.empty() &&
+				  tf->cascadeThumbnailCopy.size() ==
+					  frame.thumbnail.size();
+		if (warp) {
+			warpMaskWithMotion(tf->cascadeMaskCopy,
+					   tf->cascadeThumbnailCopy,
+					   frame.thumbnail, tf->cascadeWarped,
+					   tf->cascadeWarpScratch);
+		}
+		fuseCascadeMasks(tf->modelMask,
+				 warp ? tf->cascadeWarped : tf->cascadeMaskCopy,
+				 tf->cascadeFused, tf->cascadeScratch);
+		if (tf->enableThreshold) {
+			// The fused mask holds 255 - value, so this is
+			// value < threshold, as without the cascade
+			cv::threshold(tf->cascadeFused, tf->cascadeFused,
+				      255 - threshold, 255, cv::THRESH_BINARY);
+		}
+		backgroundMask = tf->cascadeFused;
+	}
+
+	// Follow the subject for the next readbacks
+	tf->roiTracker.update(backgroundMask, frame.sourceRoi,
+			      frame.sourceWidth, frame.sourceHeight);
+
+	if (roi != tf->lastMaskRoi) {
+		// Masks of different regions don't line up
+		tf->lastBackgroundMask.release();
+		tf->lastMaskRoi = roi;
+	}
+
+	// Temporal smoothing, contour filtering and feathering
+	MaskRefinement refinement;
+	refinement.enableThreshold = tf->enableThreshold;
+	refinement.threshold = tf->threshold;
+	refinement.temporalSmoothFactor = tf->temporalSmoothFactor;
+	refinement.contourFilter = tf->contourFilter;
+	refinement.smoothContour = tf->smoothContour;
+	refinement.feather = tf->feather;
+	{
+		ScopedStageTimer timer(tf->profiler, PROFILER_STAGE_REFINEMENT);
+		refineBackgroundMask(refinement, roi.width, roi.height,
+				     backgroundMask, tf->lastBackgroundMask,
+				     tf->refinementScratch);
+	}
+
+	// Publish the mask for rendering. It is mapped onto its region of the
+	// source when upsampled.
+	{
+		std::lock_guard<std::mutex> lock(tf->outputLock);
+		backgroundMask.copyTo(tf->backgroundMask);
+		if (tf->warpMask && !frame.thumbnail.empty()) {
+			// Later frames warp it until the next mask
+			backgroundMask.copyTo(tf->inferredMask);
+			frame.thumbnail.copyTo(tf->inferredThumbnail);
+			tf->inferredMaskRoi = roi;
+		} else {
+			tf->inferredMask.release();
+		}
+		tf->backgroundMaskRegion = cv::Rect2f(
+			(float)roi.x / (float)fullFrame.width,
+			(float)roi.y / (float)fullFrame.height,
+			(float)roi.width / (float)fullFrame.width,
+			(float)roi.height / (float)fullFrame.height);
+		tf->binarizeMask = maskNeedsBinarize(refinement);
+		tf->backgroundMaskUpdated = true;
+	}
+
+	// Feed the mask scheduler the cost of a mask
+	tf->maskScheduler.addInferenceLatency(std::chrono::steady_clock::now() -
+					      start);
+	tf->stats.addInference();
+	return true;
+}
+
+bool calculateCascadeMask(background_mask_pipeline *tf, const Frame &frame)
+{
+	std::shared_ptr<filter_data> refiner = getCascadeRefiner(tf);
+	if (!refiner) {
+		return false;
+	}
+	{
+		std::unique_lock<std::mutex> lock(refiner->modelMutex);
+		if (!runFilterModelInferenceToMask(refiner.get(),
+						   frame.imageBGRA, false, 0,
+						   tf->refinerMask)) {
+			return false;
+		}
+	}
+	refiner->stats.addInference();
+
+	std::lock_guard<std::mutex> lock(tf->cascadeLock);
+	tf->refinerMask.copyTo(tf->cascadeMask);
+	if (frame.thumbnail.empty()) {
+		tf->cascadeThumbnail.release();
+	} else {
+		frame.thumbnail.copyTo(tf->cascadeThumbnail);
+	}
+	tf->cascadeRoi = getFrameRoi(frame);
+	return true;
+}
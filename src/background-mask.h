@@ -0,0 +1,168 @@
+#ifndef BACKGROUND_MASK_H
+#define BACKGROUND_MASK_H
+
+#include <opencv2/core.hpp>
+
+#include <memory>
+#include <mutex>
+
+#include "FilterData.h"
+#include "image-utils/background-plate.h"
+#include "image-utils/mask-cascade.h"
+#include "image-utils/mask-refinement.h"
+#include "image-utils/mask-warp.h"
+#include "perf-utils/mask-scheduler.h"
+#include "perf-utils/stage-profiler.h"
+
+/**
+  * The background filter's frame pipeline up to the published mask, without
+  * OBS, so the benchmark's replay mode runs the same code as the filter.
+  *
+  * For every frame read back, the video thread calls gateBackgroundFrame,
+  * which warps the last mask to the frame, gates the frame by its similarity
+  * to the previous one and asks the mask scheduler. The frames it lets
+  * through go to calculateBackgroundMask, and in cascade mode some of them to
+  * calculateCascadeMask first, on the inference workers in the filter and
+  * inline in the benchmark. Render uploads the published mask.
+*/
+
+// Frames this different from the previous one are treated as a scene cut
+const double SCENE_CUT_PSNR = 15.0;
+// Change map tiles whose mean difference is above this have changed
+const double CHANGE_MAP_THRESHOLD = 12.0;
+
+// Defaults of the settings, shared with the benchmark
+const float DEFAULT_TEMPORAL_SMOOTH_FACTOR = 0.85f;
+const float DEFAULT_IMAGE_SIMILARITY_THRESHOLD = 35.0f;
+// Percent of each frame interval inference may use
+const int DEFAULT_INFERENCE_BUDGET = 80;
+const int DEFAULT_ROI_FULL_FRAME_INTERVAL = 30;
+const int DEFAULT_CASCADE_EVERY_X_MASKS = 6;
+
+/**
+  * @brief The settings and state of the mask pipeline
+*/
+struct background_mask_pipeline : public filter_data {
+	bool enableThreshold = true;
+	float threshold = 0.5f;
+	float contourFilter = 0.05f;
+	float smoothContour = 0.5f;
+	float feather = 0.0f;
+	float temporalSmoothFactor = DEFAULT_TEMPORAL_SMOOTH_FACTOR;
+	float imageSimilarityThreshold = DEFAULT_IMAGE_SIMILARITY_THRESHOLD;
+	bool enableImageSimilarity = true;
+	int maskEveryXFrames = 1;
+	bool adaptiveMaskRate = true;
+	int inferenceBudget = DEFAULT_INFERENCE_BUDGET;
+	MaskScheduler maskScheduler;
+
+	// Model-resolution mask, upsampled to the source when rendering
+	cv::Mat backgroundMask;
+	// The region of the source backgroundMask covers, normalized
+	cv::Rect2f backgroundMaskRegion{0.0f, 0.0f, 1.0f, 1.0f};
+	bool binarizeMask = false;
+	// Set when a new mask is published, cleared when it is uploaded
+	bool backgroundMaskUpdated = false;
+	// Warp the mask along the motion between inferences, see mask-warp.h
+	bool warpMask = false;
+	// The last inferred mask, the thumbnail of its frame and the region of
+	// the source they cover. Guarded by outputLock.
+	cv::Mat inferredMask;
+	cv::Mat inferredThumbnail;
+	cv::Rect inferredMaskRoi;
+	MaskWarpScratch warpScratch;
+	cv::Mat lastBackgroundMask;
+	MaskRefinementScratch refinementScratch;
+	// Cascade mode: a heavier model on its own session and worker refines
+	// the edges of the masks, see mask-cascade.h
+	std::shared_ptr<filter_data> refiner;
+	int cascadeEveryXMasks = DEFAULT_CASCADE_EVERY_X_MASKS;
+	int cascadeMaskCount = 0;
+	// The refiner's last mask, the thumbnail of its frame and the region of
+	// the source they cover. Guarded by cascadeLock.
+	std::mutex cascadeLock;
+	cv::Mat cascadeMask;
+	cv::Mat cascadeThumbnail;
+	cv::Rect cascadeRoi;
+	// Used by the mask worker only: its copy of the refiner's last mask and
+	// thumbnail, the mask warped to the frame and the fused mask
+	cv::Mat cascadeMaskCopy;
+	cv::Mat cascadeThumbnailCopy;
+	cv::Mat cascadeWarped;
+	cv::Mat cascadeFused;
+	MaskWarpScratch cascadeWarpScratch;
+	MaskCascadeScratch cascadeScratch;
+	// The refiner's mask, used by the refiner's worker only
+	cv::Mat refinerMask;
+	// The raw mask of the model, used by the mask worker only
+	cv::Mat modelMask;
+	// The region of the source lastBackgroundMask covers
+	cv::Rect lastMaskRoi;
+	// Thumbnail of the last frame that passed the similarity check
+	cv::Mat lastThumbnail;
+	cv::Rect lastThumbnailRoi;
+	// Tiles that changed in the last frame, see change-detection.h
+	cv::Mat changeMap;
+	// Cached blurred background, only refreshed where the source changed
+	BackgroundPlate backgroundPlate;
+
+	StageProfiler profiler;
+};
+
+/**
+  * @brief What to do with a frame, see gateBackgroundFrame
+*/
+struct BackgroundFrameGate {
+	// Compute a new mask from the frame
+	bool infer = false;
+	// Run the refiner on the frame too, before the mask in the benchmark
+	bool refine = false;
+};
+
+/**
+  * @brief Apply maskEveryXFrames, adaptiveMaskRate and inferenceBudget to the
+  * mask scheduler, and start measuring again
+*/
+void updateMaskSchedule(background_mask_pipeline *tf);
+
+/**
+  * @brief The refinement model of cascade mode, nullptr when it is off
+*/
+std::shared_ptr<filter_data>
+getCascadeRefiner(background_mask_pipeline *tf);
+
+/**
+  * @brief Decide what to do with a frame read back
+  *
+  * Runs on the video thread, after the frame interval was added to the mask
+  * scheduler. Warps the last mask to the frame, compares the frame with the
+  * last one that passed, marks the changes stale in the background plate,
+  * resets the recurrent state on a scene cut and asks the mask scheduler.
+  * Counts the frame and its skip in tf->stats.
+*/
+BackgroundFrameGate gateBackgroundFrame(background_mask_pipeline *tf,
+					const Frame &frame);
+
+/**
+  * @brief Calculate the background mask of a frame and publish it for rendering
+  *
+  * Runs on the inference worker thread, so it may block on modelMutex while the
+  * model is being swapped. Rendering keeps using the previous mask meanwhile.
+  * The mask is fused with the refiner's last one in cascade mode, then
+  * temporally smoothed, contour filtered and feathered.
+  *
+  * @return true  if a mask was published. Throws on inference errors.
+*/
+bool calculateBackgroundMask(background_mask_pipeline *tf, const Frame &frame);
+
+/**
+  * @brief Run the refinement model on a frame and keep its mask for the fast
+  * masks that follow
+  *
+  * Runs on the refiner's inference worker thread.
+  *
+  * @return true  if the refiner's mask was kept. Throws on inference errors.
+*/
+bool calculateCascadeMask(background_mask_pipeline *tf, const Frame &frame);
+
+#endif /* BACKGROUND_MASK_H */
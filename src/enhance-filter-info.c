@@ -12,6 +12,7 @@ struct obs_source_info enhance_filter_info = {
 	.update = enhance_filter_update,
 	.activate = enhance_filter_activate,
 	.deactivate = enhance_filter_deactivate,
+	.show = enhance_filter_show,
 	.video_tick = enhance_filter_video_tick,
 	.video_render = enhance_filter_video_render,
 };
@@ -15,11 +15,19 @@
 #include <new>
 #include <mutex>
 #include <regex>
+#include <utility>
 
 #include <plugin-support.h>
 #include "consts.h"
 #include "obs-utils/obs-utils.h"
+#include "obs-utils/stats-handler.h"
 #include "ort-utils/ort-session-utils.h"
+#include "ort-utils/inference-worker.h"
+#include "ort-utils/model-swap.h"
+#include "image-utils/tiled-ops.h"
+#include "image-utils/enhance-transform.h"
+#include "perf-utils/worker-pool.h"
+#include "perf-utils/core-budget.h"
 #include "models/ModelTBEFN.h"
 #include "models/ModelZeroDCE.h"
 #include "models/ModelURetinex.h"
@@ -27,6 +35,18 @@
 
 struct enhance_filter : public filter_data {
 	cv::Mat outputBGRA;
+	// Set when a new output is published, cleared when it is uploaded
+	bool outputUpdated = false;
+	gs_texture_t *outputTexture = nullptr;
+	// Full resolution mode: the worker fits a per-tile transform to the
+	// model output instead, see image-utils/enhance-transform.h
+	std::atomic<bool> fullResolution{false};
+	EnhanceTransform transform;
+	gs_texture_t *transformTextures[3] = {nullptr, nullptr, nullptr};
+	// Used by the inference worker only: the model output and the transform
+	// fitted to it, swapped with transform when published
+	cv::Mat modelOutput;
+	EnhanceTransform fittedTransform;
 	gs_effect_t *blendEffect;
 	float blendFactor;
 };
@@ -44,8 +64,20 @@ obs_properties_t *enhance_filter_properties(void *data)
 	obs_properties_add_float_slider(props, "blend",
 					obs_module_text("EffectStrengh"), 0.0,
 					1.0, 0.05);
+	obs_properties_add_bool(props, "full_resolution",
+				obs_module_text("FullResolutionEnhance"));
 	obs_properties_add_int_slider(props, "numThreads",
 				      obs_module_text("NumThreads"), 0, 8, 1);
+	obs_properties_add_int_slider(props, "post_process_threads",
+				      obs_module_text("PostProcessThreads"), 0,
+				      8, 1);
+	obs_properties_add_int_slider(props, "readback_depth",
+				      obs_module_text("ReadbackDepth"), 1, 4, 1);
+	obs_properties_add_int_slider(props, "release_inactive_after",
+				      obs_module_text("ReleaseInactiveAfter"),
+				      0, 600, 10);
+	obs_properties_add_bool(props, "gpu_downscale",
+				obs_module_text("GPUDownscale"));
 	obs_property_t *p_model_select = obs_properties_add_list(
 		props, "model_select", obs_module_text("EnhancementModel"),
 		OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
@@ -97,7 +129,12 @@ obs_properties_t *enhance_filter_properties(void *data)
 void enhance_filter_defaults(obs_data_t *settings)
 {
 	obs_data_set_default_double(settings, "blend", 1.0);
+	obs_data_set_default_bool(settings, "full_resolution", false);
 	obs_data_set_default_int(settings, "numThreads", 1);
+	obs_data_set_default_int(settings, "post_process_threads", 0);
+	obs_data_set_default_int(settings, "readback_depth", 2);
+	obs_data_set_default_int(settings, "release_inactive_after", 60);
+	obs_data_set_default_bool(settings, "gpu_downscale", true);
 	obs_data_set_default_string(settings, "model_select",
 				    MODEL_ENHANCE_TBEFN);
 #if _WIN32
@@ -114,12 +151,21 @@ void enhance_filter_activate(void *data)
 {
 	struct enhance_filter *tf = reinterpret_cast<enhance_filter *>(data);
 	tf->isDisabled = false;
+	setCoreBudgetActive(tf, true);
 }
 
 void enhance_filter_deactivate(void *data)
 {
 	struct enhance_filter *tf = reinterpret_cast<enhance_filter *>(data);
 	tf->isDisabled = true;
+	setCoreBudgetActive(tf, false);
+}
+
+void enhance_filter_show(void *data)
+{
+	struct enhance_filter *tf = reinterpret_cast<enhance_filter *>(data);
+	// Previewed or about to go live: start loading before the first frame
+	markModelUsed(tf);
 }
 
 void enhance_filter_update(void *data, obs_data_t *settings)
@@ -128,27 +174,50 @@ void enhance_filter_update(void *data, obs_data_t *settings)
 	struct enhance_filter *tf = reinterpret_cast<enhance_filter *>(data);
 
 	tf->blendFactor = (float)obs_data_get_double(settings, "blend");
+	const bool fullResolution =
+		obs_data_get_bool(settings, "full_resolution");
+	if (fullResolution != tf->fullResolution) {
+		// The output of the other mode must not be drawn
+		std::lock_guard<std::mutex> lock(tf->outputLock);
+		tf->fullResolution = fullResolution;
+		tf->outputBGRA.release();
+		tf->transform = EnhanceTransform();
+		tf->outputUpdated = false;
+	}
+	tf->readbackDepth =
+		(uint32_t)obs_data_get_int(settings, "readback_depth");
+	tf->releaseInactiveAfter = (uint32_t)obs_data_get_int(
+		settings, "release_inactive_after");
+	tf->postProcessThreads =
+		(uint32_t)obs_data_get_int(settings, "post_process_threads");
+	tf->gpuDownscale = obs_data_get_bool(settings, "gpu_downscale");
 	const uint32_t newNumThreads =
 		(uint32_t)obs_data_get_int(settings, "numThreads");
 	const std::string newModel =
 		obs_data_get_string(settings, "model_select");
 	const std::string newUseGpu = obs_data_get_string(settings, "useGPU");
 
-	if (tf->modelSelection.empty() || tf->modelSelection != newModel ||
-	    tf->useGPU != newUseGpu || tf->numThreads != newNumThreads) {
-		tf->numThreads = newNumThreads;
-		tf->modelSelection = newModel;
-		if (tf->modelSelection == MODEL_ENHANCE_TBEFN) {
-			tf->model.reset(new ModelTBEFN);
-		} else if (tf->modelSelection == MODEL_ENHANCE_ZERODCE) {
-			tf->model.reset(new ModelZeroDCE);
-		} else if (tf->modelSelection == MODEL_ENHANCE_URETINEX) {
-			tf->model.reset(new ModelURetinex);
+	OrtSessionConfig newSession;
+	newSession.modelSelection = newModel;
+	newSession.useGPU = newUseGpu;
+	newSession.numThreads = newNumThreads;
+
+	// After a failed build, any update tries again
+	if (tf->requestedSession != newSession || hasModelSwapFailed(tf)) {
+		tf->requestedSession = newSession;
+
+		// The current model keeps running until its session is built
+		std::unique_ptr<Model> model;
+		if (newModel == MODEL_ENHANCE_TBEFN) {
+			model = std::make_unique<ModelTBEFN>();
+		} else if (newModel == MODEL_ENHANCE_ZERODCE) {
+			model = std::make_unique<ModelZeroDCE>();
+		} else if (newModel == MODEL_ENHANCE_URETINEX) {
+			model = std::make_unique<ModelURetinex>();
 		} else {
-			tf->model.reset(new ModelBCHW);
+			model = std::make_unique<ModelBCHW>();
 		}
-		tf->useGPU = newUseGpu;
-		createOrtSession(tf);
+		requestModelSwap(tf, newSession, std::move(model));
 	}
 
 	if (tf->blendEffect == nullptr) {
@@ -162,6 +231,81 @@ void enhance_filter_update(void *data, obs_data_t *settings)
 	}
 }
 
+/**
+  * @brief Run the enhancement model on a frame and publish the output for rendering
+  *
+  * Runs on the inference worker thread.
+*/
+static void enhanceImage(struct enhance_filter *tf, const Frame &frame)
+{
+	cv::Mat &outputImage = tf->modelOutput;
+	try {
+		std::unique_lock<std::mutex> lock(tf->modelMutex);
+		if (!runFilterModelInference(tf, frame.imageBGRA,
+					     outputImage)) {
+			return;
+		}
+	} catch (const std::exception &e) {
+		obs_log(LOG_ERROR, "Exception caught: %s", e.what());
+		return;
+	}
+	tf->stats.addInference();
+
+	if (tf->fullResolution) {
+		// Render applies the transform to the source on the GPU
+		fitEnhanceTransform(frame.imageBGRA, outputImage,
+				    tf->fittedTransform);
+
+		std::lock_guard<std::mutex> lock(tf->outputLock);
+		if (tf->fullResolution) {
+			// The next fit reuses the buffers of the previous one
+			std::swap(tf->transform, tf->fittedTransform);
+			tf->outputUpdated = true;
+		}
+		return;
+	}
+
+	// Put output image back to source rendering pipeline
+	{
+		std::lock_guard<std::mutex> lock(tf->outputLock);
+		if (tf->fullResolution) {
+			return;
+		}
+
+		// convert to RGBA
+		const uint32_t threads = resolvePostProcessThreads(
+			tf->postProcessThreads, tf->numThreads);
+		tiledCvtColor(outputImage, tf->outputBGRA, cv::COLOR_BGR2RGBA,
+			      4, threads);
+		tf->outputUpdated = true;
+	}
+}
+
+/**
+  * @brief The enhance filter's part of its stats, see
+  * obs-utils/stats-handler.h
+*/
+static void writeEnhanceStats(filter_data *data, obs_data_t *stats)
+{
+	struct enhance_filter *tf = static_cast<enhance_filter *>(data);
+	// Every frame is enhanced
+	obs_data_set_double(stats, "requested_fps", getVideoFrameRate());
+	obs_data_set_bool(stats, "full_resolution", tf->fullResolution);
+}
+
+/**
+  * @brief The bytes of the output textures. Call in the graphics context.
+*/
+static uint64_t getEnhanceTextureBytes(filter_data *data)
+{
+	struct enhance_filter *tf = static_cast<enhance_filter *>(data);
+	uint64_t bytes = getTextureBytes(tf->outputTexture);
+	for (gs_texture_t *texture : tf->transformTextures) {
+		bytes += getTextureBytes(texture);
+	}
+	return bytes;
+}
+
 void *enhance_filter_create(obs_data_t *settings, obs_source_t *source)
 {
 	void *data = bmalloc(sizeof(struct enhance_filter));
@@ -170,12 +314,20 @@ void *enhance_filter_create(obs_data_t *settings, obs_source_t *source)
 	tf->source = source;
 	tf->texrender = gs_texrender_create(GS_BGRA, GS_ZS_NONE);
 
-	std::string instanceName{"enhance-portrait-inference"};
-	tf->env.reset(new Ort::Env(OrtLoggingLevel::ORT_LOGGING_LEVEL_ERROR,
-				   instanceName.c_str()));
-
+	deferModelLoad(tf);
+	// Counts toward the CPU split once OBS activates it
+	joinCoreBudget(tf, false);
 	enhance_filter_update(tf, settings);
 
+	startInferenceWorker(tf, [tf](const Frame &frame) {
+		enhanceImage(tf, frame);
+	});
+
+	FilterStatsHandler statsHandler;
+	statsHandler.write = writeEnhanceStats;
+	statsHandler.textureBytes = getEnhanceTextureBytes;
+	registerFilterStats(tf, statsHandler);
+
 	return tf;
 }
 
@@ -184,11 +336,21 @@ void enhance_filter_destroy(void *data)
 	struct enhance_filter *tf = reinterpret_cast<enhance_filter *>(data);
 
 	if (tf) {
+		tf->isDisabled = true;
+		unregisterFilterStats(tf);
+
+		stopModelSwapWorker(tf);
+		stopInferenceWorker(tf);
+		leaveCoreBudget(tf);
+
 		obs_enter_graphics();
 		gs_texrender_destroy(tf->texrender);
-		if (tf->stagesurface) {
-			gs_stagesurface_destroy(tf->stagesurface);
+		gs_texrender_destroy(tf->readbackTexrender);
+		gs_texture_destroy(tf->outputTexture);
+		for (gs_texture_t *texture : tf->transformTextures) {
+			gs_texture_destroy(texture);
 		}
+		destroyStageSurfaces(tf);
 		gs_effect_destroy(tf->blendEffect);
 		obs_leave_graphics();
 		tf->~enhance_filter();
@@ -201,6 +363,29 @@ void enhance_filter_video_tick(void *data, float seconds)
 	UNUSED_PARAMETER(seconds);
 	struct enhance_filter *tf = reinterpret_cast<enhance_filter *>(data);
 
+	if (releaseUnusedModel(tf)) {
+		// The next frames create the buffers again
+		{
+			std::lock_guard<std::mutex> lock(tf->outputLock);
+			tf->outputBGRA.release();
+			tf->transform = EnhanceTransform();
+			tf->outputUpdated = false;
+		}
+		tf->frameRing.releaseBuffers();
+
+		obs_enter_graphics();
+		gs_texrender_destroy(tf->readbackTexrender);
+		tf->readbackTexrender = nullptr;
+		gs_texture_destroy(tf->outputTexture);
+		tf->outputTexture = nullptr;
+		for (gs_texture_t *&texture : tf->transformTextures) {
+			gs_texture_destroy(texture);
+			texture = nullptr;
+		}
+		destroyStageSurfaces(tf);
+		obs_leave_graphics();
+	}
+
 	if (tf->isDisabled) {
 		return;
 	}
@@ -209,42 +394,43 @@ void enhance_filter_video_tick(void *data, float seconds)
 		return;
 	}
 
-	if (tf->inputBGRA.empty()) {
+	// Take ownership of the newest frame read back by render
+	FramePtr frame = tf->frameRing.takeLatest();
+	if (!frame) {
 		return;
 	}
+	tf->stats.frames++;
 
-	// Get input image from source rendering pipeline
-	cv::Mat imageBGRA;
-	{
-		std::unique_lock<std::mutex> lock(tf->inputBGRALock,
-						  std::try_to_lock);
-		if (!lock.owns_lock()) {
-			return;
-		}
-		imageBGRA = tf->inputBGRA.clone();
-	}
+	// Inference runs on the worker thread. The video thread never waits for it.
+	submitFrameToInferenceWorker(tf, std::move(frame));
+}
 
-	cv::Mat outputImage;
-	try {
-		if (!runFilterModelInference(tf, imageBGRA, outputImage)) {
-			return;
-		}
-	} catch (const std::exception &e) {
-		obs_log(LOG_ERROR, "Exception caught: %s", e.what());
-		return;
+/**
+  * @brief Upload the transform to its textures if the worker published a new
+  * one. Call with outputLock held, in the graphics context.
+  *
+  * @return true  if the textures hold a transform
+*/
+static bool uploadEnhanceTransform(struct enhance_filter *tf)
+{
+	if (tf->transform.red.empty()) {
+		return false;
 	}
-
-	// Put output image back to source rendering pipeline
-	{
-		std::unique_lock<std::mutex> lock(tf->outputLock,
-						  std::try_to_lock);
-		if (!lock.owns_lock()) {
-			return;
+	if (!tf->outputUpdated && tf->transformTextures[0]) {
+		return true;
+	}
+	const cv::Mat *grids[3] = {&tf->transform.red, &tf->transform.green,
+				   &tf->transform.blue};
+	for (int i = 0; i < 3; i++) {
+		if (!uploadToDynamicTexture(tf->transformTextures[i], *grids[i],
+					    GS_RGBA32F)) {
+			obs_log(LOG_ERROR,
+				"Failed to upload the enhance transform");
+			return false;
 		}
-
-		// convert to RGBA
-		cv::cvtColor(outputImage, tf->outputBGRA, cv::COLOR_BGR2RGBA);
 	}
+	tf->outputUpdated = false;
+	return true;
 }
 
 void enhance_filter_video_render(void *data, gs_effect_t *_effect)
@@ -253,6 +439,8 @@ void enhance_filter_video_render(void *data, gs_effect_t *_effect)
 
 	struct enhance_filter *tf = reinterpret_cast<enhance_filter *>(data);
 
+	markModelUsed(tf);
+
 	// Get input from source
 	uint32_t width, height;
 	if (!getRGBAFromStageSurface(tf, width, height)) {
@@ -267,17 +455,31 @@ void enhance_filter_video_render(void *data, gs_effect_t *_effect)
 		return;
 	}
 
-	// Get output from neural network into texture
-	gs_texture_t *outputTexture = nullptr;
+	// Get output from neural network into texture. It is uploaded only
+	// when the worker published a new one.
+	bool fullResolution;
 	{
 		std::lock_guard<std::mutex> lock(tf->outputLock);
-		outputTexture = gs_texture_create(
-			tf->outputBGRA.cols, tf->outputBGRA.rows, GS_BGRA, 1,
-			(const uint8_t **)&tf->outputBGRA.data, 0);
-		if (!outputTexture) {
-			obs_log(LOG_ERROR, "Failed to create output texture");
+		fullResolution = tf->fullResolution;
+		if (fullResolution) {
+			if (!uploadEnhanceTransform(tf)) {
+				// No transform yet, the model is still loading
+				obs_source_skip_video_filter(tf->source);
+				return;
+			}
+		} else if (tf->outputBGRA.empty()) {
+			// No output yet, the model is still loading
 			obs_source_skip_video_filter(tf->source);
 			return;
+		} else if (tf->outputUpdated || !tf->outputTexture) {
+			if (!uploadToDynamicTexture(tf->outputTexture,
+						    tf->outputBGRA, GS_BGRA)) {
+				obs_log(LOG_ERROR,
+					"Failed to upload the output texture");
+				obs_source_skip_video_filter(tf->source);
+				return;
+			}
+			tf->outputUpdated = false;
 		}
 	}
 
@@ -290,19 +492,29 @@ void enhance_filter_video_render(void *data, gs_effect_t *_effect)
 	gs_eparam_t *yOffset =
 		gs_effect_get_param_by_name(tf->blendEffect, "yOffset");
 
-	gs_effect_set_texture(blendimage, outputTexture);
 	gs_effect_set_float(blendFactor, tf->blendFactor);
-	gs_effect_set_float(xOffset, 1.0f / float(width));
-	gs_effect_set_float(yOffset, 1.0f / float(height));
+	if (fullResolution) {
+		const char *names[3] = {"transformRed", "transformGreen",
+					"transformBlue"};
+		for (int i = 0; i < 3; i++) {
+			gs_effect_set_texture(
+				gs_effect_get_param_by_name(tf->blendEffect,
+							    names[i]),
+				tf->transformTextures[i]);
+		}
+	} else {
+		gs_effect_set_texture(blendimage, tf->outputTexture);
+		gs_effect_set_float(xOffset, 1.0f / float(width));
+		gs_effect_set_float(yOffset, 1.0f / float(height));
+	}
 
 	// Render texture
 	gs_blend_state_push();
 	gs_reset_blend_state();
 
 	obs_source_process_filter_tech_end(tf->source, tf->blendEffect, 0, 0,
-					   "Draw");
+					   fullResolution ? "DrawTransform"
+							  : "Draw");
 
 	gs_blend_state_pop();
-
-	gs_texture_destroy(outputTexture);
 }
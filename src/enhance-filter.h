@@ -12,6 +12,7 @@ obs_properties_t *enhance_filter_properties(void *data);
 void enhance_filter_update(void *data, obs_data_t *settings);
 void enhance_filter_activate(void *data);
 void enhance_filter_deactivate(void *data);
+void enhance_filter_show(void *data);
 void enhance_filter_video_tick(void *data, float seconds);
 void enhance_filter_video_render(void *data, gs_effect_t *_effect);
 
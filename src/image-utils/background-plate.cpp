@@ -0,0 +1,116 @@
+#include "background-plate.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <cmath>
+
+#include "image-utils/change-detection.h"
+
+// One stale tile per change map tile of a full frame readback
+static const int STALE_TILES_WIDTH = THUMBNAIL_WIDTH / CHANGE_MAP_TILE_SIZE;
+static const int STALE_TILES_HEIGHT = THUMBNAIL_HEIGHT / CHANGE_MAP_TILE_SIZE;
+
+void BackgroundPlate::setEnabled(bool enable)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (enable && !enabled) {
+		fullRefresh = true;
+	}
+	enabled = enable;
+}
+
+bool BackgroundPlate::isEnabled() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return enabled;
+}
+
+void BackgroundPlate::invalidate()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	fullRefresh = true;
+}
+
+void BackgroundPlate::addChanges(const cv::Mat &changeMap,
+				 const cv::Rect &frameRoi, uint32_t sourceWidth,
+				 uint32_t sourceHeight)
+{
+	if (changeMap.empty() || sourceWidth == 0 || sourceHeight == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!enabled || fullRefresh) {
+		return;
+	}
+	if (staleTiles.empty()) {
+		staleTiles = cv::Mat::zeros(STALE_TILES_HEIGHT,
+					    STALE_TILES_WIDTH, CV_8UC1);
+	}
+	if (awaitingMaskTiles.empty()) {
+		awaitingMaskTiles = cv::Mat::zeros(STALE_TILES_HEIGHT,
+						   STALE_TILES_WIDTH, CV_8UC1);
+	}
+
+	// The tiles the frame's region covers, rounded outwards
+	const cv::Rect roi = frameRoi.empty() ? cv::Rect(0, 0, (int)sourceWidth,
+							 (int)sourceHeight)
+					      : frameRoi;
+	const double scaleX = (double)STALE_TILES_WIDTH / sourceWidth;
+	const double scaleY = (double)STALE_TILES_HEIGHT / sourceHeight;
+	const int x0 = (int)std::floor(roi.x * scaleX);
+	const int y0 = (int)std::floor(roi.y * scaleY);
+	const int x1 = (int)std::ceil((roi.x + roi.width) * scaleX);
+	const int y1 = (int)std::ceil((roi.y + roi.height) * scaleY);
+	const cv::Rect tiles =
+		cv::Rect(x0, y0, x1 - x0, y1 - y0) &
+		cv::Rect(0, 0, STALE_TILES_WIDTH, STALE_TILES_HEIGHT);
+	if (tiles.empty()) {
+		return;
+	}
+
+	cv::Mat changed;
+	cv::resize(changeMap, changed, tiles.size(), 0, 0, cv::INTER_NEAREST);
+	cv::Mat stale = staleTiles(tiles);
+	cv::max(stale, changed, stale);
+	cv::Mat awaiting = awaitingMaskTiles(tiles);
+	cv::max(awaiting, changed, awaiting);
+}
+
+void BackgroundPlate::maskUpdated()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (awaitingMaskTiles.empty() || staleTiles.empty()) {
+		return;
+	}
+	cv::max(staleTiles, awaitingMaskTiles, staleTiles);
+	awaitingMaskTiles.setTo(0);
+}
+
+bool BackgroundPlate::takeRefresh(cv::Mat &refreshMap)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!enabled) {
+		return false;
+	}
+
+	if (++framesSinceFullRefresh >= FULL_REFRESH_FRAMES) {
+		fullRefresh = true;
+	}
+	if (fullRefresh) {
+		fullRefresh = false;
+		framesSinceFullRefresh = 0;
+		staleTiles.release();
+		awaitingMaskTiles.release();
+		refreshMap = cv::Mat(STALE_TILES_HEIGHT, STALE_TILES_WIDTH,
+				     CV_8UC1, cv::Scalar(255));
+		return true;
+	}
+
+	if (staleTiles.empty() || cv::countNonZero(staleTiles) == 0) {
+		return false;
+	}
+	refreshMap = staleTiles.clone();
+	staleTiles.setTo(0);
+	return true;
+}
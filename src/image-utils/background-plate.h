@@ -0,0 +1,75 @@
+#ifndef BACKGROUND_PLATE_H
+#define BACKGROUND_PLATE_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <mutex>
+
+/**
+  * @brief Tracks which parts of a cached blurred background plate are stale
+  *
+  * The plate itself lives on the GPU. This collects the change map tiles that
+  * changed since the plate was last refreshed, in source coordinates, and asks
+  * for a full refresh after FULL_REFRESH_FRAMES frames or when invalidated, so
+  * parts of the source the change maps don't cover can't go stale forever.
+  * Changed tiles are refreshed again once the next mask arrives, as the mask of
+  * the frame that changed lags behind it.
+  *
+  * addChanges is called from the video thread, takeRefresh and maskUpdated
+  * from the render thread and invalidate from any thread.
+*/
+class BackgroundPlate {
+public:
+	void setEnabled(bool enable);
+	bool isEnabled() const;
+
+	/**
+	  * @brief Refresh the whole plate on the next frame
+	*/
+	void invalidate();
+
+	/**
+	  * @brief Mark the changed tiles of a frame as stale
+	  *
+	  * @param changeMap  The change map of the frame, see computeChangeMap
+	  * @param frameRoi  The region of the source the frame covers, empty
+	  * for the whole source
+	  * @param sourceWidth  The width of the source
+	  * @param sourceHeight  The height of the source
+	*/
+	void addChanges(const cv::Mat &changeMap, const cv::Rect &frameRoi,
+			uint32_t sourceWidth, uint32_t sourceHeight);
+
+	/**
+	  * @brief A new mask is in use. Refresh the tiles that changed since
+	  * the previous one again.
+	*/
+	void maskUpdated();
+
+	/**
+	  * @brief Take the stale regions to refresh this frame
+	  *
+	  * Call once per rendered frame.
+	  *
+	  * @param refreshMap  The regions to refresh (output), CV_8UC1 covering
+	  * the whole source, 255 where stale and 0 elsewhere
+	  * @return true  if any part of the plate must be refreshed
+	*/
+	bool takeRefresh(cv::Mat &refreshMap);
+
+private:
+	// Refresh the whole plate at least this often, in frames
+	static const int FULL_REFRESH_FRAMES = 300;
+
+	mutable std::mutex mutex;
+	bool enabled = false;
+	bool fullRefresh = true;
+	int framesSinceFullRefresh = 0;
+	// Stale tiles, one pixel per change map tile of the whole source
+	cv::Mat staleTiles;
+	// Tiles that changed since the last mask
+	cv::Mat awaitingMaskTiles;
+};
+
+#endif /* BACKGROUND_PLATE_H */
@@ -0,0 +1,27 @@
+#include "change-detection.h"
+
+#include <opencv2/imgproc.hpp>
+
+void makeThumbnail(const cv::Mat &imageBGRA, cv::Mat &thumbnail)
+{
+	thread_local cv::Mat smallBGRA;
+	// Area averaging also filters out most of the sensor noise
+	cv::resize(imageBGRA, smallBGRA,
+		   cv::Size(THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT), 0, 0,
+		   cv::INTER_AREA);
+	cv::cvtColor(smallBGRA, thumbnail, cv::COLOR_BGRA2GRAY);
+}
+
+int computeChangeMap(const cv::Mat &previous, const cv::Mat &current,
+		     double threshold, cv::Mat &changeMap)
+{
+	thread_local cv::Mat difference;
+	cv::absdiff(previous, current, difference);
+	// The mean difference of every tile
+	cv::resize(difference, changeMap,
+		   cv::Size(difference.cols / CHANGE_MAP_TILE_SIZE,
+			    difference.rows / CHANGE_MAP_TILE_SIZE),
+		   0, 0, cv::INTER_AREA);
+	cv::threshold(changeMap, changeMap, threshold, 255, cv::THRESH_BINARY);
+	return cv::countNonZero(changeMap);
+}
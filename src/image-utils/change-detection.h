@@ -0,0 +1,35 @@
+#ifndef CHANGE_DETECTION_H
+#define CHANGE_DETECTION_H
+
+#include <opencv2/core.hpp>
+
+// Size of the grayscale thumbnail frames are compared on
+#define THUMBNAIL_WIDTH 64
+#define THUMBNAIL_HEIGHT 36
+// Thumbnail pixels per change map tile side, for a 16x9 change map
+#define CHANGE_MAP_TILE_SIZE 4
+
+/**
+  * @brief Shrink a BGRA frame to a THUMBNAIL_WIDTH x THUMBNAIL_HEIGHT grayscale
+  * thumbnail
+  *
+  * @param imageBGRA  The frame
+  * @param thumbnail  The thumbnail (output), CV_8UC1
+*/
+void makeThumbnail(const cv::Mat &imageBGRA, cv::Mat &thumbnail);
+
+/**
+  * @brief Mark the tiles that changed between two thumbnails
+  *
+  * @param previous  The earlier thumbnail
+  * @param current  The later thumbnail, same size as previous
+  * @param threshold  The mean absolute difference in [0, 255] above which a
+  * tile counts as changed
+  * @param changeMap  The change map (output), CV_8UC1 with one pixel per tile,
+  * 255 for changed tiles and 0 elsewhere
+  * @return The number of changed tiles
+*/
+int computeChangeMap(const cv::Mat &previous, const cv::Mat &current,
+		     double threshold, cv::Mat &changeMap);
+
+#endif /* CHANGE_DETECTION_H */
@@ -0,0 +1,134 @@
+#include "enhance-transform.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <array>
+#include <vector>
+
+// Weight, per pixel of a tile, of the pull toward the identity color matrix
+static const double TRANSFORM_RIDGE = 1e-3;
+
+/**
+  * @brief Least squares sums of a set of pixels: x x^T and x y^T with
+  * x = (r, g, b, 1) the input and y = (r, g, b) the output color
+*/
+struct TileSums {
+	std::array<double, 16> xx{};
+	std::array<double, 12> xy{};
+
+	void add(const TileSums &other, double weight)
+	{
+		for (size_t i = 0; i < xx.size(); i++) {
+			xx[i] += other.xx[i] * weight;
+		}
+		for (size_t i = 0; i < xy.size(); i++) {
+			xy[i] += other.xy[i] * weight;
+		}
+	}
+};
+
+/**
+  * @brief Solve the regularized least squares of a tile into its grid pixels
+*/
+static void solveTile(const TileSums &sums, cv::Vec4f &red, cv::Vec4f &green,
+		      cv::Vec4f &blue)
+{
+	// (X^T X + ridge D) A = X^T Y + ridge D I, D leaving the offset free
+	const double ridge = TRANSFORM_RIDGE * sums.xx[15];
+	thread_local cv::Mat lhs(4, 4, CV_64F);
+	thread_local cv::Mat rhs(4, 3, CV_64F);
+	thread_local cv::Mat coefficients;
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			lhs.at<double>(i, j) = sums.xx[i * 4 + j];
+		}
+		for (int j = 0; j < 3; j++) {
+			rhs.at<double>(i, j) = sums.xy[i * 3 + j];
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		lhs.at<double>(i, i) += ridge;
+		rhs.at<double>(i, i) += ridge;
+	}
+
+	if (sums.xx[15] <= 0.0 ||
+	    !cv::solve(lhs, rhs, coefficients, cv::DECOMP_CHOLESKY)) {
+		// Leave the tile unchanged
+		red = cv::Vec4f(1.0f, 0.0f, 0.0f, 0.0f);
+		green = cv::Vec4f(0.0f, 1.0f, 0.0f, 0.0f);
+		blue = cv::Vec4f(0.0f, 0.0f, 1.0f, 0.0f);
+		return;
+	}
+	cv::Vec4f *channels[3] = {&red, &green, &blue};
+	for (int c = 0; c < 3; c++) {
+		for (int i = 0; i < 4; i++) {
+			(*channels[c])[i] =
+				(float)coefficients.at<double>(i, c);
+		}
+	}
+}
+
+void fitEnhanceTransform(const cv::Mat &inputBGRA, const cv::Mat &outputRGB,
+			 EnhanceTransform &transform)
+{
+	const int columns = ENHANCE_GRID_COLUMNS;
+	const int rows = ENHANCE_GRID_ROWS;
+
+	thread_local cv::Mat input;
+	cv::resize(inputBGRA, input, outputRGB.size(), 0, 0, cv::INTER_AREA);
+
+	// Sums of each tile's own pixels
+	thread_local std::vector<TileSums> cells;
+	cells.assign(columns * rows, TileSums());
+	for (int y = 0; y < outputRGB.rows; y++) {
+		const cv::Vec4b *inputRow = input.ptr<cv::Vec4b>(y);
+		const cv::Vec3b *outputRow = outputRGB.ptr<cv::Vec3b>(y);
+		const int row = y * rows / outputRGB.rows;
+		TileSums *cellRow = &cells[row * columns];
+		for (int x = 0; x < outputRGB.cols; x++) {
+			TileSums &cell = cellRow[x * columns / outputRGB.cols];
+			const double in[4] = {inputRow[x][2] / 255.0,
+					      inputRow[x][1] / 255.0,
+					      inputRow[x][0] / 255.0, 1.0};
+			const double out[3] = {outputRow[x][0] / 255.0,
+					       outputRow[x][1] / 255.0,
+					       outputRow[x][2] / 255.0};
+			for (int i = 0; i < 4; i++) {
+				for (int j = 0; j < 4; j++) {
+					cell.xx[i * 4 + j] += in[i] * in[j];
+				}
+				for (int j = 0; j < 3; j++) {
+					cell.xy[i * 3 + j] += in[i] * out[j];
+				}
+			}
+		}
+	}
+
+	transform.red.create(rows, columns, CV_32FC4);
+	transform.green.create(rows, columns, CV_32FC4);
+	transform.blue.create(rows, columns, CV_32FC4);
+	for (int row = 0; row < rows; row++) {
+		for (int column = 0; column < columns; column++) {
+			// Fit over the tile and half of its neighbors, so the
+			// transforms of neighboring tiles agree
+			TileSums sums;
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					const int y = row + dy;
+					const int x = column + dx;
+					if (y < 0 || y >= rows || x < 0 ||
+					    x >= columns) {
+						continue;
+					}
+					sums.add(cells[y * columns + x],
+						 (dx == 0 ? 1.0 : 0.5) *
+							 (dy == 0 ? 1.0 : 0.5));
+				}
+			}
+			solveTile(sums,
+				  transform.red.at<cv::Vec4f>(row, column),
+				  transform.green.at<cv::Vec4f>(row, column),
+				  transform.blue.at<cv::Vec4f>(row, column));
+		}
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef ENHANCE_TRANSFORM_H
+#define ENHANCE_TRANSFORM_H
+
+#include <opencv2/core.hpp>
+
+// Tiles of the transform grid, over the whole frame
+#define ENHANCE_GRID_COLUMNS 16
+#define ENHANCE_GRID_ROWS 9
+
+/**
+  * @brief A per-tile affine color transform, applied to the full-resolution
+  * frame on the GPU
+  *
+  * Each grid holds one CV_32FC4 pixel per tile, the coefficients of one output
+  * channel: out = dot(coefficients, (r, g, b, 1)), in [0, 1]. The grid pixels
+  * sit at the tile centers and are interpolated in between.
+*/
+struct EnhanceTransform {
+	cv::Mat red;
+	cv::Mat green;
+	cv::Mat blue;
+};
+
+/**
+  * @brief Fit the transform that maps a frame to its enhanced version, tile by
+  * tile
+  *
+  * Every tile gets the least squares affine color map of the pixels in and
+  * around it, pulled toward the identity in flat tiles where the colors alone
+  * do not determine it. The enhancement models change brightness and color
+  * smoothly, so the small transform carries their output to any resolution.
+  *
+  * @param inputBGRA  The frame the model ran on, CV_8UC4 BGRA
+  * @param outputRGB  The model output for it, CV_8UC3 RGB, any size
+  * @param transform  (output) The fitted transform
+*/
+void fitEnhanceTransform(const cv::Mat &inputBGRA, const cv::Mat &outputRGB,
+			 EnhanceTransform &transform);
+
+#endif /* ENHANCE_TRANSFORM_H */
@@ -0,0 +1,82 @@
+#include "frame-ring.h"
+
+FrameRing::FrameRing(size_t capacity)
+{
+	for (size_t i = 0; i < capacity; i++) {
+		slots.push_back(std::make_unique<Slot>());
+	}
+}
+
+Frame *FrameRing::beginWrite()
+{
+	for (size_t i = 0; i < slots.size(); i++) {
+		int expected = SLOT_FREE;
+		if (slots[i]->state.compare_exchange_strong(expected,
+							    SLOT_WRITING)) {
+			writing = (int)i;
+			return &slots[i]->frame;
+		}
+	}
+
+	// All buffers are busy: recycle the published frame nobody picked up
+	const int index = latest.exchange(-1);
+	if (index < 0) {
+		return nullptr;
+	}
+	slots[index]->state = SLOT_WRITING;
+	writing = index;
+	return &slots[index]->frame;
+}
+
+void FrameRing::endWrite()
+{
+	if (writing < 0) {
+		return;
+	}
+	slots[writing]->state = SLOT_READY;
+	const int previous = latest.exchange(writing);
+	if (previous >= 0) {
+		// The previous frame was never taken, its buffer is free again
+		slots[previous]->state = SLOT_FREE;
+	}
+	writing = -1;
+}
+
+void FrameRing::cancelWrite()
+{
+	if (writing < 0) {
+		return;
+	}
+	slots[writing]->state = SLOT_FREE;
+	writing = -1;
+}
+
+FramePtr FrameRing::takeLatest()
+{
+	const int index = latest.exchange(-1);
+	if (index < 0) {
+		return nullptr;
+	}
+
+	Slot *slot = slots[index].get();
+	slot->state = SLOT_READING;
+	return FramePtr(&slot->frame,
+			[slot](const Frame *) { slot->state = SLOT_FREE; });
+}
+
+void FrameRing::releaseBuffers()
+{
+	const int index = latest.exchange(-1);
+	if (index >= 0) {
+		slots[index]->state = SLOT_FREE;
+	}
+
+	for (const std::unique_ptr<Slot> &slot : slots) {
+		int expected = SLOT_FREE;
+		if (slot->state.compare_exchange_strong(expected,
+							 SLOT_WRITING)) {
+			slot->frame = Frame();
+			slot->state = SLOT_FREE;
+		}
+	}
+}
@@ -0,0 +1,93 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+  * @brief A frame read back from the GPU
+  *
+  * The pixels may have been downscaled during readback, so the size of the source
+  * is kept alongside them.
+*/
+struct Frame {
+	cv::Mat imageBGRA;
+	// Grayscale thumbnail for change detection, empty unless requested with
+	// filter_data::readbackThumbnail
+	cv::Mat thumbnail;
+	uint32_t sourceWidth = 0;
+	uint32_t sourceHeight = 0;
+	// The region of the source the pixels cover, see roi-tracker.h
+	cv::Rect sourceRoi;
+};
+
+/**
+  * @brief A frame owned by a consumer. The ring buffer is recycled once the last
+  * reference goes away.
+*/
+typedef std::shared_ptr<const Frame> FramePtr;
+
+/**
+  * @brief A ring of preallocated frame buffers with a lock-free "latest frame" slot
+  *
+  * One producer (the render thread) writes into a free buffer and publishes it. A
+  * consumer takes the latest published frame and owns it until it drops the FramePtr,
+  * so frames are handed over without copying. A published frame that nobody took is
+  * recycled by the producer.
+*/
+class FrameRing {
+public:
+	explicit FrameRing(size_t capacity = 3);
+
+	/**
+	  * @brief Get a buffer to write the next frame into
+	  *
+	  * @return The buffer, or nullptr if every buffer is held by consumers
+	*/
+	Frame *beginWrite();
+
+	/**
+	  * @brief Publish the frame written since beginWrite as the latest frame
+	*/
+	void endWrite();
+
+	/**
+	  * @brief Give back the buffer acquired with beginWrite without publishing it
+	*/
+	void cancelWrite();
+
+	/**
+	  * @brief Take ownership of the latest published frame
+	  *
+	  * @return The frame, or nullptr if nothing was published since the last call
+	*/
+	FramePtr takeLatest();
+
+	/**
+	  * @brief Free the pixels of the buffers no consumer holds, dropping
+	  * the published frame. Call from the producer thread.
+	*/
+	void releaseBuffers();
+
+private:
+	enum SlotState {
+		SLOT_FREE,
+		SLOT_WRITING,
+		SLOT_READY,
+		SLOT_READING,
+	};
+
+	struct Slot {
+		Frame frame;
+		std::atomic<int> state{SLOT_FREE};
+	};
+
+	std::vector<std::unique_ptr<Slot>> slots;
+	std::atomic<int> latest{-1};
+	int writing = -1;
+};
+
+#endif /* FRAME_RING_H */
@@ -0,0 +1,42 @@
+#include "mask-cascade.h"
+
+#include <opencv2/imgproc.hpp>
+
+void fuseCascadeMasks(const cv::Mat &fastMask, const cv::Mat &refineMask,
+		      cv::Mat &fused, MaskCascadeScratch &scratch)
+{
+	// The uncertain band of the fast mask, grown to cover its edge error
+	scratch.band.create(fastMask.size(), CV_8UC1);
+	for (int y = 0; y < fastMask.rows; y++) {
+		const uint8_t *fastRow = fastMask.ptr<uint8_t>(y);
+		uint8_t *bandRow = scratch.band.ptr<uint8_t>(y);
+		for (int x = 0; x < fastMask.cols; x++) {
+			const uint8_t value = fastRow[x];
+			bandRow[x] = value > CASCADE_BAND_LOW &&
+					     value < CASCADE_BAND_HIGH
+				     ? 255
+				     : 0;
+		}
+	}
+	cv::dilate(scratch.band, scratch.band, cv::Mat());
+
+	// Upsampling the band softens its border
+	cv::resize(scratch.band, scratch.weight, refineMask.size(), 0, 0,
+		   cv::INTER_LINEAR);
+	cv::resize(fastMask, scratch.fastResized, refineMask.size(), 0, 0,
+		   cv::INTER_LINEAR);
+
+	fused.create(refineMask.size(), CV_8UC1);
+	for (int y = 0; y < fused.rows; y++) {
+		const uint8_t *fastRow = scratch.fastResized.ptr<uint8_t>(y);
+		const uint8_t *refineRow = refineMask.ptr<uint8_t>(y);
+		const uint8_t *weightRow = scratch.weight.ptr<uint8_t>(y);
+		uint8_t *fusedRow = fused.ptr<uint8_t>(y);
+		for (int x = 0; x < fused.cols; x++) {
+			const int w = weightRow[x];
+			fusedRow[x] = (uint8_t)((fastRow[x] * (255 - w) +
+						 refineRow[x] * w + 127) /
+						255);
+		}
+	}
+}
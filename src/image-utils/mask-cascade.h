@@ -0,0 +1,37 @@
+#ifndef MASK_CASCADE_H
+#define MASK_CASCADE_H
+
+#include <opencv2/core.hpp>
+
+// Fast mask values strictly between these are uncertain, in [0, 255]
+#define CASCADE_BAND_LOW 32
+#define CASCADE_BAND_HIGH 224
+
+/**
+  * @brief Buffers reused by fuseCascadeMasks across masks
+*/
+struct MaskCascadeScratch {
+	cv::Mat band;
+	cv::Mat weight;
+	cv::Mat fastResized;
+};
+
+/**
+  * @brief Refine the edges of a fast mask with the mask of a heavier model
+  *
+  * The heavy mask replaces the fast one in the band where the fast mask is
+  * uncertain, grown by a pixel and softened so there is no seam. Elsewhere the
+  * fast mask, which is newer, is kept. Both masks must cover the same region
+  * of the source and use the same convention.
+  *
+  * @param fastMask  The soft mask of the fast model, CV_8UC1
+  * @param refineMask  The soft mask of the heavy model, CV_8UC1, moved to the
+  * fast mask's frame
+  * @param fused  (output) The refined mask, the size of refineMask. Must not
+  * be one of the inputs.
+  * @param scratch  Buffers kept between calls
+*/
+void fuseCascadeMasks(const cv::Mat &fastMask, const cv::Mat &refineMask,
+		      cv::Mat &fused, MaskCascadeScratch &scratch);
+
+#endif /* MASK_CASCADE_H */
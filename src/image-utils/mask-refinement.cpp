@@ -0,0 +1,291 @@
+#include "mask-refinement.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// Box sums are kept in 16 bits: 255 x (2 x radius + 1) plus rounding
+static const int MAX_BOX_RADIUS = 127;
+
+/**
+  * @brief Replace each label of a component by its value in keep
+*/
+static void applyLabels(const cv::Mat &labels,
+			const std::vector<uint8_t> &keep, cv::Mat &mask)
+{
+	for (int y = 0; y < mask.rows; y++) {
+		const int *label = labels.ptr<int>(y);
+		uint8_t *m = mask.ptr<uint8_t>(y);
+		for (int x = 0; x < mask.cols; x++) {
+			m[x] = keep[label[x]];
+		}
+	}
+}
+
+/**
+  * @brief Drop the background components below the area threshold and fill the
+  * foreground holes of the ones kept
+  *
+  * Same result as filling the external contours larger than the threshold, in
+  * two labeling passes instead of per-contour area and drawing.
+*/
+static void filterComponents(cv::Mat &backgroundMask, double areaFraction,
+			     MaskRefinementScratch &scratch)
+{
+	const int minArea =
+		(int)((double)backgroundMask.total() * areaFraction);
+
+	// Keep the large background components
+	const int backgroundCount = cv::connectedComponentsWithStats(
+		backgroundMask, scratch.labels, scratch.stats,
+		scratch.centroids, 8, CV_32S);
+	scratch.keep.assign(backgroundCount, 0);
+	for (int label = 1; label < backgroundCount; label++) {
+		if (scratch.stats.at<int>(label, cv::CC_STAT_AREA) > minArea) {
+			scratch.keep[label] = 255;
+		}
+	}
+	applyLabels(scratch.labels, scratch.keep, backgroundMask);
+
+	// Foreground that doesn't reach the border is enclosed by background
+	cv::bitwise_not(backgroundMask, scratch.foreground);
+	const int foregroundCount = cv::connectedComponentsWithStats(
+		scratch.foreground, scratch.labels, scratch.stats,
+		scratch.centroids, 4, CV_32S);
+	scratch.keep.assign(foregroundCount, 255);
+	for (int label = 1; label < foregroundCount; label++) {
+		const int left = scratch.stats.at<int>(label, cv::CC_STAT_LEFT);
+		const int top = scratch.stats.at<int>(label, cv::CC_STAT_TOP);
+		const int right =
+			left + scratch.stats.at<int>(label, cv::CC_STAT_WIDTH);
+		const int bottom =
+			top + scratch.stats.at<int>(label, cv::CC_STAT_HEIGHT);
+		if (left == 0 || top == 0 || right == backgroundMask.cols ||
+		    bottom == backgroundMask.rows) {
+			scratch.keep[label] = 0;
+		}
+	}
+	applyLabels(scratch.labels, scratch.keep, backgroundMask);
+}
+
+/**
+  * @brief Box average along rows, replicating the border. dst must not be src.
+*/
+static void boxRows(const cv::Mat &src, cv::Mat &dst, int radius)
+{
+	dst.create(src.size(), CV_8UC1);
+	const int width = src.cols;
+	const uint32_t n = 2 * radius + 1;
+	const uint32_t half = n / 2;
+	const uint32_t mul = (65536 + n - 1) / n;
+	for (int y = 0; y < src.rows; y++) {
+		const uint8_t *s = src.ptr<uint8_t>(y);
+		uint8_t *d = dst.ptr<uint8_t>(y);
+		uint32_t sum = s[0] * (uint32_t)(radius + 1);
+		for (int i = 1; i <= radius; i++) {
+			sum += s[std::min(i, width - 1)];
+		}
+		for (int x = 0; x < width; x++) {
+			d[x] = (uint8_t)(((sum + half) * mul) >> 16);
+			sum += s[std::min(x + radius + 1, width - 1)];
+			sum -= s[std::max(x - radius, 0)];
+		}
+	}
+}
+
+/**
+  * @brief Box average along columns, replicating the border, optionally
+  * thresholded at 128. dst must not be src.
+*/
+static void boxColumns(const cv::Mat &src, cv::Mat &dst, int radius,
+		       bool binarize, std::vector<uint16_t> &sums)
+{
+	dst.create(src.size(), CV_8UC1);
+	const int width = src.cols;
+	const int height = src.rows;
+	const uint16_t n = (uint16_t)(2 * radius + 1);
+	const uint16_t half = n / 2;
+	const uint16_t mul = (uint16_t)((65536 + n - 1) / n);
+
+	sums.assign(width, 0);
+	for (int i = -radius; i <= radius; i++) {
+		const uint8_t *s =
+			src.ptr<uint8_t>(std::clamp(i, 0, height - 1));
+		for (int x = 0; x < width; x++) {
+			sums[x] += s[x];
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		const uint8_t *add =
+			src.ptr<uint8_t>(std::min(y + radius + 1, height - 1));
+		const uint8_t *sub = src.ptr<uint8_t>(std::max(y - radius, 0));
+		uint8_t *d = dst.ptr<uint8_t>(y);
+		uint16_t *sum = sums.data();
+
+		int x = 0;
+#if CV_SIMD
+		const int lanes = cv::VTraits<cv::v_uint16>::vlanes();
+		const cv::v_uint16 vhalf = cv::vx_setall_u16(half);
+		const cv::v_uint16 vmul = cv::vx_setall_u16(mul);
+		const cv::v_uint16 v128 = cv::vx_setall_u16(128);
+		for (; x + lanes <= width; x += lanes) {
+			cv::v_uint16 vsum = cv::vx_load(sum + x);
+			cv::v_uint16 average =
+				cv::v_mul_hi(cv::v_add(vsum, vhalf), vmul);
+			if (binarize) {
+				// 0xFFFF saturates to 255
+				average = cv::v_gt(average, v128);
+			}
+			cv::v_pack_store(d + x, average);
+			vsum = cv::v_add(vsum, cv::vx_load_expand(add + x));
+			vsum = cv::v_sub(vsum, cv::vx_load_expand(sub + x));
+			cv::v_store(sum + x, vsum);
+		}
+		cv::vx_cleanup();
+#endif
+		for (; x < width; x++) {
+			const uint32_t rounded = (uint32_t)sum[x] + half;
+			const uint8_t average =
+				(uint8_t)((rounded * mul) >> 16);
+			d[x] = binarize ? (average > 128 ? 255 : 0) : average;
+			sum[x] = (uint16_t)(sum[x] + add[x] - sub[x]);
+		}
+	}
+}
+
+/**
+  * @brief Separable box blur in place, the column pass optionally thresholded
+*/
+static void boxBlur(cv::Mat &mask, int radius, bool binarize,
+		    MaskRefinementScratch &scratch)
+{
+	radius = std::clamp(radius, 0, MAX_BOX_RADIUS);
+	if (radius == 0) {
+		if (binarize) {
+			cv::threshold(mask, mask, 128, 255, cv::THRESH_BINARY);
+		}
+		return;
+	}
+	boxRows(mask, scratch.rows, radius);
+	boxColumns(scratch.rows, mask, radius, binarize, scratch.columnSums);
+}
+
+/**
+  * @brief Separable square dilation in place, the same as radius iterations
+  * of a 3x3 dilation
+*/
+static void dilateSquare(cv::Mat &mask, int radius,
+			 MaskRefinementScratch &scratch)
+{
+	if (radius <= 0) {
+		return;
+	}
+	const int width = mask.cols;
+	const int height = mask.rows;
+
+	scratch.rows.create(mask.size(), CV_8UC1);
+	for (int y = 0; y < height; y++) {
+		const uint8_t *s = mask.ptr<uint8_t>(y);
+		uint8_t *d = scratch.rows.ptr<uint8_t>(y);
+		for (int x = 0; x < width; x++) {
+			const int begin = std::max(x - radius, 0);
+			const int end = std::min(x + radius, width - 1);
+			d[x] = *std::max_element(s + begin, s + end + 1);
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		const int begin = std::max(y - radius, 0);
+		const int end = std::min(y + radius, height - 1);
+		uint8_t *d = mask.ptr<uint8_t>(y);
+
+		int x = 0;
+#if CV_SIMD
+		const int lanes = cv::VTraits<cv::v_uint8>::vlanes();
+		for (; x + lanes <= width; x += lanes) {
+			cv::v_uint8 value = cv::vx_load(
+				scratch.rows.ptr<uint8_t>(begin) + x);
+			for (int i = begin + 1; i <= end; i++) {
+				value = cv::v_max(
+					value,
+					cv::vx_load(
+						scratch.rows.ptr<uint8_t>(i) +
+						x));
+			}
+			cv::v_store(d + x, value);
+		}
+		cv::vx_cleanup();
+#endif
+		for (; x < width; x++) {
+			uint8_t value = scratch.rows.ptr<uint8_t>(begin)[x];
+			for (int i = begin + 1; i <= end; i++) {
+				value = std::max(
+					value, scratch.rows.ptr<uint8_t>(i)[x]);
+			}
+			d[x] = value;
+		}
+	}
+}
+
+void refineBackgroundMask(const MaskRefinement &settings, uint32_t sourceWidth,
+			  uint32_t sourceHeight, cv::Mat &backgroundMask,
+			  cv::Mat &lastBackgroundMask,
+			  MaskRefinementScratch &scratch)
+{
+	// Temporal smoothing
+	if (settings.temporalSmoothFactor > 0.0 &&
+	    settings.temporalSmoothFactor < 1.0 &&
+	    !lastBackgroundMask.empty() &&
+	    lastBackgroundMask.size() == backgroundMask.size()) {
+
+		float temporalSmoothFactor = settings.temporalSmoothFactor;
+		if (settings.enableThreshold) {
+			// The temporal smooth factor can't be smaller than the threshold
+			temporalSmoothFactor = std::max(temporalSmoothFactor,
+							settings.threshold);
+		}
+
+		cv::addWeighted(backgroundMask, temporalSmoothFactor,
+				lastBackgroundMask, 1.0 - temporalSmoothFactor,
+				0.0, backgroundMask);
+	}
+
+	backgroundMask.copyTo(lastBackgroundMask);
+
+	// Contour processing
+	// Only applicable if we are thresholding (and get a binary image)
+	if (!settings.enableThreshold) {
+		return;
+	}
+
+	if (settings.contourFilter > 0.0 && settings.contourFilter < 1.0) {
+		filterComponents(backgroundMask, settings.contourFilter,
+				 scratch);
+	}
+
+	const bool feather = settings.feather > 0.0;
+	if (settings.smoothContour > 0.0) {
+		// Two box passes make the tent kernel of a stack blur. Feather
+		// the binary mask, not the smoothed one.
+		int k_size = (int)(3 + 11 * settings.smoothContour);
+		k_size += k_size % 2 == 0 ? 1 : 0;
+		const int radius = (k_size + 1) / 4;
+		boxBlur(backgroundMask, radius, false, scratch);
+		boxBlur(backgroundMask, radius, feather, scratch);
+	}
+
+	if (feather) {
+		// Feather (blur) the mask. The kernel is sized for the source,
+		// so scale it down to the mask.
+		const double scale =
+			std::min((double)backgroundMask.cols / sourceWidth,
+				 (double)backgroundMask.rows / sourceHeight);
+		int k_size = std::max(1, (int)(40 * settings.feather * scale));
+		k_size += k_size % 2 == 0 ? 1 : 0;
+		dilateSquare(backgroundMask, std::max(1, k_size / 3), scratch);
+		boxBlur(backgroundMask, k_size / 2, false, scratch);
+	}
+}
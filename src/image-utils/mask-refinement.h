@@ -0,0 +1,68 @@
+#ifndef MASK_REFINEMENT_H
+#define MASK_REFINEMENT_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <vector>
+
+/**
+  * @brief Settings for cleaning up a raw background mask
+*/
+struct MaskRefinement {
+	bool enableThreshold = true;
+	float threshold = 0.5f;
+	float temporalSmoothFactor = 0.0f;
+	float contourFilter = 0.05f;
+	float smoothContour = 0.5f;
+	float feather = 0.0f;
+};
+
+/**
+  * @brief Buffers reused by refineBackgroundMask across masks
+*/
+struct MaskRefinementScratch {
+	cv::Mat labels;
+	cv::Mat stats;
+	cv::Mat centroids;
+	cv::Mat foreground;
+	std::vector<uint8_t> keep;
+	// Output of the row pass of the separable filters
+	cv::Mat rows;
+	std::vector<uint16_t> columnSums;
+};
+
+/**
+  * @brief Temporally smooth, contour filter and feather a background mask
+  *
+  * Small components are dropped with connected component labeling. Smoothing,
+  * thresholding and feathering run as separable box and max filters.
+  *
+  * The mask stays at model resolution. It is upsampled to the source on the
+  * GPU by the UpsampleMask technique of mask_alpha_filter.effect, which also
+  * binarizes it when maskNeedsBinarize() is true.
+  *
+  * @param settings  The refinement settings
+  * @param sourceWidth  The width of the source the mask covers
+  * @param sourceHeight  The height of the source the mask covers
+  * @param backgroundMask  The model-sized mask, replaced by the refined mask
+  * @param lastBackgroundMask  The previous model-sized mask, for temporal
+  * smoothing. Updated to this frame's mask.
+  * @param scratch  Buffers kept between calls, so refinement doesn't allocate
+*/
+void refineBackgroundMask(const MaskRefinement &settings, uint32_t sourceWidth,
+			  uint32_t sourceHeight, cv::Mat &backgroundMask,
+			  cv::Mat &lastBackgroundMask,
+			  MaskRefinementScratch &scratch);
+
+/**
+  * @brief Whether the refined mask is smoothed and must be thresholded at 0.5
+  * after upsampling to give a binary mask at source resolution
+*/
+inline bool maskNeedsBinarize(const MaskRefinement &settings)
+{
+	return settings.enableThreshold && settings.smoothContour > 0.0 &&
+	       settings.feather <= 0.0;
+}
+
+#endif /* MASK_REFINEMENT_H */
@@ -0,0 +1,149 @@
+#include "mask-warp.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+// A displacement has to lower the mean difference of a block by this much,
+// in [0, 255], to be preferred over no motion
+static const float MOTION_MIN_GAIN = 2.0f;
+
+/**
+  * @brief Mean absolute difference of a window of current and the window
+  * displaced by (dx, dy) in previous, over the part inside both
+*/
+static float windowCost(const cv::Mat &previous, const cv::Mat &current,
+			const cv::Rect &window, int dx, int dy)
+{
+	const cv::Rect shifted =
+		(window + cv::Point(dx, dy)) & cv::Rect(0, 0, previous.cols,
+							previous.rows);
+	if (shifted.area() == 0) {
+		return std::numeric_limits<float>::max();
+	}
+
+	int sum = 0;
+	for (int y = shifted.y; y < shifted.y + shifted.height; y++) {
+		const uint8_t *previousRow = previous.ptr<uint8_t>(y);
+		const uint8_t *currentRow = current.ptr<uint8_t>(y - dy);
+		for (int x = shifted.x; x < shifted.x + shifted.width; x++) {
+			sum += std::abs((int)previousRow[x] -
+					(int)currentRow[x - dx]);
+		}
+	}
+	return (float)sum / (float)shifted.area();
+}
+
+/**
+  * @brief Offset of the minimum of the parabola through three costs, in
+  * [-0.5, 0.5]
+*/
+static float subPixelOffset(float before, float at, float after)
+{
+	const float curvature = before - 2.0f * at + after;
+	if (curvature <= 0.0f) {
+		return 0.0f;
+	}
+	return std::clamp(0.5f * (before - after) / curvature, -0.5f, 0.5f);
+}
+
+void estimateBlockMotion(const cv::Mat &previous, const cv::Mat &current,
+			 cv::Mat &motion)
+{
+	const int blocksX = current.cols / MOTION_BLOCK_SIZE;
+	const int blocksY = current.rows / MOTION_BLOCK_SIZE;
+	motion.create(blocksY, blocksX, CV_32FC2);
+
+	const int side = 2 * MOTION_SEARCH_RADIUS + 1;
+	float costs[side][side];
+	const cv::Rect bounds(0, 0, current.cols, current.rows);
+	for (int by = 0; by < blocksY; by++) {
+		cv::Vec2f *motionRow = motion.ptr<cv::Vec2f>(by);
+		for (int bx = 0; bx < blocksX; bx++) {
+			const cv::Rect window =
+				cv::Rect(bx * MOTION_BLOCK_SIZE -
+						 MOTION_BLOCK_SIZE / 2,
+					 by * MOTION_BLOCK_SIZE -
+						 MOTION_BLOCK_SIZE / 2,
+					 2 * MOTION_BLOCK_SIZE,
+					 2 * MOTION_BLOCK_SIZE) &
+				bounds;
+
+			// Costs of all displacements, no motion in the middle
+			int bestX = MOTION_SEARCH_RADIUS;
+			int bestY = MOTION_SEARCH_RADIUS;
+			float bestCost = std::numeric_limits<float>::max();
+			for (int cy = 0; cy < side; cy++) {
+				for (int cx = 0; cx < side; cx++) {
+					costs[cy][cx] = windowCost(
+						previous, current, window,
+						cx - MOTION_SEARCH_RADIUS,
+						cy - MOTION_SEARCH_RADIUS);
+					if (costs[cy][cx] < bestCost) {
+						bestCost = costs[cy][cx];
+						bestX = cx;
+						bestY = cy;
+					}
+				}
+			}
+
+			const float still = costs[MOTION_SEARCH_RADIUS]
+						 [MOTION_SEARCH_RADIUS];
+			if (bestCost > still - MOTION_MIN_GAIN) {
+				motionRow[bx] = cv::Vec2f(0.0f, 0.0f);
+				continue;
+			}
+
+			const int x = bestX;
+			const int y = bestY;
+			float offsetX = 0.0f;
+			if (x > 0 && x < side - 1) {
+				offsetX = subPixelOffset(costs[y][x - 1],
+							 costs[y][x],
+							 costs[y][x + 1]);
+			}
+			float offsetY = 0.0f;
+			if (y > 0 && y < side - 1) {
+				offsetY = subPixelOffset(costs[y - 1][x],
+							 costs[y][x],
+							 costs[y + 1][x]);
+			}
+			motionRow[bx] = cv::Vec2f(
+				(float)(x - MOTION_SEARCH_RADIUS) + offsetX,
+				(float)(y - MOTION_SEARCH_RADIUS) + offsetY);
+		}
+	}
+}
+
+void warpMaskWithMotion(const cv::Mat &mask, const cv::Mat &previous,
+			const cv::Mat &current, cv::Mat &warped,
+			MaskWarpScratch &scratch)
+{
+	estimateBlockMotion(previous, current, scratch.motion);
+	if (scratch.motion.empty()) {
+		mask.copyTo(warped);
+		return;
+	}
+
+	// Single blocks are noisy, and the mask should bend, not tear
+	cv::blur(scratch.motion, scratch.motion, cv::Size(3, 3),
+		 cv::Point(-1, -1), cv::BORDER_REPLICATE);
+
+	// The block grid covers the thumbnail, which covers the mask
+	const float scaleX = (float)mask.cols / (float)current.cols;
+	const float scaleY = (float)mask.rows / (float)current.rows;
+	cv::resize(scratch.motion, scratch.map, mask.size(), 0, 0,
+		   cv::INTER_LINEAR);
+	for (int y = 0; y < scratch.map.rows; y++) {
+		cv::Vec2f *mapRow = scratch.map.ptr<cv::Vec2f>(y);
+		for (int x = 0; x < scratch.map.cols; x++) {
+			mapRow[x] = cv::Vec2f((float)x + mapRow[x][0] * scaleX,
+					      (float)y + mapRow[x][1] * scaleY);
+		}
+	}
+
+	cv::remap(mask, warped, scratch.map, cv::noArray(), cv::INTER_LINEAR,
+		  cv::BORDER_REPLICATE);
+}
@@ -0,0 +1,56 @@
+#ifndef MASK_WARP_H
+#define MASK_WARP_H
+
+#include <opencv2/core.hpp>
+
+// Thumbnail pixels per motion block side. Blocks are matched with a window
+// twice as large, centered on the block.
+#define MOTION_BLOCK_SIZE 4
+// Largest displacement searched, in thumbnail pixels
+#define MOTION_SEARCH_RADIUS 3
+
+/**
+  * @brief Buffers reused by warpMaskWithMotion across frames
+*/
+struct MaskWarpScratch {
+	// One displacement per block, CV_32FC2
+	cv::Mat motion;
+	// Per mask pixel sampling positions, CV_32FC2
+	cv::Mat map;
+};
+
+/**
+  * @brief Estimate the motion between two thumbnails by block matching
+  *
+  * Displacements have sub-pixel precision from a parabola fit around the best
+  * match. Blocks whose best match is not clearly better than no motion, such
+  * as flat or noisy regions, keep a zero displacement so a still mask does not
+  * jitter.
+  *
+  * @param previous  The thumbnail the motion starts from, CV_8UC1
+  * @param current  The thumbnail the motion ends at, same size as previous
+  * @param motion  (output) CV_32FC2 with one pixel per block: where the block
+  * of current was in previous, relative to it, in thumbnail pixels
+*/
+void estimateBlockMotion(const cv::Mat &previous, const cv::Mat &current,
+			 cv::Mat &motion);
+
+/**
+  * @brief Move the mask of a previous frame along the motion since then
+  *
+  * Used between inferences, so the mask follows a moving subject on every
+  * frame instead of only when a new mask arrives. The mask and the thumbnails
+  * cover the same region of the source.
+  *
+  * @param mask  The mask of the frame previous was made from, CV_8UC1
+  * @param previous  The thumbnail of that frame, CV_8UC1
+  * @param current  The thumbnail of the frame to warp the mask to
+  * @param warped  (output) The mask moved onto current, same size as mask.
+  * Must not be mask.
+  * @param scratch  Buffers kept between calls
+*/
+void warpMaskWithMotion(const cv::Mat &mask, const cv::Mat &previous,
+			const cv::Mat &current, cv::Mat &warped,
+			MaskWarpScratch &scratch);
+
+#endif /* MASK_WARP_H */
@@ -0,0 +1,102 @@
+#include "postprocess.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+
+void postprocessTensorToMask(const float *tensor,
+			     const OutputPostprocessing &post,
+			     bool enableThreshold, uint8_t threshold,
+			     cv::Mat &mask)
+{
+	if (tensor == nullptr || post.width == 0 || post.height == 0 ||
+	    post.channel >= post.channels) {
+		mask.release();
+		return;
+	}
+
+	const size_t count = (size_t)post.width * post.height;
+	// The selected channel is at src[i * stride]
+	const float *base = tensor;
+	size_t stride = post.channels;
+	if (post.layout == OutputPostprocessing::LAYOUT_CHW) {
+		base = tensor + post.channel * count;
+		stride = 1;
+	}
+	const float *src = (stride == 1) ? base : base + post.channel;
+
+	// Map the channel to [0, 255]
+	float scale = 255.0f;
+	float offset = 0.0f;
+	if (post.normalize) {
+		float minValue = src[0];
+		float maxValue = src[0];
+		for (size_t i = 1; i < count; i++) {
+			minValue = std::min(minValue, src[i * stride]);
+			maxValue = std::max(maxValue, src[i * stride]);
+		}
+		// Same as cv::normalize with NORM_MINMAX: a flat channel maps to 0
+		scale = (maxValue > minValue) ? 255.0f / (maxValue - minValue)
+					      : 0.0f;
+		offset = -minValue * scale;
+	}
+
+	mask.create((int)post.height, (int)post.width, CV_8UC1);
+	uint8_t *dst = mask.ptr<uint8_t>();
+
+	size_t i = 0;
+#if CV_SIMD
+	if (stride <= 2) {
+		const size_t lanes = cv::VTraits<cv::v_uint8>::vlanes();
+		const size_t floatLanes = cv::VTraits<cv::v_float32>::vlanes();
+		const cv::v_float32 vscale = cv::vx_setall_f32(scale);
+		const cv::v_float32 voffset = cv::vx_setall_f32(offset);
+		const cv::v_float32 vzero = cv::vx_setall_f32(0.0f);
+		const cv::v_float32 vmax = cv::vx_setall_f32(255.0f);
+		const cv::v_uint8 vthreshold = cv::vx_setall_u8(threshold);
+		const cv::v_uint8 v255 = cv::vx_setall_u8(255);
+		for (; i + lanes <= count; i += lanes) {
+			cv::v_int32 rounded[4];
+			for (size_t k = 0; k < 4; k++) {
+				const size_t px = i + k * floatLanes;
+				cv::v_float32 value;
+				if (stride == 1) {
+					value = cv::vx_load(src + px);
+				} else {
+					// Two interleaved channels, pick one
+					cv::v_float32 c0, c1;
+					cv::v_load_deinterleave(base + px * 2,
+								c0, c1);
+					value = (post.channel == 0) ? c0 : c1;
+				}
+				value = cv::v_fma(value, vscale, voffset);
+				value = cv::v_min(cv::v_max(value, vzero),
+						  vmax);
+				rounded[k] = cv::v_round(value);
+			}
+			cv::v_uint8 packed = cv::v_pack(
+				cv::v_pack(cv::v_reinterpret_as_u32(rounded[0]),
+					   cv::v_reinterpret_as_u32(rounded[1])),
+				cv::v_pack(cv::v_reinterpret_as_u32(rounded[2]),
+					   cv::v_reinterpret_as_u32(rounded[3])));
+			if (enableThreshold) {
+				packed = cv::v_lt(packed, vthreshold);
+			} else {
+				packed = cv::v_sub(v255, packed);
+			}
+			cv::v_store(dst + i, packed);
+		}
+		cv::vx_cleanup();
+	}
+#endif
+	for (; i < count; i++) {
+		const uint8_t value =
+			cv::saturate_cast<uint8_t>(src[i * stride] * scale +
+						   offset);
+		if (enableThreshold) {
+			dst[i] = (value < threshold) ? 255 : 0;
+		} else {
+			dst[i] = 255 - value;
+		}
+	}
+}
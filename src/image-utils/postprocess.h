@@ -0,0 +1,44 @@
+#ifndef POSTPROCESS_H
+#define POSTPROCESS_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+
+/**
+  * @brief Where a model's mask lives in its output tensor
+  *
+  * The mask is channel `channel` of a `channels`-channel tensor of
+  * width x height values, expected in [0, 1] unless normalize is set.
+*/
+struct OutputPostprocessing {
+	enum Layout { LAYOUT_HWC, LAYOUT_CHW };
+
+	Layout layout = LAYOUT_HWC;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t channels = 1;
+	uint32_t channel = 0;
+	// Stretch the channel to [0, 1] by its min and max first
+	bool normalize = false;
+};
+
+/**
+  * @brief Convert a model output tensor into an 8-bit background mask
+  *
+  * Reads the selected channel, optionally normalizes it, scales to [0, 255] and
+  * applies the threshold or inversion in a single pass.
+  *
+  * @param tensor  The output tensor data
+  * @param post  The mask location in the tensor
+  * @param enableThreshold  Output 255 where the value is below threshold and 0
+  * elsewhere, instead of 255 - value
+  * @param threshold  The threshold in [0, 255]
+  * @param mask  The background mask (output), CV_8UC1 of post.height x post.width
+*/
+void postprocessTensorToMask(const float *tensor,
+			     const OutputPostprocessing &post,
+			     bool enableThreshold, uint8_t threshold,
+			     cv::Mat &mask);
+
+#endif /* POSTPROCESS_H */
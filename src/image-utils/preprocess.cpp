@@ -0,0 +1,197 @@
+#include "preprocess.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Fixed point precision of the bilinear weights
+const int INTERP_BITS = 11;
+const int INTERP_ONE = 1 << INTERP_BITS;
+
+/**
+  * @brief Source coordinates and weight of a bilinear sample, using the same
+  * pixel center convention as cv::resize
+*/
+void linearCoordinate(uint32_t dst, float ratio, int srcSize, int &i0, int &i1,
+		      int &weight)
+{
+	float s = ((float)dst + 0.5f) * ratio - 0.5f;
+	s = std::min(std::max(s, 0.0f), (float)(srcSize - 1));
+	i0 = (int)s;
+	i1 = std::min(i0 + 1, srcSize - 1);
+	weight = (int)std::lround((s - (float)i0) * INTERP_ONE);
+}
+
+/**
+  * @brief Bilinearly sample one output row of BGRA pixels from two source rows
+*/
+void resampleRow(const uint8_t *row0, const uint8_t *row1, int wy,
+		 const std::vector<int> &x0, const std::vector<int> &x1,
+		 const std::vector<int> &wx, uint8_t *dst)
+{
+	const uint32_t wy1 = (uint32_t)wy;
+	const uint32_t wy0 = (uint32_t)(INTERP_ONE - wy);
+	const uint32_t round = 1u << (2 * INTERP_BITS - 1);
+	for (size_t x = 0; x < x0.size(); x++) {
+		const uint8_t *a0 = row0 + x0[x] * 4;
+		const uint8_t *b0 = row0 + x1[x] * 4;
+		const uint8_t *a1 = row1 + x0[x] * 4;
+		const uint8_t *b1 = row1 + x1[x] * 4;
+		const uint32_t wx1 = (uint32_t)wx[x];
+		const uint32_t wx0 = (uint32_t)(INTERP_ONE - wx[x]);
+		for (int c = 0; c < 4; c++) {
+			const uint32_t top = a0[c] * wx0 + b0[c] * wx1;
+			const uint32_t bottom = a1[c] * wx0 + b1[c] * wx1;
+			dst[x * 4 + c] = (uint8_t)((top * wy0 + bottom * wy1 +
+						    round) >>
+						   (2 * INTERP_BITS));
+		}
+	}
+}
+
+#if CV_SIMD
+/**
+  * @brief Widen 8-bit lanes to four float vectors
+*/
+inline void expandToFloat(const cv::v_uint8 &src, cv::v_float32 dst[4])
+{
+	cv::v_uint16 lo, hi;
+	cv::v_expand(src, lo, hi);
+	cv::v_uint32 q0, q1, q2, q3;
+	cv::v_expand(lo, q0, q1);
+	cv::v_expand(hi, q2, q3);
+	dst[0] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q0));
+	dst[1] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q1));
+	dst[2] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q2));
+	dst[3] = cv::v_cvt_f32(cv::v_reinterpret_as_s32(q3));
+}
+#endif
+
+/**
+  * @brief Normalize one row of BGRA pixels into the tensor
+  *
+  * @param planes  For LAYOUT_CHW the row start in each of the three planes, for
+  * LAYOUT_HWC only planes[0] is used and receives interleaved pixels
+*/
+void convertRow(const uint8_t *row, int width, const int srcChannel[3],
+		const InputPreprocessing &pre, float *planes[3])
+{
+	int x = 0;
+#if CV_SIMD
+	const int lanes = cv::VTraits<cv::v_uint8>::vlanes();
+	const int floatLanes = cv::VTraits<cv::v_float32>::vlanes();
+	cv::v_float32 scale[3], offset[3];
+	for (int c = 0; c < 3; c++) {
+		scale[c] = cv::vx_setall_f32(pre.scale[c]);
+		offset[c] = cv::vx_setall_f32(pre.offset[c]);
+	}
+	for (; x <= width - lanes; x += lanes) {
+		cv::v_uint8 bgra[4];
+		cv::v_load_deinterleave(row + x * 4, bgra[0], bgra[1], bgra[2],
+					bgra[3]);
+		cv::v_float32 values[3][4];
+		for (int c = 0; c < 3; c++) {
+			expandToFloat(bgra[srcChannel[c]], values[c]);
+			for (int k = 0; k < 4; k++) {
+				values[c][k] = cv::v_fma(values[c][k], scale[c],
+							 offset[c]);
+			}
+		}
+		for (int k = 0; k < 4; k++) {
+			const int px = x + k * floatLanes;
+			if (pre.layout == InputPreprocessing::LAYOUT_CHW) {
+				for (int c = 0; c < 3; c++) {
+					cv::v_store(planes[c] + px,
+						    values[c][k]);
+				}
+			} else {
+				cv::v_store_interleave(planes[0] + px * 3,
+						       values[0][k],
+						       values[1][k],
+						       values[2][k]);
+			}
+		}
+	}
+#endif
+	for (; x < width; x++) {
+		const uint8_t *pixel = row + x * 4;
+		for (int c = 0; c < 3; c++) {
+			const float value = (float)pixel[srcChannel[c]] *
+						    pre.scale[c] +
+					    pre.offset[c];
+			if (pre.layout == InputPreprocessing::LAYOUT_CHW) {
+				planes[c][x] = value;
+			} else {
+				planes[0][x * 3 + c] = value;
+			}
+		}
+	}
+}
+
+} // namespace
+
+void preprocessImageToTensor(const cv::Mat &imageBGRA, uint32_t width,
+			     uint32_t height, const InputPreprocessing &pre,
+			     float *tensor)
+{
+	if (imageBGRA.empty() || imageBGRA.type() != CV_8UC4 || width == 0 ||
+	    height == 0) {
+		return;
+	}
+
+	const int srcWidth = imageBGRA.cols;
+	const int srcHeight = imageBGRA.rows;
+	const bool resize = (uint32_t)srcWidth != width ||
+			    (uint32_t)srcHeight != height;
+	const int srcChannel[3] = {pre.swapRB ? 2 : 0, 1, pre.swapRB ? 0 : 2};
+	const size_t planeSize = (size_t)width * height;
+
+	// Kept per thread so steady-state frames do not allocate
+	thread_local std::vector<int> x0, x1, wx;
+	thread_local std::vector<uint8_t> rowBuffer;
+	const float xRatio = (float)srcWidth / (float)width;
+	const float yRatio = (float)srcHeight / (float)height;
+	if (resize) {
+		x0.resize(width);
+		x1.resize(width);
+		wx.resize(width);
+		for (uint32_t x = 0; x < width; x++) {
+			linearCoordinate(x, xRatio, srcWidth, x0[x], x1[x],
+					 wx[x]);
+		}
+		rowBuffer.resize((size_t)width * 4);
+	}
+
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t *row;
+		if (resize) {
+			int y0, y1, wy;
+			linearCoordinate(y, yRatio, srcHeight, y0, y1, wy);
+			resampleRow(imageBGRA.ptr<uint8_t>(y0),
+				    imageBGRA.ptr<uint8_t>(y1), wy, x0, x1, wx,
+				    rowBuffer.data());
+			row = rowBuffer.data();
+		} else {
+			row = imageBGRA.ptr<uint8_t>(y);
+		}
+
+		float *planes[3];
+		if (pre.layout == InputPreprocessing::LAYOUT_CHW) {
+			for (int c = 0; c < 3; c++) {
+				planes[c] = tensor + c * planeSize +
+					    (size_t)y * width;
+			}
+		} else {
+			planes[0] = tensor + (size_t)y * width * 3;
+			planes[1] = planes[2] = nullptr;
+		}
+		convertRow(row, (int)width, srcChannel, pre, planes);
+	}
+#if CV_SIMD
+	cv::vx_cleanup();
+#endif
+}
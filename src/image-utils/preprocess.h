@@ -0,0 +1,51 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+
+/**
+  * @brief How a model wants its input image laid out in the tensor
+  *
+  * Each tensor channel c is computed as pixel[c] * scale[c] + offset[c], with
+  * channels taken in RGB order (or BGR with swapRB = false).
+*/
+struct InputPreprocessing {
+	enum Layout { LAYOUT_HWC, LAYOUT_CHW };
+
+	Layout layout = LAYOUT_HWC;
+	bool swapRB = true;
+	float scale[3] = {1.0f / 255.0f, 1.0f / 255.0f, 1.0f / 255.0f};
+	float offset[3] = {0.0f, 0.0f, 0.0f};
+
+	/**
+	  * @brief Normalize as (pixel - mean) / std, per channel
+	*/
+	void setMeanStd(const float mean[3], const float std[3])
+	{
+		for (int c = 0; c < 3; c++) {
+			scale[c] = 1.0f / std[c];
+			offset[c] = -mean[c] / std[c];
+		}
+	}
+};
+
+/**
+  * @brief Resize, reorder, normalize and lay out a BGRA image into a float tensor
+  *
+  * Runs as a single pass over the output: each row is bilinearly sampled (if the
+  * sizes differ) and converted straight into the tensor, without intermediate
+  * images.
+  *
+  * @param imageBGRA  The input image, CV_8UC4
+  * @param width  The tensor width
+  * @param height  The tensor height
+  * @param pre  The channel order, normalization and layout
+  * @param tensor  The tensor data, at least width * height * 3 floats
+*/
+void preprocessImageToTensor(const cv::Mat &imageBGRA, uint32_t width,
+			     uint32_t height, const InputPreprocessing &pre,
+			     float *tensor);
+
+#endif /* PREPROCESS_H */
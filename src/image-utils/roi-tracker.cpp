@@ -0,0 +1,131 @@
+#include "roi-tracker.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+
+void RoiTracker::setEnabled(bool enable)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (enable != enabled) {
+		enabled = enable;
+		roi = cv::Rect();
+		fullFramePending = true;
+	}
+}
+
+bool RoiTracker::isEnabled() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return enabled;
+}
+
+void RoiTracker::setFullFrameInterval(int frames)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	fullFrameInterval = std::max(frames, 1);
+}
+
+cv::Rect RoiTracker::nextReadbackRoi(uint32_t sourceWidth,
+				     uint32_t sourceHeight)
+{
+	const cv::Rect fullFrame(0, 0, (int)sourceWidth, (int)sourceHeight);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!enabled) {
+		return fullFrame;
+	}
+	if (fullFramePending || roi.empty() || (roi & fullFrame) != roi ||
+	    ++framesSinceFullFrame >= fullFrameInterval) {
+		fullFramePending = false;
+		framesSinceFullFrame = 0;
+		return fullFrame;
+	}
+	return roi;
+}
+
+void RoiTracker::update(const cv::Mat &backgroundMask, const cv::Rect &frameRoi,
+			uint32_t sourceWidth, uint32_t sourceHeight)
+{
+	if (backgroundMask.empty() || frameRoi.empty()) {
+		return;
+	}
+	const cv::Rect fullFrame(0, 0, (int)sourceWidth, (int)sourceHeight);
+
+	// Bounding box of the foreground, in mask pixels
+	cv::threshold(backgroundMask, foreground, 127, 255,
+		      cv::THRESH_BINARY_INV);
+	const cv::Rect box = cv::boundingRect(foreground);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!enabled) {
+		return;
+	}
+	if (box.empty()) {
+		// Lost the subject
+		roi = cv::Rect();
+		return;
+	}
+
+	// The subject may continue outside a cropped frame. Look at all of it.
+	const bool touchesCrop =
+		(box.x == 0 && frameRoi.x > 0) ||
+		(box.y == 0 && frameRoi.y > 0) ||
+		(box.br().x == backgroundMask.cols &&
+		 frameRoi.br().x < fullFrame.br().x) ||
+		(box.br().y == backgroundMask.rows &&
+		 frameRoi.br().y < fullFrame.br().y);
+	if (touchesCrop) {
+		fullFramePending = true;
+		return;
+	}
+
+	// Map to source pixels and pad
+	const float scaleX = (float)frameRoi.width / (float)backgroundMask.cols;
+	const float scaleY = (float)frameRoi.height / (float)backgroundMask.rows;
+	float width = (float)box.width * scaleX * (1.0f + 2.0f * PADDING);
+	float height = (float)box.height * scaleY * (1.0f + 2.0f * PADDING);
+	const float centerX =
+		(float)frameRoi.x + ((float)box.x + box.width * 0.5f) * scaleX;
+	const float centerY =
+		(float)frameRoi.y + ((float)box.y + box.height * 0.5f) * scaleY;
+
+	// Keep the aspect ratio of the source, so the model sees the same
+	// proportions as on a full frame
+	const float aspect = (float)sourceWidth / (float)sourceHeight;
+	width = std::max({width, height * aspect,
+			  (float)sourceWidth * MIN_SIZE});
+	height = width / aspect;
+	if (width * height > MAX_AREA * (float)fullFrame.area()) {
+		roi = cv::Rect();
+		return;
+	}
+
+	// Shift the region back inside the source rather than clipping it
+	const int w = (int)width;
+	const int h = (int)height;
+	const int x = std::clamp((int)(centerX - width * 0.5f), 0,
+				 (int)sourceWidth - w);
+	const int y = std::clamp((int)(centerY - height * 0.5f), 0,
+				 (int)sourceHeight - h);
+	const cv::Rect next(x, y, w, h);
+
+	// Hold the region while the subject stays well inside it, so consecutive
+	// masks line up for temporal smoothing
+	const cv::Rect subject((int)(centerX - box.width * scaleX * 0.5f),
+			       (int)(centerY - box.height * scaleY * 0.5f),
+			       (int)(box.width * scaleX),
+			       (int)(box.height * scaleY));
+	if (!roi.empty() && (roi & subject) == subject &&
+	    roi.area() < next.area() * 3 / 2) {
+		return;
+	}
+	roi = next;
+}
+
+void RoiTracker::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	roi = cv::Rect();
+	fullFramePending = true;
+}
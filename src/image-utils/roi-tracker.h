@@ -0,0 +1,68 @@
+#ifndef ROI_TRACKER_H
+#define ROI_TRACKER_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <mutex>
+
+/**
+  * @brief Tracks the subject's region of interest so only that part of the
+  * source is read back and segmented
+  *
+  * The region is the padded bounding box of the foreground in the last mask,
+  * expanded to the source aspect ratio. Every full frame interval readbacks, or
+  * whenever the subject touches the edge of the region or disappears, the next
+  * readback covers the whole source again.
+  *
+  * nextReadbackRoi is called from the render thread, update from the inference
+  * thread.
+*/
+class RoiTracker {
+public:
+	void setEnabled(bool enable);
+	bool isEnabled() const;
+	void setFullFrameInterval(int frames);
+
+	/**
+	  * @brief The region of the source to read back next
+	  *
+	  * @return The region, or the whole source if tracking is off or lost
+	*/
+	cv::Rect nextReadbackRoi(uint32_t sourceWidth, uint32_t sourceHeight);
+
+	/**
+	  * @brief Follow the subject in the raw mask of a frame
+	  *
+	  * @param backgroundMask  The model-sized mask, 0 on the foreground
+	  * @param frameRoi  The region of the source the frame covers
+	  * @param sourceWidth  The width of the source
+	  * @param sourceHeight  The height of the source
+	*/
+	void update(const cv::Mat &backgroundMask, const cv::Rect &frameRoi,
+		    uint32_t sourceWidth, uint32_t sourceHeight);
+
+	/**
+	  * @brief Read back the whole source on the next frame
+	*/
+	void reset();
+
+private:
+	// Padding around the subject, as a fraction of its size on each side
+	static constexpr float PADDING = 0.15f;
+	// Regions larger than this share of the source are not worth cropping
+	static constexpr float MAX_AREA = 0.8f;
+	// Don't zoom in further than this share of the source width and height
+	static constexpr float MIN_SIZE = 0.25f;
+
+	mutable std::mutex mutex;
+	bool enabled = false;
+	int fullFrameInterval = 30;
+	int framesSinceFullFrame = 0;
+	bool fullFramePending = true;
+	cv::Rect roi;
+	// The foreground of the last mask, used by update only
+	cv::Mat foreground;
+};
+
+#endif /* ROI_TRACKER_H */
@@ -0,0 +1,53 @@
+#include "tiled-ops.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include "perf-utils/worker-pool.h"
+
+void tiledCopy(const cv::Mat &src, cv::Mat &dst, uint32_t threads)
+{
+	if (threads <= 1) {
+		src.copyTo(dst);
+		return;
+	}
+	dst.create(src.size(), src.type());
+	parallelForRows(src.rows, threads, [&](int begin, int end) {
+		cv::Mat tile = dst.rowRange(begin, end);
+		src.rowRange(begin, end).copyTo(tile);
+	});
+}
+
+void tiledResize(const cv::Mat &src, cv::Mat &dst, cv::Size size,
+		 uint32_t threads)
+{
+	if (threads <= 1) {
+		cv::resize(src, dst, size);
+		return;
+	}
+	dst.create(size, src.type());
+	const double scaleX = (double)src.cols / size.width;
+	const double scaleY = (double)src.rows / size.height;
+	parallelForRows(size.height, threads, [&](int begin, int end) {
+		// Sample the source where cv::resize would for these rows
+		const cv::Matx23d map(scaleX, 0.0, 0.5 * scaleX - 0.5, 0.0,
+				      scaleY, (begin + 0.5) * scaleY - 0.5);
+		cv::Mat tile = dst.rowRange(begin, end);
+		cv::warpAffine(src, tile, map, tile.size(),
+			       cv::INTER_LINEAR | cv::WARP_INVERSE_MAP,
+			       cv::BORDER_REPLICATE);
+	});
+}
+
+void tiledCvtColor(const cv::Mat &src, cv::Mat &dst, int code,
+		   int dstChannels, uint32_t threads)
+{
+	if (threads <= 1) {
+		cv::cvtColor(src, dst, code);
+		return;
+	}
+	dst.create(src.size(), CV_MAKETYPE(CV_8U, dstChannels));
+	parallelForRows(src.rows, threads, [&](int begin, int end) {
+		cv::Mat tile = dst.rowRange(begin, end);
+		cv::cvtColor(src.rowRange(begin, end), tile, code);
+	});
+}
@@ -0,0 +1,33 @@
+#ifndef TILED_OPS_H
+#define TILED_OPS_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+
+/**
+  * Full-resolution image operations split into row tiles across the worker
+  * pool, see parallelForRows. With threads <= 1 they are the plain OpenCV
+  * calls.
+*/
+
+/**
+  * @brief Copy an image, like src.copyTo(dst)
+*/
+void tiledCopy(const cv::Mat &src, cv::Mat &dst, uint32_t threads);
+
+/**
+  * @brief Resize an image with bilinear interpolation, like cv::resize
+*/
+void tiledResize(const cv::Mat &src, cv::Mat &dst, cv::Size size,
+		 uint32_t threads);
+
+/**
+  * @brief Convert the colors of an 8-bit image, like cv::cvtColor
+  *
+  * @param dstChannels  The number of channels the conversion outputs
+*/
+void tiledCvtColor(const cv::Mat &src, cv::Mat &dst, int code,
+		   int dstChannels, uint32_t threads);
+
+#endif /* TILED_OPS_H */
@@ -3,6 +3,8 @@
 
 #include <onnxruntime_cxx_api.h>
 #include "plugin-support.h"
+#include "image-utils/preprocess.h"
+#include "image-utils/postprocess.h"
 
 #ifdef _WIN32
 #include <wchar.h>
@@ -23,27 +25,14 @@ template<typename T> T vectorProduct(const std::vector<T> &v)
 	return product;
 }
 
-static void hwc_to_chw(cv::InputArray src, cv::OutputArray dst)
-{
-	std::vector<cv::Mat> channels;
-	cv::split(src, channels);
-
-	// Stretch one-channel images to vector
-	for (auto &img : channels) {
-		img = img.reshape(1, 1);
-	}
-
-	// Concatenate three vectors to one
-	cv::hconcat(channels, dst);
-}
-
 /**
 * Convert a CHW Mat to HWC
 * Assume the input Mat is a 3D tensor of shape (C, H, W), but the Mat header has
 * the correct shape (H, W, C). This function will swap the channels to make it
 * (H, W, C) on the data level.
 * @param src Input Mat, assume data is in CHW format, type is float32
-* @param dst Output Mat, data is in HWC format, type is float32
+* @param dst Output Mat, data is in HWC format, type is float32. Reused if it
+* already has the size and type, and must not share data with src
 */
 static void chw_to_hwc_32f(cv::InputArray src, cv::OutputArray dst)
 {
@@ -52,21 +41,22 @@ static void chw_to_hwc_32f(cv::InputArray src, cv::OutputArray dst)
 	const int height = srcMat.rows;
 	const int width = srcMat.cols;
 	const int dtype = srcMat.type();
-	assert(dtype == CV_32F);
+	assert(CV_MAT_DEPTH(dtype) == CV_32F);
 	const int channelStride = height * width;
 
-	// Flatten to a vector of channels
-	cv::Mat flatMat = srcMat.reshape(1, 1);
-
-	std::vector<cv::Mat> channelsVec(channels);
-	// Split the vector into channels
-	for (int i = 0; i < channels; i++) {
-		channelsVec[i] =
-			cv::Mat(height, width, CV_MAKE_TYPE(dtype, 1),
-				flatMat.ptr<float>(0) + i * channelStride);
+	dst.create(height, width, dtype);
+	cv::Mat dstMat = dst.getMat();
+
+	// Interleave the channel planes
+	const float *planes = srcMat.ptr<float>(0);
+	float *pixels = dstMat.ptr<float>(0);
+	for (int c = 0; c < channels; c++) {
+		const float *plane = planes + c * channelStride;
+		float *channel = pixels + c;
+		for (int i = 0; i < channelStride; i++) {
+			channel[i * channels] = plane[i];
+		}
 	}
-
-	cv::merge(channelsVec, dst);
 }
 
 /**
@@ -75,12 +65,14 @@ static void chw_to_hwc_32f(cv::InputArray src, cv::OutputArray dst)
   * Assume that all models have one input and one output.
   * The input is a 4D tensor of shape (1, H, W, C) where H and W are the height and width of
   * the input image.
-  * The range of the input is [0, 255]. The input is in BGR format.
-  * The input is a 32-bit floating point tensor.
-  * This base model will convert the input to [0,1] and then the output to [0,255].
+  * The input is a 32-bit floating point RGB tensor. This base model converts the
+  * [0, 255] BGRA frame to [0, 1] and then the output to [0,255]. FP16 inputs
+  * and outputs are staged through the same float buffers, see
+  * allocateHalfTensorBuffers.
   *
   * Inheriting classes may override the methods for loading the model and running inference
   * with different pre-post processing behavior (like BCHW instead of BHWC or different ranges).
+  * Input normalization and layout are described by getInputPreprocessing.
 */
 class Model {
 private:
@@ -126,7 +118,7 @@ public:
 	}
 
 	virtual void populateInputOutputNames(
-		const std::unique_ptr<Ort::Session> &session,
+		const std::shared_ptr<Ort::Session> &session,
 		std::vector<Ort::AllocatedStringPtr> &inputNames,
 		std::vector<Ort::AllocatedStringPtr> &outputNames)
 	{
@@ -141,7 +133,7 @@ public:
 	}
 
 	virtual bool
-	populateInputOutputShapes(const std::unique_ptr<Ort::Session> &session,
+	populateInputOutputShapes(const std::shared_ptr<Ort::Session> &session,
 				  std::vector<std::vector<int64_t>> &inputDims,
 				  std::vector<std::vector<int64_t>> &outputDims)
 	{
@@ -238,6 +230,132 @@ public:
 		}
 	}
 
+	/**
+    * @brief Back the FP16 inputs and outputs of the session with half buffers
+    *
+    * Call after allocateTensorBuffers. The float buffers stay what the pre- and
+    * postprocessing use: convertInputsToHalf and convertOutputsFromHalf copy
+    * them to and from the half tensors around each run. Recurrent state stays
+    * in half precision.
+  */
+	void allocateHalfTensorBuffers(
+		const std::shared_ptr<Ort::Session> &session,
+		const std::vector<std::vector<int64_t>> &inputDims,
+		const std::vector<std::vector<int64_t>> &outputDims,
+		std::vector<std::vector<Ort::Float16_t>>
+			&outputTensorHalfValues,
+		std::vector<std::vector<Ort::Float16_t>> &inputTensorHalfValues,
+		std::vector<Ort::Value> &inputTensor,
+		std::vector<Ort::Value> &outputTensor)
+	{
+		outputTensorHalfValues.assign(outputDims.size(), {});
+		inputTensorHalfValues.assign(inputDims.size(), {});
+
+		Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(
+			OrtAllocatorType::OrtDeviceAllocator,
+			OrtMemType::OrtMemTypeDefault);
+
+		for (size_t i = 0; i < inputDims.size(); i++) {
+			if (session->GetInputTypeInfo(i)
+				    .GetTensorTypeAndShapeInfo()
+				    .GetElementType() !=
+			    ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16) {
+				continue;
+			}
+			inputTensorHalfValues[i].resize(
+				vectorProduct(inputDims[i]));
+			obs_log(LOG_INFO, "Input %d is half precision", (int)i);
+			inputTensor[i] =
+				Ort::Value::CreateTensor<Ort::Float16_t>(
+					memoryInfo,
+					inputTensorHalfValues[i].data(),
+					inputTensorHalfValues[i].size(),
+					inputDims[i].data(),
+					inputDims[i].size());
+		}
+
+		for (size_t i = 0; i < outputDims.size(); i++) {
+			if (session->GetOutputTypeInfo(i)
+				    .GetTensorTypeAndShapeInfo()
+				    .GetElementType() !=
+			    ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16) {
+				continue;
+			}
+			outputTensorHalfValues[i].resize(
+				vectorProduct(outputDims[i]));
+			obs_log(LOG_INFO, "Output %d is half precision",
+				(int)i);
+			outputTensor[i] =
+				Ort::Value::CreateTensor<Ort::Float16_t>(
+					memoryInfo,
+					outputTensorHalfValues[i].data(),
+					outputTensorHalfValues[i].size(),
+					outputDims[i].data(),
+					outputDims[i].size());
+		}
+	}
+
+	/**
+    * @brief Copy the float inputs into the half tensors, except the recurrent
+    * state, which the last run left in them
+    *
+    * @param outputCount The number of outputs of the model
+  */
+	void convertInputsToHalf(
+		const std::vector<std::vector<float>> &inputTensorValues,
+		size_t outputCount,
+		std::vector<std::vector<Ort::Float16_t>> &inputTensorHalfValues)
+	{
+		for (size_t i = 0; i < inputTensorHalfValues.size(); i++) {
+			std::vector<Ort::Float16_t> &half =
+				inputTensorHalfValues[i];
+			if (half.empty() || isRecurrentInput(i, outputCount)) {
+				continue;
+			}
+			cv::Mat halfMat(1, (int)half.size(), CV_16F,
+					half.data());
+			cv::Mat(1, (int)half.size(), CV_32F,
+				(void *)inputTensorValues[i].data())
+				.convertTo(halfMat, CV_16F);
+		}
+	}
+
+	/**
+    * @brief Copy the half outputs into the float buffers, except the recurrent
+    * state, which is only fed back
+  */
+	void convertOutputsFromHalf(
+		const std::vector<std::vector<Ort::Float16_t>>
+			&outputTensorHalfValues,
+		std::vector<std::vector<float>> &outputTensorValues)
+	{
+		for (size_t i = 0; i < outputTensorHalfValues.size(); i++) {
+			const std::vector<Ort::Float16_t> &half =
+				outputTensorHalfValues[i];
+			if (half.empty() || getRecurrentInputIndex(i) >= 0) {
+				continue;
+			}
+			cv::Mat floatMat(1, (int)half.size(), CV_32F,
+					 outputTensorValues[i].data());
+			cv::Mat(1, (int)half.size(), CV_16F,
+				(void *)half.data())
+				.convertTo(floatMat, CV_32F);
+		}
+	}
+
+	/**
+    * @brief Ask the model to run at another input resolution
+    *
+    * @return true if the model accepts any input size and will use
+    * width x height from the next populateInputOutputShapes call on
+  */
+	virtual bool setInputResolution(uint32_t width, uint32_t height)
+	{
+		UNUSED_PARAMETER(width);
+		UNUSED_PARAMETER(height);
+		return false;
+	}
+
 	virtual void
 	getNetworkInputSize(const std::vector<std::vector<int64_t>> &inputDims,
 			    uint32_t &inputWidth, uint32_t &inputHeight)
@@ -247,31 +365,40 @@ public:
 		inputHeight = (int)inputDims[0][1];
 	}
 
-	virtual void prepareInputToNetwork(cv::Mat &resizedImage,
-					   cv::Mat &preprocessedImage)
+	/**
+    * @brief Describe the channel order, normalization and layout of the input
+  */
+	virtual InputPreprocessing getInputPreprocessing()
 	{
-		preprocessedImage = resizedImage / 255.0;
+		return InputPreprocessing();
 	}
 
 	/**
     * @brief Postprocess the output of the network
     *
-    * @param output The output of the network. This function should ensure the output is with
-    * values in the range 0-1 (float 32), and in the BHWC format
+    * @param networkOutput The output of the network, see getNetworkOutput
+    * @param output The caller's buffer for the postprocessed output, with
+    * values in the range 0-1 (float 32), and in the BHWC format. Reused
+    * across frames; models that don't change the output make it a view of
+    * networkOutput instead.
   */
-	virtual void postprocessOutput(cv::Mat &output)
+	virtual void postprocessOutput(const cv::Mat &networkOutput,
+				       cv::Mat &output)
 	{
-		UNUSED_PARAMETER(output);
+		output = networkOutput;
 	}
 
+	/**
+    * @brief Resize and normalize a BGRA frame straight into the input tensor
+  */
 	virtual void
-	loadInputToTensor(const cv::Mat &preprocessedImage, uint32_t inputWidth,
+	loadInputToTensor(const cv::Mat &imageBGRA, uint32_t inputWidth,
 			  uint32_t inputHeight,
 			  std::vector<std::vector<float>> &inputTensorValues)
 	{
-		preprocessedImage.copyTo(cv::Mat(inputHeight, inputWidth,
-						 CV_32FC3,
-						 &(inputTensorValues[0][0])));
+		preprocessImageToTensor(imageBGRA, inputWidth, inputHeight,
+					getInputPreprocessing(),
+					inputTensorValues[0].data());
 	}
 
 	virtual cv::Mat
@@ -288,17 +415,65 @@ public:
 			       outputTensorValues[0].data());
 	}
 
-	virtual void assignOutputToInput(std::vector<std::vector<float>> &,
-					 std::vector<std::vector<float>> &)
+	/**
+    * @brief Describe where the mask is in the output tensor, for models that produce
+    * a [0, 1] foreground mask
+  */
+	virtual OutputPostprocessing
+	getOutputPostprocessing(const std::vector<std::vector<int64_t>> &outputDims)
 	{
+		// BHWC
+		OutputPostprocessing post;
+		post.width = (uint32_t)outputDims[0].at(2);
+		post.height = (uint32_t)outputDims[0].at(1);
+		post.channels = (outputDims[0].size() > 3)
+					? (uint32_t)outputDims[0].at(3)
+					: 1;
+		return post;
 	}
 
-	virtual void runNetworkInference(
-		const std::unique_ptr<Ort::Session> &session,
-		const std::vector<Ort::AllocatedStringPtr> &inputNames,
-		const std::vector<Ort::AllocatedStringPtr> &outputNames,
-		const std::vector<Ort::Value> &inputTensor,
-		std::vector<Ort::Value> &outputTensor)
+	/**
+    * @brief The input that an output is fed back into on the next frame
+    *
+    * The output and the input must have the same shape, since their buffers are
+    * swapped after every run instead of copied.
+    *
+    * @param outputIndex The index of the output in outputNames
+    * @return The index of the input in inputNames, or -1 if the output is not
+    * recurrent state
+  */
+	virtual int getRecurrentInputIndex(size_t outputIndex)
+	{
+		UNUSED_PARAMETER(outputIndex);
+		return -1;
+	}
+
+	/**
+    * @brief Whether an input is fed by one of the first outputCount outputs
+  */
+	bool isRecurrentInput(size_t inputIndex, size_t outputCount)
+	{
+		for (size_t i = 0; i < outputCount; i++) {
+			if (getRecurrentInputIndex(i) == (int)inputIndex) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+    * @brief Run the session on the tensors
+    *
+    * @param inputNames The input names as Session::Run takes them, built
+    * once per session, see InferenceScratch
+    * @param outputNames The output names, likewise
+  */
+	virtual void
+	runNetworkInference(const std::shared_ptr<Ort::Session> &session,
+			    const std::vector<const char *> &inputNames,
+			    const std::vector<const char *> &outputNames,
+			    const std::vector<Ort::Value> &inputTensor,
+			    std::vector<Ort::Value> &outputTensor)
 	{
 		if (inputNames.size() == 0 || outputNames.size() == 0 ||
 		    inputTensor.size() == 0 || outputTensor.size() == 0) {
@@ -307,19 +482,9 @@ public:
 			return;
 		}
 
-		std::vector<const char *> rawInputNames;
-		for (auto &inputName : inputNames) {
-			rawInputNames.push_back(inputName.get());
-		}
-
-		std::vector<const char *> rawOutputNames;
-		for (auto &outputName : outputNames) {
-			rawOutputNames.push_back(outputName.get());
-		}
-
-		session->Run(Ort::RunOptions{nullptr}, rawInputNames.data(),
+		session->Run(Ort::RunOptions{nullptr}, inputNames.data(),
 			     inputTensor.data(), inputNames.size(),
-			     rawOutputNames.data(), outputTensor.data(),
+			     outputNames.data(), outputTensor.data(),
 			     outputNames.size());
 	}
 };
@@ -329,18 +494,17 @@ public:
 	ModelBCHW(/* args */) {}
 	~ModelBCHW() {}
 
-	virtual void prepareInputToNetwork(cv::Mat &resizedImage,
-					   cv::Mat &preprocessedImage)
+	virtual InputPreprocessing getInputPreprocessing()
 	{
-		resizedImage = resizedImage / 255.0;
-		hwc_to_chw(resizedImage, preprocessedImage);
+		InputPreprocessing pre;
+		pre.layout = InputPreprocessing::LAYOUT_CHW;
+		return pre;
 	}
 
-	virtual void postprocessOutput(cv::Mat &output)
+	virtual void postprocessOutput(const cv::Mat &networkOutput,
+				       cv::Mat &output)
 	{
-		cv::Mat outputTransposed;
-		chw_to_hwc_32f(output, outputTransposed);
-		outputTransposed.copyTo(output);
+		chw_to_hwc_32f(networkOutput, output);
 	}
 
 	virtual void
@@ -366,12 +530,16 @@ public:
 			       outputTensorValues[0].data());
 	}
 
-	virtual void
-	loadInputToTensor(const cv::Mat &preprocessedImage, uint32_t, uint32_t,
-			  std::vector<std::vector<float>> &inputTensorValues)
+	virtual OutputPostprocessing
+	getOutputPostprocessing(const std::vector<std::vector<int64_t>> &outputDims)
 	{
-		inputTensorValues[0].assign(preprocessedImage.begin<float>(),
-					    preprocessedImage.end<float>());
+		// BCHW
+		OutputPostprocessing post;
+		post.layout = OutputPostprocessing::LAYOUT_CHW;
+		post.width = (uint32_t)outputDims[0].at(3);
+		post.height = (uint32_t)outputDims[0].at(2);
+		post.channels = (uint32_t)outputDims[0].at(1);
+		return post;
 	}
 };
 
@@ -8,36 +8,27 @@ public:
 	ModelPPHumanSeg(/* args */) {}
 	~ModelPPHumanSeg() {}
 
-	virtual void prepareInputToNetwork(cv::Mat &resizedImage,
-					   cv::Mat &preprocessedImage)
+	virtual InputPreprocessing getInputPreprocessing()
 	{
-		resizedImage =
-			(resizedImage / 256.0 - cv::Scalar(0.5, 0.5, 0.5)) /
-			cv::Scalar(0.5, 0.5, 0.5);
-
-		hwc_to_chw(resizedImage, preprocessedImage);
-	}
-
-	virtual cv::Mat
-	getNetworkOutput(const std::vector<std::vector<int64_t>> &outputDims,
-			 std::vector<std::vector<float>> &outputTensorValues)
-	{
-		uint32_t outputWidth = (int)outputDims[0].at(2);
-		uint32_t outputHeight = (int)outputDims[0].at(1);
-		int32_t outputChannels = CV_32FC2;
-
-		return cv::Mat(outputHeight, outputWidth, outputChannels,
-			       outputTensorValues[0].data());
+		// (x / 256 - 0.5) / 0.5
+		const float mean[3] = {128.0f, 128.0f, 128.0f};
+		const float std[3] = {128.0f, 128.0f, 128.0f};
+		InputPreprocessing pre = ModelBCHW::getInputPreprocessing();
+		pre.setMeanStd(mean, std);
+		return pre;
 	}
 
-	virtual void postprocessOutput(cv::Mat &outputImage)
+	virtual OutputPostprocessing
+	getOutputPostprocessing(const std::vector<std::vector<int64_t>> &outputDims)
 	{
-		// take 1st channel
-		std::vector<cv::Mat> outputImageSplit;
-		cv::split(outputImage, outputImageSplit);
-
-		cv::normalize(outputImageSplit[1], outputImage, 1.0, 0.0,
-			      cv::NORM_MINMAX);
+		// take 2nd channel of a 2-channel BHWC output
+		OutputPostprocessing post;
+		post.width = (uint32_t)outputDims[0].at(2);
+		post.height = (uint32_t)outputDims[0].at(1);
+		post.channels = 2;
+		post.channel = 1;
+		post.normalize = true;
+		return post;
 	}
 };
 
@@ -9,7 +9,7 @@ public:
 	~ModelRMBG() {}
 
 	bool
-	populateInputOutputShapes(const std::unique_ptr<Ort::Session> &session,
+	populateInputOutputShapes(const std::shared_ptr<Ort::Session> &session,
 				  std::vector<std::vector<int64_t>> &inputDims,
 				  std::vector<std::vector<int64_t>> &outputDims)
 	{
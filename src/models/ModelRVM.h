@@ -5,13 +5,32 @@
 
 class ModelRVM : public ModelBCHW {
 private:
-	/* data */
+	int baseWidth = 320;
+	int baseHeight = 192;
+	// The backbone runs at this fraction of the input size, the refiner
+	// at the full size
+	float downsampleRatio = 1.0f;
+
 public:
 	ModelRVM(/* args */) {}
 	~ModelRVM() {}
 
+	virtual bool setInputResolution(uint32_t width, uint32_t height)
+	{
+		baseWidth = (int)width;
+		baseHeight = (int)height;
+		// Keep the backbone at or below 384 px on the long side, as the
+		// RVM authors recommend, and let the refiner restore the detail
+		downsampleRatio = 1.0f;
+		const float longSide = (float)std::max(baseWidth, baseHeight);
+		while (longSide * downsampleRatio > 384.0f) {
+			downsampleRatio *= 0.5f;
+		}
+		return true;
+	}
+
 	virtual void populateInputOutputNames(
-		const std::unique_ptr<Ort::Session> &session,
+		const std::shared_ptr<Ort::Session> &session,
 		std::vector<Ort::AllocatedStringPtr> &inputNames,
 		std::vector<Ort::AllocatedStringPtr> &outputNames)
 	{
@@ -31,7 +50,7 @@ public:
 	}
 
 	virtual bool
-	populateInputOutputShapes(const std::unique_ptr<Ort::Session> &session,
+	populateInputOutputShapes(const std::shared_ptr<Ort::Session> &session,
 				  std::vector<std::vector<int64_t>> &inputDims,
 				  std::vector<std::vector<int64_t>> &outputDims)
 	{
@@ -58,51 +77,60 @@ public:
 			outputDims.push_back(outputTensorInfo.GetShape());
 		}
 
-		const int base_width = 320;
-		const int base_height = 192;
-
 		inputDims[0][0] = 1;
-		inputDims[0][2] = base_height;
-		inputDims[0][3] = base_width;
+		inputDims[0][2] = baseHeight;
+		inputDims[0][3] = baseWidth;
+
+		// The recurrent states are at 1/2 to 1/16 of the downsampled
+		// size. The strided convolutions round odd sizes up.
+		int64_t stateHeight =
+			(int64_t)((float)baseHeight * downsampleRatio);
+		int64_t stateWidth =
+			(int64_t)((float)baseWidth * downsampleRatio);
 		for (size_t i = 1; i < 5; i++) {
+			stateHeight = (stateHeight + 1) / 2;
+			stateWidth = (stateWidth + 1) / 2;
+
 			inputDims[i][0] = 1;
 			inputDims[i][1] = (i == 1)   ? 16
 					  : (i == 2) ? 20
 					  : (i == 3) ? 40
 						     : 64;
-			inputDims[i][2] = base_height / (2 << (i - 1));
-			inputDims[i][3] = base_width / (2 << (i - 1));
+			inputDims[i][2] = stateHeight;
+			inputDims[i][3] = stateWidth;
+
+			// Same shape as the state input, so the buffers can be swapped
+			outputDims[i] = inputDims[i];
 		}
 
 		outputDims[0][0] = 1;
-		outputDims[0][2] = base_height;
-		outputDims[0][3] = base_width;
-		for (size_t i = 1; i < 5; i++) {
-			outputDims[i][0] = 1;
-			outputDims[i][2] = base_height / (2 << (i - 1));
-			outputDims[i][3] = base_width / (2 << (i - 1));
-		}
+		outputDims[0][2] = baseHeight;
+		outputDims[0][3] = baseWidth;
 		return true;
 	}
 
-	virtual void
-	loadInputToTensor(const cv::Mat &preprocessedImage, uint32_t, uint32_t,
-			  std::vector<std::vector<float>> &inputTensorValues)
+	virtual void allocateTensorBuffers(
+		const std::vector<std::vector<int64_t>> &inputDims,
+		const std::vector<std::vector<int64_t>> &outputDims,
+		std::vector<std::vector<float>> &outputTensorValues,
+		std::vector<std::vector<float>> &inputTensorValues,
+		std::vector<Ort::Value> &inputTensor,
+		std::vector<Ort::Value> &outputTensor)
 	{
-		inputTensorValues[0].assign(preprocessedImage.begin<float>(),
-					    preprocessedImage.end<float>());
-		inputTensorValues[5][0] = 1.0f;
+		ModelBCHW::allocateTensorBuffers(inputDims, outputDims,
+						 outputTensorValues,
+						 inputTensorValues, inputTensor,
+						 outputTensor);
+		// downsample_ratio only changes with the resolution and is not
+		// recurrent state
+		inputTensorValues[5][0] = downsampleRatio;
 	}
 
-	virtual void
-	assignOutputToInput(std::vector<std::vector<float>> &outputTensorValues,
-			    std::vector<std::vector<float>> &inputTensorValues)
+	virtual int getRecurrentInputIndex(size_t outputIndex)
 	{
-		for (size_t i = 1; i < 5; i++) {
-			inputTensorValues[i].assign(
-				outputTensorValues[i].begin(),
-				outputTensorValues[i].end());
-		}
+		// Outputs r1o-r4o feed inputs r1i-r4i
+		return (outputIndex >= 1 && outputIndex < 5) ? (int)outputIndex
+							     : -1;
 	}
 };
 
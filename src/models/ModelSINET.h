@@ -8,33 +8,28 @@ public:
 	ModelSINET(/* args */) {}
 	~ModelSINET() {}
 
-	virtual void prepareInputToNetwork(cv::Mat &resizedImage,
-					   cv::Mat &preprocessedImage)
+	virtual InputPreprocessing getInputPreprocessing()
 	{
-		resizedImage = (resizedImage -
-				cv::Scalar(102.890434, 111.25247, 126.91212)) /
-			       cv::Scalar(62.93292 * 255.0, 62.82138 * 255.0,
-					  66.355705 * 255.0);
-		hwc_to_chw(resizedImage, preprocessedImage);
+		const float mean[3] = {102.890434f, 111.25247f, 126.91212f};
+		const float std[3] = {62.93292f * 255.0f, 62.82138f * 255.0f,
+				      66.355705f * 255.0f};
+		InputPreprocessing pre = ModelBCHW::getInputPreprocessing();
+		pre.setMeanStd(mean, std);
+		return pre;
 	}
 
-	virtual cv::Mat
-	getNetworkOutput(const std::vector<std::vector<int64_t>> &outputDims,
-			 std::vector<std::vector<float>> &outputTensorValues)
+	virtual OutputPostprocessing
+	getOutputPostprocessing(const std::vector<std::vector<int64_t>> &outputDims)
 	{
 		UNUSED_PARAMETER(outputDims);
-		return cv::Mat(320, 320, CV_32FC2,
-			       outputTensorValues[0].data());
-	}
-
-	virtual void postprocessOutput(cv::Mat &outputImage)
-	{
-		cv::Mat outputTransposed;
-		chw_to_hwc_32f(outputImage, outputTransposed);
-		// take 2nd channel
-		std::vector<cv::Mat> outputImageSplit;
-		cv::split(outputTransposed, outputImageSplit);
-		outputImage = outputImageSplit[1];
+		// take 2nd channel of a 2x320x320 output
+		OutputPostprocessing post;
+		post.layout = OutputPostprocessing::LAYOUT_CHW;
+		post.width = 320;
+		post.height = 320;
+		post.channels = 2;
+		post.channel = 1;
+		return post;
 	}
 };
 
@@ -10,10 +10,13 @@ public:
 	ModelSelfie(/* args */) {}
 	~ModelSelfie() {}
 
-	virtual void postprocessOutput(cv::Mat &outputImage)
+	virtual OutputPostprocessing
+	getOutputPostprocessing(const std::vector<std::vector<int64_t>> &outputDims)
 	{
-		cv::normalize(outputImage, outputImage, 1.0, 0.0,
-			      cv::NORM_MINMAX);
+		OutputPostprocessing post =
+			Model::getOutputPostprocessing(outputDims);
+		post.normalize = true;
+		return post;
 	}
 };
 
@@ -5,10 +5,12 @@
 
 class ModelTBEFN : public ModelBCHW {
 public:
-	virtual void postprocessOutput(cv::Mat &output)
+	virtual void postprocessOutput(const cv::Mat &networkOutput,
+				       cv::Mat &output)
 	{
 		// output is already BHWC ...
-		output = output * 255.0; // Convert to 0-255 range
+		// Convert to 0-255 range
+		networkOutput.convertTo(output, CV_32F, 255.0);
 	}
 
 	virtual cv::Mat
@@ -10,18 +10,21 @@ public:
 	ModelTCMonoDepth(/* args */) {}
 	~ModelTCMonoDepth() {}
 
-	virtual void prepareInputToNetwork(cv::Mat &resizedImage,
-					   cv::Mat &preprocessedImage)
+	virtual InputPreprocessing getInputPreprocessing()
 	{
 		// Do not normalize from [0, 255] to [0, 1].
-
-		hwc_to_chw(resizedImage, preprocessedImage);
+		InputPreprocessing pre = ModelBCHW::getInputPreprocessing();
+		pre.scale[0] = pre.scale[1] = pre.scale[2] = 1.0f;
+		return pre;
 	}
 
-	virtual void postprocessOutput(cv::Mat &outputImage)
+	virtual OutputPostprocessing
+	getOutputPostprocessing(const std::vector<std::vector<int64_t>> &outputDims)
 	{
-		cv::normalize(outputImage, outputImage, 1.0, 0.0,
-			      cv::NORM_MINMAX);
+		OutputPostprocessing post =
+			ModelBCHW::getOutputPostprocessing(outputDims);
+		post.normalize = true;
+		return post;
 	}
 };
 
@@ -6,7 +6,7 @@
 class ModelURetinex : public ModelBCHW {
 public:
 	virtual void populateInputOutputNames(
-		const std::unique_ptr<Ort::Session> &session,
+		const std::shared_ptr<Ort::Session> &session,
 		std::vector<Ort::AllocatedStringPtr> &inputNames,
 		std::vector<Ort::AllocatedStringPtr> &outputNames)
 	{
@@ -26,7 +26,7 @@ public:
 	}
 
 	virtual bool
-	populateInputOutputShapes(const std::unique_ptr<Ort::Session> &session,
+	populateInputOutputShapes(const std::shared_ptr<Ort::Session> &session,
 				  std::vector<std::vector<int64_t>> &inputDims,
 				  std::vector<std::vector<int64_t>> &outputDims)
 	{
@@ -57,11 +57,12 @@ public:
 	}
 
 	virtual void
-	loadInputToTensor(const cv::Mat &preprocessedImage, uint32_t, uint32_t,
+	loadInputToTensor(const cv::Mat &imageBGRA, uint32_t inputWidth,
+			  uint32_t inputHeight,
 			  std::vector<std::vector<float>> &inputTensorValues)
 	{
-		inputTensorValues[0].assign(preprocessedImage.begin<float>(),
-					    preprocessedImage.end<float>());
+		ModelBCHW::loadInputToTensor(imageBGRA, inputWidth, inputHeight,
+					     inputTensorValues);
 		inputTensorValues[1][0] = 5.0f;
 	}
 };
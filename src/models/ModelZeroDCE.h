@@ -5,10 +5,11 @@
 
 class ModelZeroDCE : public ModelBCHW {
 public:
-	virtual void postprocessOutput(cv::Mat &output)
+	virtual void postprocessOutput(const cv::Mat &networkOutput,
+				       cv::Mat &output)
 	{
-		UNUSED_PARAMETER(output);
 		// output is already BHWC and 0-255... nothing to do
+		output = networkOutput;
 	}
 
 	virtual cv::Mat
@@ -51,6 +51,23 @@ int getFlagFromConfig(const char *name, bool *returnValue, bool defaultValue)
 	return OBS_BGREMOVAL_CONFIG_SUCCESS;
 }
 
+int getIntFromConfig(const char *name, int *returnValue, int defaultValue)
+{
+	// Get the config file
+	config_t *config;
+	if (getConfig(&config) != OBS_BGREMOVAL_CONFIG_SUCCESS) {
+		*returnValue = defaultValue;
+		return OBS_BGREMOVAL_CONFIG_FAIL;
+	}
+
+	*returnValue = config_has_user_value(config, "config", name)
+			       ? (int)config_get_int(config, "config", name)
+			       : defaultValue;
+	config_close(config);
+
+	return OBS_BGREMOVAL_CONFIG_SUCCESS;
+}
+
 int setFlagInConfig(const char *name, const bool value)
 {
 	// Get the config file
@@ -17,6 +17,18 @@ enum {
  */
 int getFlagFromConfig(const char *name, bool *returnValue, bool defaultValue);
 
+/**
+ * Get an integer from the module configuration file.
+ *
+ * @param name The name of the config item.
+ * @param returnValue The value of the config item, defaultValue if it is not
+ * set.
+ * @param defaultValue The default value of the config item.
+ * @return OBS_BGREMOVAL_CONFIG_SUCCESS if the config file was opened,
+ * OBS_BGREMOVAL_CONFIG_FAIL otherwise.
+ */
+int getIntFromConfig(const char *name, int *returnValue, int defaultValue);
+
 /**
  * Set a boolean flag in the module configuration file.
  *
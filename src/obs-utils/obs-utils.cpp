@@ -2,9 +2,202 @@
 
 #include <obs-module.h>
 
+#include <opencv2/imgproc.hpp>
+
+#include "obs-utils/shared-readback.h"
+#include "image-utils/change-detection.h"
+#include "image-utils/tiled-ops.h"
+#include "perf-utils/worker-pool.h"
+
+#include <algorithm>
+#include <cstring>
+
+/**
+  * @brief Scale a region of a texture into a texrender of the given size
+  *
+  * @param texrender  The texrender to draw into
+  * @param texture  The source texture
+  * @param region  The region of the texture to scale, in texels
+  * @param width  The target width
+  * @param height  The target height
+  * @return true  if successful
+  * @return false if unsuccessful
+*/
+static bool scaleTexture(gs_texrender_t *texrender, gs_texture_t *texture,
+			 const cv::Rect &region, uint32_t width,
+			 uint32_t height)
+{
+	// The low-res bilinear effect averages several taps, which avoids the
+	// aliasing plain bilinear sampling gives at large reduction factors
+	gs_effect_t *effect = obs_get_base_effect(OBS_EFFECT_BILINEAR_LOWRES);
+	gs_eparam_t *image = gs_effect_get_param_by_name(effect, "image");
+	gs_eparam_t *dimension_i =
+		gs_effect_get_param_by_name(effect, "base_dimension_i");
+
+	gs_texrender_reset(texrender);
+	if (!gs_texrender_begin(texrender, width, height)) {
+		return false;
+	}
+	struct vec4 background;
+	vec4_zero(&background);
+	gs_clear(GS_CLEAR_COLOR, &background, 0.0f, 0);
+	// Project only the region onto the target
+	gs_ortho(static_cast<float>(region.x),
+		 static_cast<float>(region.x + region.width),
+		 static_cast<float>(region.y),
+		 static_cast<float>(region.y + region.height), -100.0f, 100.0f);
+	gs_blend_state_push();
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_ZERO);
+
+	gs_effect_set_texture(image, texture);
+	if (dimension_i) {
+		struct vec2 base_dimension_i;
+		vec2_set(&base_dimension_i,
+			 1.0f / (float)gs_texture_get_width(texture),
+			 1.0f / (float)gs_texture_get_height(texture));
+		gs_effect_set_vec2(dimension_i, &base_dimension_i);
+	}
+	while (gs_effect_loop(effect, "Draw")) {
+		gs_draw_sprite(texture, 0, gs_texture_get_width(texture),
+			       gs_texture_get_height(texture));
+	}
+	gs_blend_state_pop();
+	gs_texrender_end(texrender);
+	return true;
+}
+
+/**
+  * @brief Whether the filters between the parent and a filter's target leave
+  * the pixels as this plugin's filters expect, so the unfiltered frame can
+  * stand in for the target's
+  *
+  * Only this plugin's filters may be enabled between them. Any other filter,
+  * such as a mirror, crop, LUT or chroma key, changes what the filter
+  * composites, and its mask would not match.
+  *
+  * @param target  The filter's target
+  * @param parent  The source the filters are on
+*/
+static bool renderedFromParent(obs_source_t *target, obs_source_t *parent)
+{
+	for (obs_source_t *filter = target; filter != parent;
+	     filter = obs_filter_get_target(filter)) {
+		if (!filter) {
+			return false;
+		}
+		if (!obs_source_enabled(filter)) {
+			// Disabled filters pass their target through
+			continue;
+		}
+		// The ids of background-filter-info.c and enhance-filter-info.c
+		const char *id = obs_source_get_id(filter);
+		if (!id || (strcmp(id, "background_removal") != 0 &&
+			    strcmp(id, "enhanceportrait") != 0)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+  * @brief Take this frame from the readback of the unfiltered source, see
+  * obs-utils/shared-readback.h
+  *
+  * @param roi  The region of the source to take
+  * @param size  The size to take it at
+  * @return true  if the frame was taken, false to read it back instead
+*/
+static bool takeSharedFrame(filter_data *tf, obs_source_t *parent,
+			    uint32_t width, uint32_t height,
+			    const cv::Rect &roi, const cv::Size &size)
+{
+	// Ask for enough pixels to take the region at this size
+	const uint64_t neededWidth = (uint64_t)size.width * width / roi.width;
+	const uint64_t neededHeight =
+		(uint64_t)size.height * height / roi.height;
+	requestSharedReadback(parent,
+			      (uint32_t)std::min<uint64_t>(width, neededWidth),
+			      (uint32_t)std::min<uint64_t>(height,
+							  neededHeight));
+
+	std::shared_ptr<const Frame> shared = getSharedReadback(parent);
+	if (!shared || shared->sourceWidth != width ||
+	    shared->sourceHeight != height || shared->imageBGRA.empty()) {
+		return false;
+	}
+	const cv::Rect sharedRoi = shared->sourceRoi.empty()
+					   ? cv::Rect(0, 0, (int)width,
+						      (int)height)
+					   : shared->sourceRoi;
+	if ((roi & sharedRoi) != roi) {
+		return false;
+	}
+	// The region in the shared pixels, which must not be upscaled
+	const double scaleX =
+		(double)shared->imageBGRA.cols / (double)sharedRoi.width;
+	const double scaleY =
+		(double)shared->imageBGRA.rows / (double)sharedRoi.height;
+	const cv::Rect region =
+		cv::Rect(cvRound((roi.x - sharedRoi.x) * scaleX),
+			 cvRound((roi.y - sharedRoi.y) * scaleY),
+			 cvRound(roi.width * scaleX),
+			 cvRound(roi.height * scaleY)) &
+		cv::Rect(0, 0, shared->imageBGRA.cols, shared->imageBGRA.rows);
+	if (region.width + 1 < size.width || region.height + 1 < size.height) {
+		return false;
+	}
+
+	Frame *frame = tf->frameRing.beginWrite();
+	if (frame) {
+		const cv::Mat pixels = shared->imageBGRA(region);
+		const uint32_t threads = resolvePostProcessThreads(
+			tf->postProcessThreads, tf->numThreads);
+		if (pixels.size() == size) {
+			tiledCopy(pixels, frame->imageBGRA, threads);
+		} else {
+			tiledResize(pixels, frame->imageBGRA, size, threads);
+		}
+		if (!tf->readbackThumbnail) {
+			frame->thumbnail.release();
+		} else if (roi == sharedRoi) {
+			// Made once for all filters of the source
+			shared->thumbnail.copyTo(frame->thumbnail);
+		} else {
+			makeThumbnail(frame->imageBGRA, frame->thumbnail);
+		}
+		frame->sourceWidth = width;
+		frame->sourceHeight = height;
+		frame->sourceRoi = roi;
+		tf->frameRing.endWrite();
+	}
+
+	// The own ring is idle while frames are shared, and would deliver a
+	// stale frame once sharing stops
+	if (!tf->stagesurfaces.empty()) {
+		destroyStageSurfaces(tf);
+	}
+	return true;
+}
+
 /**
   * @brief Get RGBA from the stage surface
   *
+  * Renders the filter target and reads it back through a ring of
+  * tf->readbackDepth stage surfaces, so the frame published to tf->frameRing
+  * is up to depth - 1 frames old but mapping it does not stall on the GPU.
+  *
+  * With tf->gpuDownscale the target is first scaled on the GPU to
+  * tf->readbackWidth x tf->readbackHeight, or the minimum readback size if
+  * larger, so only a model-sized image crosses the bus. tf->texrender keeps
+  * the full-size render either way.
+  * That scale also crops to the region picked by tf->roiTracker; without it
+  * the whole source is read back.
+  *
+  * With tf->shareReadback the frame is taken from the readback of the
+  * unfiltered source by another filter of this plugin when there is one and
+  * only filters of this plugin are between them, and nothing is read back.
+  * See obs-utils/shared-readback.h.
+  *
   * @param tf  The filter data
   * @param width  The width of the stage surface (output)
   * @param height  The height of the stage surface (output)
@@ -42,32 +235,178 @@ bool getRGBAFromStageSurface(filter_data *tf, uint32_t &width, uint32_t &height)
 	gs_blend_state_pop();
 	gs_texrender_end(tf->texrender);
 
-	if (tf->stagesurface) {
-		uint32_t stagesurf_width =
-			gs_stagesurface_get_width(tf->stagesurface);
-		uint32_t stagesurf_height =
-			gs_stagesurface_get_height(tf->stagesurface);
-		if (stagesurf_width != width || stagesurf_height != height) {
-			gs_stagesurface_destroy(tf->stagesurface);
-			tf->stagesurface = nullptr;
+	uint32_t readbackWidth =
+		std::max<uint32_t>(tf->readbackWidth, tf->readbackMinWidth);
+	uint32_t readbackHeight =
+		std::max<uint32_t>(tf->readbackHeight, tf->readbackMinHeight);
+
+	// Only the filter reading the unfiltered source publishes its frames
+	obs_source_t *parent = obs_filter_get_parent(tf->source);
+	uint32_t sharedWidth, sharedHeight;
+	const bool publish =
+		target == parent &&
+		getSharedReadbackRequest(parent, sharedWidth, sharedHeight);
+	if (publish && readbackWidth > 0 && readbackHeight > 0) {
+		// Large enough for the filters taking the frames too
+		readbackWidth = std::max(readbackWidth, sharedWidth);
+		readbackHeight = std::max(readbackHeight, sharedHeight);
+	}
+	const bool shrink = readbackWidth > 0 && readbackHeight > 0 &&
+			    readbackWidth <= width && readbackHeight <= height;
+
+	const cv::Rect fullFrame(0, 0, (int)width, (int)height);
+	const cv::Rect requestedRoi =
+		shrink && tf->gpuDownscale
+			? tf->roiTracker.nextReadbackRoi(width, height)
+			: fullFrame;
+	if (tf->shareReadback && target != parent &&
+	    renderedFromParent(target, parent)) {
+		const cv::Size size = shrink ? cv::Size(readbackWidth,
+							readbackHeight)
+					     : requestedRoi.size();
+		if (takeSharedFrame(tf, parent, width, height, requestedRoi,
+				    size)) {
+			return true;
+		}
+	}
+
+	gs_texture_t *stageTexture = gs_texrender_get_texture(tf->texrender);
+	uint32_t stageWidth = width;
+	uint32_t stageHeight = height;
+	cv::Rect roi = fullFrame;
+	if (shrink && tf->gpuDownscale) {
+		if (!tf->readbackTexrender) {
+			tf->readbackTexrender =
+				gs_texrender_create(GS_BGRA, GS_ZS_NONE);
+		}
+		roi = requestedRoi;
+		if (scaleTexture(tf->readbackTexrender, stageTexture, roi,
+				 readbackWidth, readbackHeight)) {
+			stageTexture =
+				gs_texrender_get_texture(tf->readbackTexrender);
+			stageWidth = readbackWidth;
+			stageHeight = readbackHeight;
+		} else {
+			roi = fullFrame;
+		}
+	}
+
+	// (Re)create the stage surface ring when the depth or the size changes
+	const size_t depth = std::max<size_t>(1, tf->readbackDepth);
+	if (!tf->stagesurfaces.empty() &&
+	    (tf->stagesurfaces.size() != depth ||
+	     gs_stagesurface_get_width(tf->stagesurfaces[0]) != stageWidth ||
+	     gs_stagesurface_get_height(tf->stagesurfaces[0]) != stageHeight)) {
+		destroyStageSurfaces(tf);
+	}
+	if (tf->stagesurfaces.empty()) {
+		for (size_t i = 0; i < depth; i++) {
+			tf->stagesurfaces.push_back(gs_stagesurface_create(
+				stageWidth, stageHeight, GS_BGRA));
 		}
+		tf->stagesurfaceFrames.assign(depth, 0);
+		tf->stagesurfaceRois.assign(depth, cv::Rect());
+		tf->stagesurfaceIndex = 0;
+		tf->mappedFrame = 0;
 	}
-	if (!tf->stagesurface) {
-		tf->stagesurface =
-			gs_stagesurface_create(width, height, GS_BGRA);
+
+	// Stage this frame
+	const size_t stageIndex = tf->stagesurfaceIndex;
+	gs_stage_texture(tf->stagesurfaces[stageIndex], stageTexture);
+	tf->stagesurfaceFrames[stageIndex] = ++tf->stagedFrameCount;
+	tf->stagesurfaceRois[stageIndex] = roi;
+	tf->stagesurfaceIndex = (stageIndex + 1) % depth;
+
+	// Map the oldest staged surface, which the GPU had depth - 1 frames to
+	// finish. Right after the ring was (re)created nothing was delivered at
+	// this size yet, so map this frame's surface synchronously instead.
+	size_t mapIndex = tf->stagesurfaceIndex;
+	if (tf->stagesurfaceFrames[mapIndex] <= tf->mappedFrame) {
+		if (tf->mappedFrame != 0) {
+			// The ring is still filling up
+			return true;
+		}
+		mapIndex = stageIndex;
 	}
-	gs_stage_texture(tf->stagesurface,
-			 gs_texrender_get_texture(tf->texrender));
+	gs_stagesurf_t *stagesurface = tf->stagesurfaces[mapIndex];
+
 	uint8_t *video_data;
 	uint32_t linesize;
-	if (!gs_stagesurface_map(tf->stagesurface, &video_data, &linesize)) {
+	if (!gs_stagesurface_map(stagesurface, &video_data, &linesize)) {
+		return false;
+	}
+	tf->mappedFrame = tf->stagesurfaceFrames[mapIndex];
+
+	Frame *frame = tf->frameRing.beginWrite();
+	if (frame) {
+		const cv::Mat mappedBGRA(stageHeight, stageWidth, CV_8UC4,
+					 video_data, linesize);
+		const uint32_t threads = resolvePostProcessThreads(
+			tf->postProcessThreads, tf->numThreads);
+		if (shrink && (readbackWidth != stageWidth ||
+			       readbackHeight != stageHeight)) {
+			// Shrink to the model input size while the surface is still mapped
+			tiledResize(mappedBGRA, frame->imageBGRA,
+				    cv::Size(readbackWidth, readbackHeight),
+				    threads);
+		} else {
+			// Copy the surface exactly once, into the pooled buffer
+			tiledCopy(mappedBGRA, frame->imageBGRA, threads);
+		}
+		if (tf->readbackThumbnail) {
+			makeThumbnail(frame->imageBGRA, frame->thumbnail);
+		} else {
+			frame->thumbnail.release();
+		}
+		frame->sourceWidth = width;
+		frame->sourceHeight = height;
+		frame->sourceRoi = tf->stagesurfaceRois[mapIndex];
+		if (publish) {
+			publishSharedReadback(parent, *frame);
+		}
+		tf->frameRing.endWrite();
+	}
+	gs_stagesurface_unmap(stagesurface);
+	return true;
+}
+
+/**
+  * @brief Destroy the stage surface ring. Must be called in the graphics context.
+  *
+  * @param tf  The filter data
+*/
+void destroyStageSurfaces(filter_data *tf)
+{
+	for (gs_stagesurf_t *stagesurface : tf->stagesurfaces) {
+		gs_stagesurface_destroy(stagesurface);
+	}
+	tf->stagesurfaces.clear();
+	tf->stagesurfaceFrames.clear();
+	tf->stagesurfaceRois.clear();
+}
+
+bool uploadToDynamicTexture(gs_texture_t *&texture, const cv::Mat &image,
+			    enum gs_color_format format)
+{
+	if (image.empty()) {
 		return false;
 	}
-	{
-		std::lock_guard<std::mutex> lock(tf->inputBGRALock);
-		tf->inputBGRA =
-			cv::Mat(height, width, CV_8UC4, video_data, linesize);
+
+	if (texture && (gs_texture_get_width(texture) != (uint32_t)image.cols ||
+			gs_texture_get_height(texture) !=
+				(uint32_t)image.rows)) {
+		gs_texture_destroy(texture);
+		texture = nullptr;
+	}
+	if (!texture) {
+		texture = gs_texture_create(image.cols, image.rows, format, 1,
+					    nullptr, GS_DYNAMIC);
+		if (!texture) {
+			return false;
+		}
 	}
-	gs_stagesurface_unmap(tf->stagesurface);
+
+	gs_texture_set_image(texture, image.data, (uint32_t)image.step[0],
+			     false);
 	return true;
 }
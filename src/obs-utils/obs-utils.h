@@ -6,4 +6,20 @@
 bool getRGBAFromStageSurface(filter_data *tf, uint32_t &width,
 			     uint32_t &height);
 
+void destroyStageSurfaces(filter_data *tf);
+
+/**
+  * @brief Upload an image into a persistent dynamic texture
+  *
+  * The texture is created on first use and recreated only when the image size
+  * changes. Call in the graphics context.
+  *
+  * @param texture  The texture, created or replaced as needed
+  * @param image  The image, 1 byte per channel
+  * @param format  The texture format matching the image channels
+  * @return true  if the texture holds the image
+*/
+bool uploadToDynamicTexture(gs_texture_t *&texture, const cv::Mat &image,
+			    enum gs_color_format format);
+
 #endif /* OBS_UTILS_H */
@@ -0,0 +1,110 @@
+#include "shared-readback.h"
+
+#include "image-utils/change-detection.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+// Requests and frames older than this are dropped, in ns
+static const uint64_t SHARED_READBACK_TIMEOUT_NS = 1000000000ULL;
+
+struct SharedReadback {
+	uint32_t requestWidth = 0;
+	uint32_t requestHeight = 0;
+	uint64_t requestTime = 0;
+	// The last published frame and the video frame it was published for
+	std::shared_ptr<Frame> frame;
+	uint64_t frameTime = 0;
+};
+
+static std::mutex sharedReadbackMutex;
+static std::map<obs_source_t *, SharedReadback> sharedReadbacks;
+
+/**
+  * @brief Drop the sources nothing was requested or published for lately,
+  * such as removed ones. Call with sharedReadbackMutex held.
+*/
+static void dropStaleSharedReadbacks(uint64_t now)
+{
+	for (auto it = sharedReadbacks.begin(); it != sharedReadbacks.end();) {
+		const uint64_t last =
+			std::max(it->second.requestTime, it->second.frameTime);
+		if (now - last > SHARED_READBACK_TIMEOUT_NS) {
+			it = sharedReadbacks.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void requestSharedReadback(obs_source_t *parent, uint32_t width,
+			   uint32_t height)
+{
+	const uint64_t now = obs_get_video_frame_time();
+	std::lock_guard<std::mutex> lock(sharedReadbackMutex);
+	dropStaleSharedReadbacks(now);
+
+	SharedReadback &shared = sharedReadbacks[parent];
+	if (now - shared.requestTime > SHARED_READBACK_TIMEOUT_NS) {
+		// The consumers that asked for more are gone
+		shared.requestWidth = 0;
+		shared.requestHeight = 0;
+	}
+	shared.requestWidth = std::max(shared.requestWidth, width);
+	shared.requestHeight = std::max(shared.requestHeight, height);
+	shared.requestTime = now;
+}
+
+bool getSharedReadbackRequest(obs_source_t *parent, uint32_t &width,
+			      uint32_t &height)
+{
+	const uint64_t now = obs_get_video_frame_time();
+	std::lock_guard<std::mutex> lock(sharedReadbackMutex);
+	auto it = sharedReadbacks.find(parent);
+	if (it == sharedReadbacks.end() ||
+	    now - it->second.requestTime > SHARED_READBACK_TIMEOUT_NS) {
+		return false;
+	}
+	width = it->second.requestWidth;
+	height = it->second.requestHeight;
+	return true;
+}
+
+void publishSharedReadback(obs_source_t *parent, const Frame &frame)
+{
+	const uint64_t now = obs_get_video_frame_time();
+	std::lock_guard<std::mutex> lock(sharedReadbackMutex);
+	auto it = sharedReadbacks.find(parent);
+	if (it == sharedReadbacks.end()) {
+		return;
+	}
+	SharedReadback &shared = it->second;
+
+	// Reuse the buffers unless a consumer still holds the frame
+	if (!shared.frame || shared.frame.use_count() > 1) {
+		shared.frame = std::make_shared<Frame>();
+	}
+	frame.imageBGRA.copyTo(shared.frame->imageBGRA);
+	if (frame.thumbnail.empty()) {
+		makeThumbnail(shared.frame->imageBGRA,
+			      shared.frame->thumbnail);
+	} else {
+		frame.thumbnail.copyTo(shared.frame->thumbnail);
+	}
+	shared.frame->sourceWidth = frame.sourceWidth;
+	shared.frame->sourceHeight = frame.sourceHeight;
+	shared.frame->sourceRoi = frame.sourceRoi;
+	shared.frameTime = now;
+}
+
+std::shared_ptr<const Frame> getSharedReadback(obs_source_t *parent)
+{
+	const uint64_t now = obs_get_video_frame_time();
+	std::lock_guard<std::mutex> lock(sharedReadbackMutex);
+	auto it = sharedReadbacks.find(parent);
+	if (it == sharedReadbacks.end() || it->second.frameTime != now) {
+		return nullptr;
+	}
+	return it->second.frame;
+}
@@ -0,0 +1,55 @@
+#ifndef SHARED_READBACK_H
+#define SHARED_READBACK_H
+
+#include <obs-module.h>
+
+#include <memory>
+
+#include "image-utils/frame-ring.h"
+
+/**
+  * Filters of this plugin stacked on one source would each read the frame back
+  * from the GPU. The filter that reads the unfiltered source publishes its
+  * frame per source and video frame, and filters further down the chain that
+  * can work on the unfiltered frame take it instead of reading their own.
+  * They only take it when no other plugin's filter is enabled in between, as
+  * that would change the pixels they composite.
+  *
+  * Consumers ask for the frame size they need over the whole source, and the
+  * publisher reads back at least that large. Everything runs on the graphics
+  * thread, during render.
+*/
+
+/**
+  * @brief Ask the publisher of a source for frames of at least this size
+  *
+  * A request holds for about a second, consumers renew it on every frame.
+  *
+  * @param parent  The source the filters are on
+*/
+void requestSharedReadback(obs_source_t *parent, uint32_t width,
+			   uint32_t height);
+
+/**
+  * @brief The size the consumers of a source asked for
+  *
+  * @return true  if a consumer is waiting for frames, false to not publish
+*/
+bool getSharedReadbackRequest(obs_source_t *parent, uint32_t &width,
+			      uint32_t &height);
+
+/**
+  * @brief Publish the frame read back for this video frame. The pixels are
+  * copied and a thumbnail is made once for all consumers.
+*/
+void publishSharedReadback(obs_source_t *parent, const Frame &frame);
+
+/**
+  * @brief The frame published for this video frame
+  *
+  * @return The frame, with a thumbnail, or nullptr if none was published for
+  * this video frame yet
+*/
+std::shared_ptr<const Frame> getSharedReadback(obs_source_t *parent);
+
+#endif /* SHARED_READBACK_H */
@@ -0,0 +1,206 @@
+#include "stats-handler.h"
+
+#include <map>
+#include <mutex>
+
+#include "plugin-support.h"
+
+static std::mutex statsMutex;
+static std::map<filter_data *, FilterStatsHandler> statsHandlers;
+
+static uint64_t getStageSurfaceBytes(gs_stagesurf_t *stagesurface)
+{
+	if (!stagesurface) {
+		return 0;
+	}
+	return (uint64_t)gs_stagesurface_get_width(stagesurface) *
+	       gs_stagesurface_get_height(stagesurface) *
+	       gs_get_format_bpp(gs_stagesurface_get_color_format(
+		       stagesurface)) /
+	       8;
+}
+
+uint64_t getTextureBytes(gs_texture_t *texture)
+{
+	if (!texture) {
+		return 0;
+	}
+	return (uint64_t)gs_texture_get_width(texture) *
+	       gs_texture_get_height(texture) *
+	       gs_get_format_bpp(gs_texture_get_color_format(texture)) / 8;
+}
+
+uint64_t getTexrenderBytes(gs_texrender_t *texrender)
+{
+	return texrender ? getTextureBytes(gs_texrender_get_texture(texrender))
+			 : 0;
+}
+
+double getVideoFrameRate()
+{
+	struct obs_video_info ovi;
+	if (!obs_get_video_info(&ovi) || ovi.fps_den == 0) {
+		return 0.0;
+	}
+	return (double)ovi.fps_num / (double)ovi.fps_den;
+}
+
+void writeStageLatency(StageProfiler &profiler, obs_data_t *stats)
+{
+	profiler.keepSampling();
+
+	obs_data_t *latency = obs_data_create();
+	for (int i = 0; i < PROFILER_STAGE_COUNT; i++) {
+		const ProfilerStage stage = (ProfilerStage)i;
+		float p50, p99;
+		if (!profiler.getLatency(stage, p50, p99)) {
+			continue;
+		}
+		obs_data_t *percentiles = obs_data_create();
+		obs_data_set_double(percentiles, "p50", p50);
+		obs_data_set_double(percentiles, "p99", p99);
+		obs_data_set_obj(latency, StageProfiler::getStageName(stage),
+				 percentiles);
+		obs_data_release(percentiles);
+	}
+	obs_data_set_obj(stats, "latency_ms", latency);
+	obs_data_release(latency);
+}
+
+/**
+  * @brief Write the stats of one filter. Call with statsMutex held.
+*/
+static void writeFilterStats(filter_data *tf,
+			     const FilterStatsHandler &handler,
+			     obs_data_t *stats)
+{
+	obs_data_set_string(stats, "source", obs_source_get_name(tf->source));
+	obs_source_t *parent = obs_filter_get_parent(tf->source);
+	obs_data_set_string(stats, "parent",
+			    parent ? obs_source_get_name(parent) : "");
+	obs_data_set_string(stats, "filter", obs_source_get_id(tf->source));
+	// Recorded by the session code, modelMutex is held across inference
+	const FilterStats &counters = tf->stats;
+	std::string model, provider;
+	counters.getSession(model, provider);
+	obs_data_set_string(stats, "model", model.c_str());
+	obs_data_set_string(stats, "provider", provider.c_str());
+	obs_data_set_bool(stats, "loaded", tf->modelInstalled);
+
+	obs_data_set_int(stats, "frames", (long long)counters.frames.load());
+	obs_data_set_int(stats, "inferences",
+			 (long long)counters.inferences.load());
+	obs_data_set_int(stats, "similarity_skips",
+			 (long long)counters.similaritySkips.load());
+	obs_data_set_int(stats, "scheduled_skips",
+			 (long long)counters.scheduledSkips.load());
+	obs_data_set_int(stats, "mask_interval", counters.maskInterval.load());
+	obs_data_set_int(stats, "cpu_fallbacks",
+			 (long long)counters.cpuFallbacks.load());
+	obs_data_set_double(stats, "inference_fps", counters.inferenceRate());
+
+	handler.write(tf, stats);
+
+	const uint64_t tensorBytes = counters.tensorBytes;
+	obs_enter_graphics();
+	uint64_t textureBytes = getTexrenderBytes(tf->texrender) +
+				getTexrenderBytes(tf->readbackTexrender);
+	for (gs_stagesurf_t *stagesurface : tf->stagesurfaces) {
+		textureBytes += getStageSurfaceBytes(stagesurface);
+	}
+	textureBytes += handler.textureBytes(tf);
+	obs_leave_graphics();
+
+	obs_data_t *memory = obs_data_create();
+	obs_data_set_int(memory, "tensor_bytes", (long long)tensorBytes);
+	obs_data_set_int(memory, "texture_bytes", (long long)textureBytes);
+	obs_data_set_obj(stats, "memory", memory);
+	obs_data_release(memory);
+}
+
+static void getFilterStats(void *data, calldata_t *cd)
+{
+	filter_data *tf = static_cast<filter_data *>(data);
+	obs_data_t *stats = obs_data_create();
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		auto it = statsHandlers.find(tf);
+		if (it != statsHandlers.end()) {
+			writeFilterStats(tf, it->second, stats);
+		}
+	}
+	calldata_set_string(cd, "json", obs_data_get_json(stats));
+	obs_data_release(stats);
+}
+
+static void getPluginStats(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	obs_data_t *stats = obs_data_create();
+	obs_data_set_string(stats, "version", PLUGIN_VERSION);
+
+	obs_data_array_t *filters = obs_data_array_create();
+	double inferenceFps = 0.0;
+	long long cpuFallbacks = 0, tensorBytes = 0, textureBytes = 0;
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		for (const auto &entry : statsHandlers) {
+			obs_data_t *filter = obs_data_create();
+			writeFilterStats(entry.first, entry.second, filter);
+
+			inferenceFps +=
+				obs_data_get_double(filter, "inference_fps");
+			cpuFallbacks +=
+				obs_data_get_int(filter, "cpu_fallbacks");
+			obs_data_t *memory = obs_data_get_obj(filter, "memory");
+			tensorBytes += obs_data_get_int(memory, "tensor_bytes");
+			textureBytes +=
+				obs_data_get_int(memory, "texture_bytes");
+			obs_data_release(memory);
+
+			obs_data_array_push_back(filters, filter);
+			obs_data_release(filter);
+		}
+	}
+	obs_data_set_int(stats, "filter_count",
+			 (long long)obs_data_array_count(filters));
+	obs_data_set_array(stats, "filters", filters);
+	obs_data_array_release(filters);
+
+	obs_data_set_double(stats, "inference_fps", inferenceFps);
+	obs_data_set_double(stats, "video_fps", getVideoFrameRate());
+	obs_data_set_int(stats, "cpu_fallbacks", cpuFallbacks);
+	obs_data_t *memory = obs_data_create();
+	obs_data_set_int(memory, "tensor_bytes", tensorBytes);
+	obs_data_set_int(memory, "texture_bytes", textureBytes);
+	obs_data_set_obj(stats, "memory", memory);
+	obs_data_release(memory);
+
+	calldata_set_string(cd, "json", obs_data_get_json(stats));
+	obs_data_release(stats);
+}
+
+void registerFilterStats(filter_data *tf, const FilterStatsHandler &handler)
+{
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		statsHandlers[tf] = handler;
+	}
+	proc_handler_add(obs_source_get_proc_handler(tf->source),
+			 "void get_stats(out string json)", getFilterStats, tf);
+}
+
+void unregisterFilterStats(filter_data *tf)
+{
+	// Waits for a stats call in progress
+	std::lock_guard<std::mutex> lock(statsMutex);
+	statsHandlers.erase(tf);
+}
+
+void register_plugin_stats_handler(void)
+{
+	proc_handler_add(
+		obs_get_proc_handler(),
+		"void obs_backgroundremoval_get_stats(out string json)",
+		getPluginStats, nullptr);
+}
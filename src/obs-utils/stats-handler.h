@@ -0,0 +1,83 @@
+#ifndef STATS_HANDLER_H
+#define STATS_HANDLER_H
+
+#ifdef __cplusplus
+
+#include <obs-module.h>
+
+#include <cstdint>
+
+#include "FilterData.h"
+#include "perf-utils/stage-profiler.h"
+
+/**
+  * Inference health as JSON, for scripts and obs-websocket to scrape without
+  * parsing the log.
+  *
+  * Every filter registers "void get_stats(out string json)" on its source's
+  * proc handler. The plugin registers
+  * "void obs_backgroundremoval_get_stats(out string json)" on the global proc
+  * handler, which returns the stats of every filter and their totals.
+  *
+  * The per-filter object has the source and parent names, the model and
+  * provider, the frame, inference and skip counters, the achieved and
+  * requested inference rates, the stage latencies in ms and the bytes held in
+  * tensors and textures. Counters only grow.
+*/
+
+/**
+  * @brief A filter type's part of its stats
+*/
+struct FilterStatsHandler {
+	// Add the filter's own stats, such as the requested rate and latencies
+	void (*write)(filter_data *tf, obs_data_t *stats);
+	// The bytes of the filter's own textures, in the graphics context
+	uint64_t (*textureBytes)(filter_data *tf);
+};
+
+/**
+  * @brief Register the get_stats proc of a filter's source
+  *
+  * Call when the filter is created, after tf->source is set.
+*/
+void registerFilterStats(filter_data *tf, const FilterStatsHandler &handler);
+
+/**
+  * @brief Stop reporting a filter. Its proc returns an empty object from now
+  * on. Call first thing when the filter is destroyed.
+*/
+void unregisterFilterStats(filter_data *tf);
+
+/**
+  * @brief The frame rate of the OBS video output
+*/
+double getVideoFrameRate();
+
+/**
+  * @brief Add the median and 99th percentile of each timed stage, as
+  * "latency_ms": {"<stage>": {"p50": ms, "p99": ms}}
+  *
+  * Starts timing the stages on the first call.
+*/
+void writeStageLatency(StageProfiler &profiler, obs_data_t *stats);
+
+/**
+  * @brief The bytes held by a texture or a texrender's texture. Call in the
+  * graphics context.
+*/
+uint64_t getTextureBytes(gs_texture_t *texture);
+uint64_t getTexrenderBytes(gs_texrender_t *texrender);
+
+extern "C" {
+#endif
+
+/**
+  * @brief Register the plugin-wide stats proc. Call when the module loads.
+*/
+void register_plugin_stats_handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_HANDLER_H */
@@ -2,10 +2,59 @@
 #define ORTMODELDATA_H
 
 #include <onnxruntime_cxx_api.h>
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ort-utils/ort-device-binding.h"
+
+/**
+  * @brief The model and inference device a session is built for
+*/
+struct OrtSessionConfig {
+	std::string modelSelection;
+	std::string useGPU;
+	uint32_t numThreads = 0;
+
+	bool operator==(const OrtSessionConfig &other) const
+	{
+		return modelSelection == other.modelSelection &&
+		       useGPU == other.useGPU &&
+		       numThreads == other.numThreads;
+	}
+	bool operator!=(const OrtSessionConfig &other) const
+	{
+		return !(*this == other);
+	}
+};
+
+/**
+  * @brief Buffers the inference functions reuse from frame to frame, so a
+  * running session doesn't allocate
+  *
+  * Sized by allocateOrtSessionTensors for the model and its input resolution,
+  * or by the first frame after it. Used with modelMutex held.
+*/
+struct InferenceScratch {
+	// inputNames and outputNames as Session::Run takes them
+	std::vector<const char *> inputNames;
+	std::vector<const char *> outputNames;
+	// The postprocessed output of runFilterModelInference, HWC float
+	cv::Mat output;
+};
 
 struct ORTModelData {
-	std::unique_ptr<Ort::Session> session;
-	std::unique_ptr<Ort::Env> env;
+	// Shared with other filters using the same model, see ort-session-cache.h
+	std::shared_ptr<Ort::Session> session;
+	// Held around Session::Run, null if the session runs concurrently. See
+	// lockOrtSessionRun.
+	std::shared_ptr<std::mutex> sessionRunMutex;
+	// Set when recurrent state stays on the GPU, see ort-device-binding.h
+	std::unique_ptr<OrtDeviceBinding> deviceBinding;
 	std::vector<Ort::AllocatedStringPtr> inputNames;
 	std::vector<Ort::AllocatedStringPtr> outputNames;
 	std::vector<Ort::Value> inputTensor;
@@ -14,6 +63,11 @@ struct ORTModelData {
 	std::vector<std::vector<int64_t>> outputDims;
 	std::vector<std::vector<float>> outputTensorValues;
 	std::vector<std::vector<float>> inputTensorValues;
+	// Buffers of the FP16 tensors, empty for FP32 ones. See
+	// Model::allocateHalfTensorBuffers
+	std::vector<std::vector<Ort::Float16_t>> outputTensorHalfValues;
+	std::vector<std::vector<Ort::Float16_t>> inputTensorHalfValues;
+	InferenceScratch scratch;
 };
 
 #endif /* ORTMODELDATA_H */
@@ -0,0 +1,336 @@
+#include "inference-batch.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "plugin-support.h"
+#include "ort-session-cache.h"
+
+struct InferenceBatchMember;
+
+namespace {
+
+/**
+  * @brief A frame waiting to be run as part of a batch
+*/
+struct BatchRequest {
+	filter_data *tf;
+	const cv::Mat *imageBGRA;
+	bool enableThreshold;
+	uint8_t threshold;
+	cv::Mat *backgroundMask;
+	bool done = false;
+	bool success = false;
+};
+
+/**
+  * @brief The filters batched on one session and the frames they submitted
+*/
+struct InferenceBatch {
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<InferenceBatchMember *> members;
+	std::vector<BatchRequest *> pending;
+
+	// Only one batch runs at a time, so the batched tensors are reused
+	std::mutex runMutex;
+	std::vector<float> inputTensorValues;
+	std::vector<float> outputTensorValues;
+	// Tensors over the buffers, rebuilt when the batch size or the buffers
+	// change
+	std::vector<int64_t> inputShape;
+	std::vector<int64_t> outputShape;
+	std::vector<Ort::Value> inputTensor;
+	std::vector<Ort::Value> outputTensor;
+};
+
+std::mutex batchesMutex;
+// Keyed by the session's control block, which the key keeps alive, so a new
+// session built at the address of a freed one gets a batch of its own
+std::map<std::weak_ptr<Ort::Session>, std::weak_ptr<InferenceBatch>,
+	 std::owner_less<std::weak_ptr<Ort::Session>>>
+	batches;
+
+} // namespace
+
+/**
+  * @brief A filter's membership of a batch, listed in InferenceBatch::members
+*/
+struct InferenceBatchMember {
+	std::shared_ptr<InferenceBatch> batch;
+	// When the filter last submitted a frame, guarded by batch->mutex
+	std::chrono::steady_clock::time_point lastSubmit;
+
+	explicit InferenceBatchMember(std::shared_ptr<InferenceBatch> batch_)
+		: batch(std::move(batch_))
+	{
+		std::lock_guard<std::mutex> lock(batch->mutex);
+		batch->members.push_back(this);
+	}
+
+	~InferenceBatchMember()
+	{
+		{
+			std::lock_guard<std::mutex> lock(batch->mutex);
+			batch->members.erase(std::remove(batch->members.begin(),
+							 batch->members.end(),
+							 this),
+					     batch->members.end());
+		}
+		// A batch may be waiting for this member's frame
+		batch->condition.notify_all();
+	}
+};
+
+/**
+  * @brief The members a batch waits for: those that submitted a frame within
+  * INFERENCE_BATCH_ACTIVE_MS. Call with batch.mutex held.
+*/
+static size_t
+countSubmittingMembers(const InferenceBatch &batch,
+		       std::chrono::steady_clock::time_point now)
+{
+	const std::chrono::milliseconds active(INFERENCE_BATCH_ACTIVE_MS);
+	return (size_t)std::count_if(
+		batch.members.begin(), batch.members.end(),
+		[&](const InferenceBatchMember *member) {
+			return now - member->lastSubmit <= active;
+		});
+}
+
+/**
+  * @brief Whether the session can run several frames in one call
+*/
+static bool
+sessionSupportsBatching(const std::shared_ptr<Ort::Session> &session)
+{
+	if (session->GetInputCount() != 1 || session->GetOutputCount() != 1) {
+		// Recurrent models keep per-source state in their extra inputs
+		return false;
+	}
+
+	const Ort::TypeInfo inputTypeInfo = session->GetInputTypeInfo(0);
+	const Ort::TypeInfo outputTypeInfo = session->GetOutputTypeInfo(0);
+	const auto inputInfo = inputTypeInfo.GetTensorTypeAndShapeInfo();
+	const auto outputInfo = outputTypeInfo.GetTensorTypeAndShapeInfo();
+	if (inputInfo.GetElementType() !=
+		    ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT ||
+	    outputInfo.GetElementType() !=
+		    ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) {
+		// The batch tensors are FP32 only
+		return false;
+	}
+
+	const std::vector<int64_t> inputShape = inputInfo.GetShape();
+	const std::vector<int64_t> outputShape = outputInfo.GetShape();
+	return !inputShape.empty() && inputShape[0] == -1 &&
+	       !outputShape.empty() && outputShape[0] == -1;
+}
+
+bool updateInferenceBatch(filter_data *tf)
+{
+	if (!tf->batchInference || !tf->session || !tf->model ||
+	    !sessionSupportsBatching(tf->session)) {
+		leaveInferenceBatch(tf);
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(batchesMutex);
+	const std::weak_ptr<Ort::Session> session = tf->session;
+	std::shared_ptr<InferenceBatch> batch = batches[session].lock();
+	if (tf->inferenceBatchMember &&
+	    tf->inferenceBatchMember->batch == batch) {
+		// Already a member
+		return true;
+	}
+
+	if (!batch) {
+		batch = std::make_shared<InferenceBatch>();
+		batches[session] = batch;
+	}
+	tf->inferenceBatchMember =
+		std::make_shared<InferenceBatchMember>(batch);
+
+	// Drop the entries of batches that have no members left
+	for (auto it = batches.begin(); it != batches.end();) {
+		if (it->second.expired()) {
+			it = batches.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	obs_log(LOG_INFO, "Batching inference with other sources on %s",
+		tf->modelSelection.c_str());
+	return true;
+}
+
+void leaveInferenceBatch(filter_data *tf)
+{
+	tf->inferenceBatchMember.reset();
+}
+
+/**
+  * @brief Whether a batched tensor shape is the model's with this batch size
+*/
+static bool isBatchShape(const std::vector<int64_t> &shape,
+			 const std::vector<int64_t> &dims, int64_t batchSize)
+{
+	return !shape.empty() && shape.size() == dims.size() &&
+	       shape[0] == batchSize &&
+	       std::equal(shape.begin() + 1, shape.end(), dims.begin() + 1);
+}
+
+/**
+  * @brief Run the frames of a batch in one Session::Run and write their masks
+  *
+  * @param tf  The filter whose session and buffers shapes are used
+*/
+static void runBatch(InferenceBatch &batch, filter_data *tf,
+		     const std::vector<BatchRequest *> &requests)
+{
+	std::lock_guard<std::mutex> lock(batch.runMutex);
+
+	const int64_t batchSize = (int64_t)requests.size();
+	const size_t inputSize = vectorProduct(tf->inputDims[0]);
+	const size_t outputSize = vectorProduct(tf->outputDims[0]);
+	batch.inputTensorValues.resize(batchSize * inputSize);
+	batch.outputTensorValues.resize(batchSize * outputSize);
+
+	// Each member loads its frame with its own model's preprocessing
+	uint32_t inputWidth, inputHeight;
+	tf->model->getNetworkInputSize(tf->inputDims, inputWidth, inputHeight);
+	for (size_t i = 0; i < requests.size(); i++) {
+		preprocessImageToTensor(
+			*requests[i]->imageBGRA, inputWidth, inputHeight,
+			requests[i]->tf->model->getInputPreprocessing(),
+			batch.inputTensorValues.data() + i * inputSize);
+	}
+
+	const bool sameTensors =
+		!batch.inputTensor.empty() &&
+		isBatchShape(batch.inputShape, tf->inputDims[0], batchSize) &&
+		isBatchShape(batch.outputShape, tf->outputDims[0], batchSize) &&
+		batch.inputTensor[0].GetTensorData<float>() ==
+			batch.inputTensorValues.data() &&
+		batch.outputTensor[0].GetTensorData<float>() ==
+			batch.outputTensorValues.data();
+	if (!sameTensors) {
+		batch.inputShape = tf->inputDims[0];
+		batch.outputShape = tf->outputDims[0];
+		batch.inputShape[0] = batchSize;
+		batch.outputShape[0] = batchSize;
+
+		Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(
+			OrtAllocatorType::OrtDeviceAllocator,
+			OrtMemType::OrtMemTypeDefault);
+		batch.inputTensor.clear();
+		batch.outputTensor.clear();
+		batch.inputTensor.push_back(Ort::Value::CreateTensor<float>(
+			memoryInfo, batch.inputTensorValues.data(),
+			batch.inputTensorValues.size(), batch.inputShape.data(),
+			batch.inputShape.size()));
+		batch.outputTensor.push_back(Ort::Value::CreateTensor<float>(
+			memoryInfo, batch.outputTensorValues.data(),
+			batch.outputTensorValues.size(),
+			batch.outputShape.data(), batch.outputShape.size()));
+	}
+
+	{
+		std::unique_lock<std::mutex> runLock =
+			lockOrtSessionRun(tf->sessionRunMutex);
+		tf->model->runNetworkInference(tf->session,
+					       tf->scratch.inputNames,
+					       tf->scratch.outputNames,
+					       batch.inputTensor,
+					       batch.outputTensor);
+	}
+
+	// Scatter the masks back to their filters
+	const OutputPostprocessing post =
+		tf->model->getOutputPostprocessing(tf->outputDims);
+	for (size_t i = 0; i < requests.size(); i++) {
+		BatchRequest *request = requests[i];
+		postprocessTensorToMask(batch.outputTensorValues.data() +
+						i * outputSize,
+					post, request->enableThreshold,
+					request->threshold,
+					*request->backgroundMask);
+		request->success = !request->backgroundMask->empty();
+	}
+}
+
+bool runBatchedInferenceToMask(filter_data *tf, const cv::Mat &imageBGRA,
+			       bool enableThreshold, uint8_t threshold,
+			       cv::Mat &backgroundMask)
+{
+	if (!tf->inferenceBatchMember) {
+		return false;
+	}
+	// The member keeps the batch alive while this frame is in it
+	InferenceBatchMember &member = *tf->inferenceBatchMember;
+	InferenceBatch &batch = *member.batch;
+
+	BatchRequest request{tf, &imageBGRA, enableThreshold, threshold,
+			     &backgroundMask};
+
+	std::unique_lock<std::mutex> lock(batch.mutex);
+	const std::chrono::steady_clock::time_point now =
+		std::chrono::steady_clock::now();
+	member.lastSubmit = now;
+	batch.pending.push_back(&request);
+
+	if (batch.pending.size() > 1) {
+		// Another filter leads this batch. Wake it if the batch is full.
+		const size_t submitting = countSubmittingMembers(batch, now);
+		if (batch.pending.size() >= submitting) {
+			batch.condition.notify_all();
+		}
+		batch.condition.wait(lock, [&request] { return request.done; });
+		return request.success;
+	}
+
+	// First frame in: wait for the other submitting members, but not past
+	// the deadline. Alone, it runs right away.
+	if (countSubmittingMembers(batch, now) > 1) {
+		batch.condition.wait_for(
+			lock,
+			std::chrono::milliseconds(INFERENCE_BATCH_DEADLINE_MS),
+			[&batch, now] {
+				return batch.pending.size() >=
+				       countSubmittingMembers(batch, now);
+			});
+	}
+
+	// Keep both vectors' capacity for the next batches
+	thread_local std::vector<BatchRequest *> requests;
+	requests.assign(batch.pending.begin(), batch.pending.end());
+	batch.pending.clear();
+	lock.unlock();
+
+	try {
+		runBatch(batch, tf, requests);
+	} catch (const std::exception &e) {
+		obs_log(LOG_ERROR, "Batched inference of %d frames failed: %s",
+			(int)requests.size(), e.what());
+		for (BatchRequest *r : requests) {
+			r->success = false;
+		}
+	}
+
+	lock.lock();
+	for (BatchRequest *r : requests) {
+		r->done = true;
+	}
+	lock.unlock();
+	batch.condition.notify_all();
+
+	return request.success;
+}
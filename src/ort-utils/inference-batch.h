@@ -0,0 +1,60 @@
+#ifndef INFERENCE_BATCH_H
+#define INFERENCE_BATCH_H
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+
+#include "FilterData.h"
+
+// How long the first frame of a batch waits for the other members
+#define INFERENCE_BATCH_DEADLINE_MS 4
+// Members that submitted a frame this recently are waited for. Hidden
+// sources and ones whose frames are skipped drop out of the wait.
+#define INFERENCE_BATCH_ACTIVE_MS 100
+
+/**
+  * @brief Join the inference batch of the filter's session, or leave it
+  *
+  * Filters that share a session and have batchInference set are batched together
+  * when the model has a dynamic batch dimension and a single input and output.
+  * Call with modelMutex held, after the session is created or batchInference
+  * changes.
+  *
+  * @param tf  The filter data
+  * @return true  if the filter is now a member of a batch
+*/
+bool updateInferenceBatch(filter_data *tf);
+
+/**
+  * @brief Leave the inference batch of the filter's session, if any
+  *
+  * Call with modelMutex held, before the session is released.
+  *
+  * @param tf  The filter data
+*/
+void leaveInferenceBatch(filter_data *tf);
+
+/**
+  * @brief Run a segmentation model on a frame batched with the other members
+  *
+  * The first caller of a batch waits up to INFERENCE_BATCH_DEADLINE_MS for the
+  * other members that submitted within INFERENCE_BATCH_ACTIVE_MS, runs a single
+  * Session::Run with batch dimension N and hands each member its mask. It runs
+  * right away when no other member is submitting. Blocks until this frame's
+  * mask is ready.
+  *
+  * @param tf  The filter data, which must be a member of a batch
+  * @param imageBGRA  The frame to segment
+  * @param enableThreshold  Binarize the mask at threshold instead of inverting
+  * the foreground probability
+  * @param threshold  The threshold in [0, 255]
+  * @param backgroundMask  The background mask (output), CV_8UC1 at the model
+  * output size
+  * @return true  if the mask was produced
+*/
+bool runBatchedInferenceToMask(filter_data *tf, const cv::Mat &imageBGRA,
+			       bool enableThreshold, uint8_t threshold,
+			       cv::Mat &backgroundMask);
+
+#endif /* INFERENCE_BATCH_H */
@@ -0,0 +1,112 @@
+#include "inference-worker.h"
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "plugin-support.h"
+#include "ort-session-utils.h"
+#include "perf-utils/core-budget.h"
+
+/**
+  * @brief Rebuild the session with the filter's new share of the CPU budget
+  *
+  * On the worker, so only this filter's masks pause while the session builds.
+*/
+static void rebuildSessionForCoreBudget(filter_data *tf)
+{
+	std::unique_lock<std::mutex> lock(tf->modelMutex);
+	if (!tf->model || !tf->session) {
+		return;
+	}
+	obs_log(LOG_INFO, "Rebuilding the %s session for the CPU budget",
+		tf->modelSelection.c_str());
+	if (createOrtSession(tf) != OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+		obs_log(LOG_ERROR, "Failed to rebuild the session");
+		tf->isDisabled = true;
+		tf->model.reset();
+		tf->modelInstalled = false;
+	}
+}
+
+void startInferenceWorker(filter_data *tf,
+			  std::function<void(const Frame &)> processFrame)
+{
+	if (tf->inferenceThread.joinable()) {
+		// Worker is already running
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(tf->inferenceThreadMutex);
+		tf->inferenceThreadStop = false;
+		tf->pendingFrame.reset();
+	}
+
+	tf->inferenceThread = std::thread([tf, processFrame]() {
+		os_set_thread_name("bgremoval-inference");
+		// ORT runs part of every inference on the calling thread
+		pinThreadToCoreBudget();
+
+		while (true) {
+			FramePtr frame;
+			{
+				std::unique_lock<std::mutex> lock(
+					tf->inferenceThreadMutex);
+				tf->inferenceThreadCondition.wait(lock, [tf] {
+					return tf->inferenceThreadStop ||
+					       tf->pendingFrame != nullptr;
+				});
+				if (tf->inferenceThreadStop) {
+					break;
+				}
+				// Take ownership of the newest frame
+				frame = std::move(tf->pendingFrame);
+				tf->pendingFrame.reset();
+			}
+
+			if (tf->isDisabled) {
+				continue;
+			}
+
+			if (tf->coreBudgetChanged.exchange(false)) {
+				rebuildSessionForCoreBudget(tf);
+			}
+
+			try {
+				processFrame(*frame);
+			} catch (const std::exception &e) {
+				obs_log(LOG_ERROR,
+					"Inference worker exception: %s",
+					e.what());
+			}
+		}
+	});
+}
+
+void submitFrameToInferenceWorker(filter_data *tf, FramePtr frame)
+{
+	{
+		// The worker only holds this lock while moving a frame out
+		std::lock_guard<std::mutex> lock(tf->inferenceThreadMutex);
+		// Replace any frame the worker has not picked up yet
+		tf->pendingFrame = std::move(frame);
+	}
+	tf->inferenceThreadCondition.notify_one();
+}
+
+void stopInferenceWorker(filter_data *tf)
+{
+	{
+		std::lock_guard<std::mutex> lock(tf->inferenceThreadMutex);
+		tf->inferenceThreadStop = true;
+	}
+	tf->inferenceThreadCondition.notify_one();
+
+	if (tf->inferenceThread.joinable()) {
+		tf->inferenceThread.join();
+	}
+
+	// Give the frame buffer back to the ring
+	std::lock_guard<std::mutex> lock(tf->inferenceThreadMutex);
+	tf->pendingFrame.reset();
+}
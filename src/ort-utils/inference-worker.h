@@ -0,0 +1,36 @@
+#ifndef INFERENCE_WORKER_H
+#define INFERENCE_WORKER_H
+
+#include <functional>
+
+#include "FilterData.h"
+
+/**
+  * @brief Start the inference worker thread of a filter
+  *
+  * The worker waits for frames submitted with submitFrameToInferenceWorker and calls
+  * processFrame on the newest one. Frames that arrive while the worker is busy replace
+  * the pending frame, so the worker never falls behind the video.
+  *
+  * @param tf  The filter data
+  * @param processFrame  Called on the worker thread for every frame it picks up
+*/
+void startInferenceWorker(filter_data *tf,
+			  std::function<void(const Frame &)> processFrame);
+
+/**
+  * @brief Hand a frame to the inference worker without blocking
+  *
+  * @param tf  The filter data
+  * @param frame  The frame to process. Ownership moves to the worker.
+*/
+void submitFrameToInferenceWorker(filter_data *tf, FramePtr frame);
+
+/**
+  * @brief Stop the inference worker thread and wait for it to exit
+  *
+  * @param tf  The filter data
+*/
+void stopInferenceWorker(filter_data *tf);
+
+#endif /* INFERENCE_WORKER_H */
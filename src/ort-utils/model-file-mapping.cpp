@@ -0,0 +1,121 @@
+#include "model-file-mapping.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#include <map>
+#include <mutex>
+
+MappedModelFile::MappedModelFile(const void *address_, size_t length_)
+	: address(address_),
+	  length(length_)
+{
+}
+
+MappedModelFile::~MappedModelFile()
+{
+#ifdef _WIN32
+	UnmapViewOfFile(address);
+#else
+	munmap(const_cast<void *>(address), length);
+#endif
+}
+
+#if _WIN32
+typedef std::wstring ModelFilepath;
+#else
+typedef std::string ModelFilepath;
+#endif
+
+/**
+  * @brief Map the whole file read-only
+*/
+static std::shared_ptr<const MappedModelFile>
+mapFile(const ModelFilepath &path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+				  nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+				  nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	HANDLE mapping =
+		CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr) {
+		return nullptr;
+	}
+	// The view keeps the mapping alive
+	void *address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (address == nullptr) {
+		return nullptr;
+	}
+	return std::make_shared<const MappedModelFile>(address,
+						       (size_t)size.QuadPart);
+#else
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return nullptr;
+	}
+	void *address = mmap(nullptr, (size_t)st.st_size, PROT_READ,
+			     MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file open
+	close(fd);
+	if (address == MAP_FAILED) {
+		return nullptr;
+	}
+	return std::make_shared<const MappedModelFile>(address,
+						       (size_t)st.st_size);
+#endif
+}
+
+static std::mutex mappingCacheMutex;
+static std::map<ModelFilepath, std::weak_ptr<const MappedModelFile>>
+	mappingCache;
+
+std::shared_ptr<const MappedModelFile> mapModelFile(const ModelFilepath &path)
+{
+	std::lock_guard<std::mutex> lock(mappingCacheMutex);
+
+	// Drop entries whose mappings were released
+	for (auto it = mappingCache.begin(); it != mappingCache.end();) {
+		if (it->second.expired()) {
+			it = mappingCache.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	auto cached = mappingCache.find(path);
+	if (cached != mappingCache.end()) {
+		std::shared_ptr<const MappedModelFile> mapping =
+			cached->second.lock();
+		if (mapping) {
+			return mapping;
+		}
+	}
+
+	std::shared_ptr<const MappedModelFile> mapping = mapFile(path);
+	if (mapping) {
+		mappingCache[path] = mapping;
+	}
+	return mapping;
+}
@@ -0,0 +1,46 @@
+#ifndef MODEL_FILE_MAPPING_H
+#define MODEL_FILE_MAPPING_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+  * @brief A model file mapped read-only into memory
+  *
+  * The pages come from the OS file cache, so sessions built at the same time
+  * from one mapping don't each read the file into their own buffer.
+*/
+class MappedModelFile {
+public:
+	MappedModelFile(const void *address, size_t length);
+	~MappedModelFile();
+
+	MappedModelFile(const MappedModelFile &) = delete;
+	MappedModelFile &operator=(const MappedModelFile &) = delete;
+
+	const void *data() const { return address; }
+	size_t size() const { return length; }
+
+private:
+	const void *address;
+	size_t length;
+};
+
+/**
+  * @brief Map a model file, or share the mapping another session build holds
+  *
+  * The mapping is unmapped when the last reference goes away. ONNX models are
+  * parsed into the session, so it only has to live while the session is
+  * created.
+  *
+  * @param path  The model file
+  * @return The mapping, or nullptr if the file can't be mapped
+*/
+#if _WIN32
+std::shared_ptr<const MappedModelFile> mapModelFile(const std::wstring &path);
+#else
+std::shared_ptr<const MappedModelFile> mapModelFile(const std::string &path);
+#endif
+
+#endif /* MODEL_FILE_MAPPING_H */
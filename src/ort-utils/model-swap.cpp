@@ -0,0 +1,321 @@
+#include "model-swap.h"
+
+#include <obs-module.h>
+#include <util/platform.h>
+
+#include "ort-session-utils.h"
+#include "inference-batch.h"
+#include "tensorrt-engines.h"
+#include "consts.h"
+#include "plugin-support.h"
+
+/**
+  * @brief Record a failed build if it left the filter without a model, so the
+  * filter passes frames through quietly until its settings change. Call with
+  * modelMutex held.
+*/
+static void markModelSwapFailedLocked(filter_data *tf)
+{
+	if (tf->model) {
+		// Still serving frames with the previous model
+		return;
+	}
+	tf->modelSwapFailed = true;
+	obs_log(LOG_ERROR,
+		"%s has no model, passing frames through until its settings change",
+		obs_source_get_name(tf->source));
+}
+
+static void markModelSwapFailed(filter_data *tf)
+{
+	std::unique_lock<std::mutex> lock(tf->modelMutex);
+	markModelSwapFailedLocked(tf);
+}
+
+/**
+  * @brief Build the requested session and install it, unless a newer request
+  * came in meanwhile
+*/
+static void swapModel(filter_data *tf, ModelSwapRequest &request)
+{
+	const OrtSessionConfig &config = request.config;
+	obs_log(LOG_INFO, "Building the %s session on %s",
+		config.modelSelection.c_str(), config.useGPU.c_str());
+
+	OrtSessionBuild build;
+	int result = openOrtSession(tf, config, build);
+	if (result != OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+		obs_log(LOG_ERROR,
+			"Failed to create ONNXRuntime session. Error code: %d",
+			result);
+		markModelSwapFailed(tf);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(tf->modelSwapMutex);
+		if (tf->pendingModelSwap || tf->modelSwapStop) {
+			obs_log(LOG_INFO,
+				"Dropping the %s session, another model was requested",
+				config.modelSelection.c_str());
+			return;
+		}
+	}
+
+	// Released after modelMutex, so inference does not wait for them
+	std::unique_ptr<Model> oldModel;
+	std::shared_ptr<Ort::Session> oldSession;
+	{
+		std::unique_lock<std::mutex> lock(tf->modelMutex);
+		OrtSessionConfig oldConfig;
+		oldConfig.modelSelection = tf->modelSelection;
+		oldConfig.useGPU = tf->useGPU;
+		oldConfig.numThreads = tf->numThreads;
+		OrtSessionBuild oldBuild;
+		oldBuild.session = tf->session;
+		oldBuild.runMutex = tf->sessionRunMutex;
+		oldBuild.modelFilepath = tf->modelFilepath;
+		oldModel = std::move(tf->model);
+		oldSession = tf->session;
+
+		tf->model = std::move(request.model);
+		tf->modelSelection = config.modelSelection;
+		tf->useGPU = config.useGPU;
+		tf->numThreads = config.numThreads;
+		result = installOrtSession(tf, build);
+		if (result != OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+			obs_log(LOG_ERROR,
+				"Failed to set up the %s session. Error code: %d",
+				config.modelSelection.c_str(), result);
+			// Back to the model that was serving frames
+			tf->model = std::move(oldModel);
+			tf->modelSelection = oldConfig.modelSelection;
+			tf->useGPU = oldConfig.useGPU;
+			tf->numThreads = oldConfig.numThreads;
+			if (!tf->model || !oldBuild.session ||
+			    installOrtSession(tf, oldBuild) !=
+				    OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+				tf->model.reset();
+				tf->session.reset();
+				tf->sessionRunMutex.reset();
+				markModelSwapFailedLocked(tf);
+			}
+			tf->modelInstalled = tf->model != nullptr;
+			return;
+		}
+		tf->modelInstalled = true;
+		tf->modelSwapFailed = false;
+	}
+	if (request.cpuFallback) {
+		tf->stats.cpuFallbacks++;
+	}
+
+#ifdef _WIN32
+	obs_log(LOG_INFO, "Switched to %s on %s: %S",
+		config.modelSelection.c_str(), config.useGPU.c_str(),
+		tf->modelFilepath.c_str());
+#else
+	obs_log(LOG_INFO, "Switched to %s on %s: %s",
+		config.modelSelection.c_str(), config.useGPU.c_str(),
+		tf->modelFilepath.c_str());
+#endif
+
+	if (config.useGPU == USEGPU_TENSORRT) {
+		// Model switches load the engines from the cache
+		prebuildTensorRTEngines();
+	}
+}
+
+/**
+  * @brief The swap thread: build the latest request until stopped
+*/
+static void modelSwapLoop(filter_data *tf)
+{
+	os_set_thread_name("bgremoval-model-swap");
+
+	while (true) {
+		std::shared_ptr<ModelSwapRequest> request;
+		{
+			std::unique_lock<std::mutex> lock(tf->modelSwapMutex);
+			tf->modelSwapCondition.wait(lock, [tf] {
+				return tf->modelSwapStop ||
+				       tf->pendingModelSwap != nullptr;
+			});
+			if (tf->modelSwapStop) {
+				break;
+			}
+			request = std::move(tf->pendingModelSwap);
+			tf->pendingModelSwap.reset();
+			tf->modelSwapBuilding = true;
+		}
+
+		try {
+			swapModel(tf, *request);
+		} catch (const std::exception &e) {
+			obs_log(LOG_ERROR, "Model swap exception: %s",
+				e.what());
+			markModelSwapFailed(tf);
+		}
+
+		std::lock_guard<std::mutex> lock(tf->modelSwapMutex);
+		tf->modelSwapBuilding = false;
+	}
+}
+
+/**
+  * @brief Start the swap thread if needed. Call with modelSwapMutex held.
+*/
+static void startModelSwapThreadLocked(filter_data *tf)
+{
+	if (!tf->modelSwapThread.joinable()) {
+		tf->modelSwapThread = std::thread(modelSwapLoop, tf);
+	}
+}
+
+void requestModelSwap(filter_data *tf, const OrtSessionConfig &config,
+		      std::unique_ptr<Model> model, bool cpuFallback)
+{
+	std::shared_ptr<ModelSwapRequest> request =
+		std::make_shared<ModelSwapRequest>();
+	request->config = config;
+	request->model = std::move(model);
+	request->cpuFallback = cpuFallback;
+
+	{
+		std::lock_guard<std::mutex> lock(tf->modelSwapMutex);
+		if (tf->modelSwapStop) {
+			return;
+		}
+		if (tf->modelSwapReleased) {
+			// Built when the source is used again
+			tf->releasedModelSwap = std::move(request);
+			return;
+		}
+		// Replace any request the thread has not picked up yet
+		tf->pendingModelSwap = std::move(request);
+		startModelSwapThreadLocked(tf);
+	}
+	tf->modelSwapCondition.notify_one();
+}
+
+bool isModelSwapPending(filter_data *tf)
+{
+	std::lock_guard<std::mutex> lock(tf->modelSwapMutex);
+	return tf->pendingModelSwap != nullptr || tf->modelSwapBuilding ||
+	       tf->modelSwapReleased;
+}
+
+bool hasModelSwapFailed(filter_data *tf)
+{
+	return tf->modelSwapFailed;
+}
+
+void stopModelSwapWorker(filter_data *tf)
+{
+	{
+		std::lock_guard<std::mutex> lock(tf->modelSwapMutex);
+		tf->modelSwapStop = true;
+		tf->pendingModelSwap.reset();
+	}
+	tf->modelSwapCondition.notify_one();
+
+	if (tf->modelSwapThread.joinable()) {
+		tf->modelSwapThread.join();
+	}
+}
+
+void deferModelLoad(filter_data *tf)
+{
+	std::lock_guard<std::mutex> lock(tf->modelSwapMutex);
+	tf->modelSwapReleased = true;
+}
+
+/**
+  * @brief Free the session and tensors, keeping the model to load it again
+  *
+  * @return true  if the session was released, false if a switch is in progress
+*/
+static bool releaseModelSession(filter_data *tf)
+{
+	std::lock_guard<std::mutex> swapLock(tf->modelSwapMutex);
+	if (tf->modelSwapReleased || tf->modelSwapStop ||
+	    tf->pendingModelSwap || tf->modelSwapBuilding) {
+		return false;
+	}
+	tf->modelSwapReleased = true;
+
+	std::shared_ptr<ModelSwapRequest> request =
+		std::make_shared<ModelSwapRequest>();
+	// Destroyed after modelMutex is released
+	std::shared_ptr<Ort::Session> session;
+	{
+		std::unique_lock<std::mutex> lock(tf->modelMutex);
+		request->config.modelSelection = tf->modelSelection;
+		request->config.useGPU = tf->useGPU;
+		request->config.numThreads = tf->numThreads;
+		request->model = std::move(tf->model);
+		tf->modelInstalled = false;
+
+		leaveInferenceBatch(tf);
+		tf->deviceBinding.reset();
+		session = std::move(tf->session);
+		tf->inputTensor.clear();
+		tf->outputTensor.clear();
+		tf->inputTensorValues.clear();
+		tf->outputTensorValues.clear();
+		tf->inputTensorHalfValues.clear();
+		tf->outputTensorHalfValues.clear();
+		tf->stats.tensorBytes = 0;
+	}
+	if (request->model) {
+		tf->releasedModelSwap = std::move(request);
+	}
+	return true;
+}
+
+void markModelUsed(filter_data *tf)
+{
+	tf->lastUsedNs = os_gettime_ns();
+	if (!tf->modelSwapReleased) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(tf->modelSwapMutex);
+		if (!tf->modelSwapReleased || tf->modelSwapStop) {
+			return;
+		}
+		tf->modelSwapReleased = false;
+		if (!tf->releasedModelSwap) {
+			return;
+		}
+		obs_log(LOG_INFO, "Loading the %s model of %s",
+			tf->releasedModelSwap->config.modelSelection.c_str(),
+			obs_source_get_name(tf->source));
+		tf->pendingModelSwap = std::move(tf->releasedModelSwap);
+		tf->releasedModelSwap.reset();
+		startModelSwapThreadLocked(tf);
+	}
+	tf->modelSwapCondition.notify_one();
+}
+
+bool releaseUnusedModel(filter_data *tf)
+{
+	const uint64_t releaseAfter = tf->releaseInactiveAfter;
+	const uint64_t lastUsed = tf->lastUsedNs;
+	if (releaseAfter == 0 || lastUsed == 0 || tf->modelSwapReleased) {
+		return false;
+	}
+	const uint64_t unused = os_gettime_ns() - lastUsed;
+	if (unused < releaseAfter * 1000000000ULL) {
+		return false;
+	}
+
+	if (!releaseModelSession(tf)) {
+		// Already released, or a model is being switched to
+		return false;
+	}
+	obs_log(LOG_INFO, "Released the model of %s, unused for %d s",
+		obs_source_get_name(tf->source), (int)(unused / 1000000000ULL));
+	return true;
+}
@@ -0,0 +1,93 @@
+#ifndef MODEL_SWAP_H
+#define MODEL_SWAP_H
+
+#include <memory>
+
+#include "FilterData.h"
+
+/**
+  * @brief A model to switch a filter to once its session is built
+*/
+struct ModelSwapRequest {
+	OrtSessionConfig config;
+	// The model object for config, with its input resolution already set
+	std::unique_ptr<Model> model;
+	// Counted in the filter's stats.cpuFallbacks once installed
+	bool cpuFallback = false;
+};
+
+/**
+  * @brief Build a session for a new model in the background and switch to it
+  *
+  * The filter keeps inferring with its current model until the new session is
+  * built. It then takes modelMutex only to install the session and allocate
+  * its tensors. A request made while another one builds replaces it, and the
+  * older build is dropped once it is done. A session that fails to build
+  * leaves the current model in place. Starts the filter's swap thread on
+  * first use. While the filter's model is released, the request is kept
+  * until the source is used again.
+  *
+  * @param tf  The filter data
+  * @param config  The model and device to switch to
+  * @param model  The model object for config
+  * @param cpuFallback  Whether this replaces a failed GPU session, see
+  * FilterStats::cpuFallbacks
+*/
+void requestModelSwap(filter_data *tf, const OrtSessionConfig &config,
+		      std::unique_ptr<Model> model, bool cpuFallback = false);
+
+/**
+  * @brief Whether a requested model is not installed yet, including a model
+  * released while the source is unused
+*/
+bool isModelSwapPending(filter_data *tf);
+
+/**
+  * @brief Whether the filter has no model because its last build failed
+  *
+  * The failure is logged once. The filter passes frames through, and its
+  * update callback requests the model again even if the settings are the
+  * same.
+*/
+bool hasModelSwapFailed(filter_data *tf);
+
+/**
+  * @brief Stop the swap thread, waiting for the build in progress
+  *
+  * @param tf  The filter data
+*/
+void stopModelSwapWorker(filter_data *tf);
+
+/**
+  * Sources nobody looks at don't keep their model loaded.
+  *
+  * A filter starts released: its first model is only built when the source is
+  * first shown. Once the source has not been rendered for
+  * releaseInactiveAfter seconds, the session and tensors are freed, and they
+  * are built again the next time it is shown, in preview or at the start of a
+  * transition to its scene.
+*/
+
+/**
+  * @brief Start the filter released, so its first model loads when it is used.
+  * Call before the first update.
+*/
+void deferModelLoad(filter_data *tf);
+
+/**
+  * @brief Record that the source is shown, and load its model if it was
+  * released
+  *
+  * Called when the filter renders and when its source is shown.
+*/
+void markModelUsed(filter_data *tf);
+
+/**
+  * @brief Release the model if the source was not used for
+  * releaseInactiveAfter seconds
+  *
+  * @return true  if it was released now, so the filter frees its own buffers
+*/
+bool releaseUnusedModel(filter_data *tf);
+
+#endif /* MODEL_SWAP_H */
@@ -0,0 +1,103 @@
+#include "ort-device-binding.h"
+
+#include <obs-module.h>
+
+#include "FilterData.h"
+#include "ort-session-cache.h"
+#include "consts.h"
+#include "plugin-support.h"
+
+OrtDeviceBinding::OrtDeviceBinding(Ort::Session &session)
+	: binding(session),
+	  // TensorRT allocates from the CUDA allocator as well
+	  deviceMemoryInfo("Cuda", OrtArenaAllocator, 0, OrtMemTypeDefault)
+{
+}
+
+bool setupDeviceBinding(filter_data *tf)
+{
+	tf->deviceBinding.reset();
+
+#if defined(__linux__) && defined(__x86_64__) && \
+	!defined(DISABLE_ONNXRUNTIME_GPU)
+	if (tf->useGPU != USEGPU_CUDA && tf->useGPU != USEGPU_TENSORRT) {
+		return false;
+	}
+
+	std::vector<int> recurrentOutputOfInput(tf->inputNames.size(), -1);
+	bool hasRecurrentState = false;
+	for (size_t i = 0; i < tf->outputNames.size(); i++) {
+		const int input = tf->model->getRecurrentInputIndex(i);
+		if (input >= 0 && (size_t)input < tf->inputNames.size()) {
+			recurrentOutputOfInput[input] = (int)i;
+			hasRecurrentState = true;
+		}
+	}
+	if (!hasRecurrentState) {
+		// Session::Run makes the same copies IoBinding would
+		return false;
+	}
+
+	tf->deviceBinding = std::make_unique<OrtDeviceBinding>(*tf->session);
+	tf->deviceBinding->recurrentOutputOfInput =
+		std::move(recurrentOutputOfInput);
+	for (size_t i = 0; i < tf->outputNames.size(); i++) {
+		tf->deviceBinding->recurrentState.emplace_back(nullptr);
+	}
+
+	obs_log(LOG_INFO, "Keeping recurrent state of %s on the device",
+		tf->modelSelection.c_str());
+	return true;
+#else
+	UNUSED_PARAMETER(tf);
+	return false;
+#endif
+}
+
+void runNetworkOnDevice(filter_data *tf)
+{
+	OrtDeviceBinding &device = *tf->deviceBinding;
+
+	device.binding.ClearBoundInputs();
+	device.binding.ClearBoundOutputs();
+
+	for (size_t i = 0; i < tf->inputNames.size(); i++) {
+		const int output = device.recurrentOutputOfInput[i];
+		if (output >= 0 && device.recurrentState[output]) {
+			device.binding.BindInput(tf->inputNames[i].get(),
+						 device.recurrentState[output]);
+		} else {
+			// The frame, constants, and the zero state of the first frame
+			device.binding.BindInput(tf->inputNames[i].get(),
+						 tf->inputTensor[i]);
+		}
+	}
+
+	for (size_t i = 0; i < tf->outputNames.size(); i++) {
+		if (tf->model->getRecurrentInputIndex(i) >= 0) {
+			// Let ORT allocate the new state on the device
+			device.binding.BindOutput(tf->outputNames[i].get(),
+						  device.deviceMemoryInfo);
+		} else {
+			device.binding.BindOutput(tf->outputNames[i].get(),
+						  tf->outputTensor[i]);
+		}
+	}
+
+	{
+		std::unique_lock<std::mutex> runLock =
+			lockOrtSessionRun(tf->sessionRunMutex);
+		tf->session->Run(Ort::RunOptions{nullptr}, device.binding);
+	}
+	device.binding.SynchronizeOutputs();
+
+	// Keep this frame's state for the next one. The binding holds its own
+	// reference to the previous state until it is cleared.
+	std::vector<Ort::Value> outputs = device.binding.GetOutputValues();
+	for (size_t i = 0; i < outputs.size() && i < tf->outputNames.size();
+	     i++) {
+		if (tf->model->getRecurrentInputIndex(i) >= 0) {
+			device.recurrentState[i] = std::move(outputs[i]);
+		}
+	}
+}
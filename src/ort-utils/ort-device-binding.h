@@ -0,0 +1,47 @@
+#ifndef ORT_DEVICE_BINDING_H
+#define ORT_DEVICE_BINDING_H
+
+#include <onnxruntime_cxx_api.h>
+
+#include <vector>
+
+struct filter_data;
+
+/**
+  * @brief IoBinding state of a filter whose recurrent tensors live on the GPU
+*/
+struct OrtDeviceBinding {
+	Ort::IoBinding binding;
+	Ort::MemoryInfo deviceMemoryInfo;
+	// For every input, the output whose previous value is fed into it, or -1
+	std::vector<int> recurrentOutputOfInput;
+	// Recurrent outputs of the previous frame, still in device memory
+	std::vector<Ort::Value> recurrentState;
+
+	explicit OrtDeviceBinding(Ort::Session &session);
+};
+
+/**
+  * @brief Set up IoBinding if the model has recurrent state and the provider can
+  * keep it on the device
+  *
+  * Only CUDA and TensorRT are supported. Other providers, and models without
+  * recurrent outputs, keep using Session::Run over the CPU tensors.
+  *
+  * @param tf  The filter data, with the session and tensors already created
+  * @return true  if runNetworkOnDevice should be used for this session
+*/
+bool setupDeviceBinding(filter_data *tf);
+
+/**
+  * @brief Run the network with the recurrent state bound in device memory
+  *
+  * Regular inputs and outputs are bound to the filter's CPU tensors, so only the
+  * frame is uploaded and only the mask is downloaded. Recurrent outputs are left
+  * in device memory and bound as the matching inputs on the next call.
+  *
+  * @param tf  The filter data
+*/
+void runNetworkOnDevice(filter_data *tf);
+
+#endif /* ORT_DEVICE_BINDING_H */
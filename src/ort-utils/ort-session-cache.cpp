@@ -0,0 +1,183 @@
+#include "ort-session-cache.h"
+
+#include <obs-module.h>
+
+#include <exception>
+#include <future>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "plugin-support.h"
+#include "consts.h"
+#include "model-file-mapping.h"
+#include "perf-utils/core-budget.h"
+
+bool OrtSessionKey::operator<(const OrtSessionKey &other) const
+{
+	return std::tie(modelFilepath, provider, numThreads) <
+	       std::tie(other.modelFilepath, other.provider, other.numThreads);
+}
+
+Ort::Env &getOrtEnv()
+{
+	// Never destroyed: sessions may still be released while the module unloads,
+	// and the environment has to outlive all of them.
+	static Ort::Env *env = [] {
+		Ort::ThreadingOptions threadingOptions;
+		// Idle pool threads should not spin and steal CPU from OBS
+		threadingOptions.SetGlobalSpinControl(0);
+		// Filters on the shared pools together stay within the budget
+		const uint32_t budget = getCoreBudget();
+		threadingOptions.SetGlobalIntraOpNumThreads((int)budget);
+		threadingOptions.SetGlobalInterOpNumThreads(1);
+		const std::string affinity = coreBudgetAffinity(budget);
+		if (!affinity.empty()) {
+			Ort::ThrowOnError(
+				Ort::GetApi().SetGlobalIntraOpThreadAffinity(
+					threadingOptions, affinity.c_str()));
+		}
+		return new Ort::Env(threadingOptions,
+				    OrtLoggingLevel::ORT_LOGGING_LEVEL_ERROR,
+				    "obs-backgroundremoval");
+	}();
+	return *env;
+}
+
+/**
+  * @brief The prepacked weights shared by all sessions
+*/
+static Ort::PrepackedWeightsContainer &getPrepackedWeights()
+{
+	// Never destroyed, like the environment: it has to outlive the sessions
+	static Ort::PrepackedWeightsContainer *container =
+		new Ort::PrepackedWeightsContainer();
+	return *container;
+}
+
+#if _WIN32
+std::unique_ptr<Ort::Session>
+createSessionFromModelFile(const std::wstring &modelFilepath,
+			   const Ort::SessionOptions &sessionOptions)
+#else
+std::unique_ptr<Ort::Session>
+createSessionFromModelFile(const std::string &modelFilepath,
+			   const Ort::SessionOptions &sessionOptions)
+#endif
+{
+	// Held until the session is built, shared with concurrent builds
+	std::shared_ptr<const MappedModelFile> mapping =
+		mapModelFile(modelFilepath);
+	if (!mapping) {
+		obs_log(LOG_WARNING,
+			"Failed to map the model file, loading it from the path");
+		return std::make_unique<Ort::Session>(
+			getOrtEnv(), modelFilepath.c_str(), sessionOptions,
+			getPrepackedWeights());
+	}
+	return std::make_unique<Ort::Session>(getOrtEnv(), mapping->data(),
+					      mapping->size(), sessionOptions,
+					      getPrepackedWeights());
+}
+
+namespace {
+
+struct CachedOrtSession {
+	std::weak_ptr<Ort::Session> session;
+	std::shared_ptr<std::mutex> runMutex;
+	// Valid while the session is being built, identical requests wait on it
+	std::shared_future<SharedOrtSession> building;
+};
+
+} // namespace
+
+static std::mutex sessionCacheMutex;
+static std::map<OrtSessionKey, CachedOrtSession> sessionCache;
+
+std::unique_lock<std::mutex>
+lockOrtSessionRun(const std::shared_ptr<std::mutex> &runMutex)
+{
+	if (!runMutex) {
+		return std::unique_lock<std::mutex>();
+	}
+	return std::unique_lock<std::mutex>(*runMutex);
+}
+
+static void logSharedSession(const SharedOrtSession &shared)
+{
+	obs_log(LOG_INFO, "Sharing ONNXRuntime session (%ld users)",
+		shared.session.use_count());
+}
+
+SharedOrtSession
+getCachedOrtSession(const OrtSessionKey &key,
+		    const std::function<std::unique_ptr<Ort::Session>()> &create)
+{
+	// The lock only guards the map. Builds run outside of it, so only
+	// identical requests wait for each other, on the first one's build.
+	std::promise<SharedOrtSession> built;
+	std::shared_future<SharedOrtSession> building;
+	{
+		std::lock_guard<std::mutex> lock(sessionCacheMutex);
+
+		// Drop entries whose sessions were released
+		auto it = sessionCache.begin();
+		while (it != sessionCache.end()) {
+			if (!it->second.building.valid() &&
+			    it->second.session.expired()) {
+				it = sessionCache.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		auto cached = sessionCache.find(key);
+		if (cached != sessionCache.end() &&
+		    cached->second.building.valid()) {
+			building = cached->second.building;
+		} else {
+			SharedOrtSession shared;
+			if (cached != sessionCache.end()) {
+				// Released meanwhile if this is null
+				shared.session = cached->second.session.lock();
+				shared.runMutex = cached->second.runMutex;
+			}
+			if (shared.session) {
+				logSharedSession(shared);
+				return shared;
+			}
+			sessionCache[key].building = built.get_future().share();
+		}
+	}
+	if (building.valid()) {
+		// Throws if that build failed
+		SharedOrtSession shared = building.get();
+		logSharedSession(shared);
+		return shared;
+	}
+
+	SharedOrtSession shared;
+	try {
+		shared.session = std::shared_ptr<Ort::Session>(create());
+	} catch (...) {
+		{
+			std::lock_guard<std::mutex> lock(sessionCacheMutex);
+			sessionCache.erase(key);
+		}
+		built.set_exception(std::current_exception());
+		throw;
+	}
+	if (key.provider == USEGPU_DML) {
+		// DirectML sessions run one Run at a time
+		shared.runMutex = std::make_shared<std::mutex>();
+	}
+	{
+		std::lock_guard<std::mutex> lock(sessionCacheMutex);
+		CachedOrtSession &entry = sessionCache[key];
+		entry.session = shared.session;
+		entry.runMutex = shared.runMutex;
+		entry.building = std::shared_future<SharedOrtSession>();
+	}
+	built.set_value(shared);
+	return shared;
+}
@@ -0,0 +1,98 @@
+#ifndef ORT_SESSION_CACHE_H
+#define ORT_SESSION_CACHE_H
+
+#include <onnxruntime_cxx_api.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+  * @brief The process-wide ONNX Runtime environment
+  *
+  * Owns the global intra/inter-op thread pools that sessions created with
+  * DisablePerSessionThreads run on.
+*/
+Ort::Env &getOrtEnv();
+
+/**
+  * @brief Create a session of a model file
+  *
+  * The model is parsed from a shared read-only mapping of the file instead of
+  * being read into a buffer per session, and all sessions share one container
+  * of prepacked CPU weights, so sessions of the same model with different
+  * providers or threads don't each keep their own packed copy. Falls back to
+  * loading from the path when the file can't be mapped.
+  *
+  * @param modelFilepath  The model file
+  * @param sessionOptions  The options of the session
+  * @return The session. Throws on failure.
+*/
+#if _WIN32
+std::unique_ptr<Ort::Session>
+createSessionFromModelFile(const std::wstring &modelFilepath,
+			   const Ort::SessionOptions &sessionOptions);
+#else
+std::unique_ptr<Ort::Session>
+createSessionFromModelFile(const std::string &modelFilepath,
+			   const Ort::SessionOptions &sessionOptions);
+#endif
+
+/**
+  * @brief What makes two sessions interchangeable
+*/
+struct OrtSessionKey {
+#if _WIN32
+	std::wstring modelFilepath;
+#else
+	std::string modelFilepath;
+#endif
+	std::string provider;
+	// 0 when the session runs on the global thread pools
+	uint32_t numThreads = 0;
+
+	bool operator<(const OrtSessionKey &other) const;
+};
+
+/**
+  * @brief A session shared between filters
+*/
+struct SharedOrtSession {
+	std::shared_ptr<Ort::Session> session;
+	// Held around Session::Run by every user of the session when its
+	// provider can't run it from several threads at once. Null when it can.
+	std::shared_ptr<std::mutex> runMutex;
+};
+
+/**
+  * @brief Get the session for key, building it with create if no filter holds one
+  *
+  * Sessions are shared between filter instances and destroyed when the last
+  * instance releases its reference. Instances need their own input and output
+  * buffers. Session::Run is thread-safe on the CPU, CUDA, TensorRT and CoreML
+  * providers, but DirectML sessions don't support concurrent runs, so their
+  * users take the run mutex, see lockOrtSessionRun.
+  *
+  * Requests for a key being built wait for that build and share its session,
+  * or its exception. Builds of different keys run concurrently.
+  *
+  * @param key  The model, provider and thread configuration
+  * @param create  Builds a new session. May throw.
+  * @return The shared session and its run mutex
+*/
+SharedOrtSession
+getCachedOrtSession(const OrtSessionKey &key,
+		    const std::function<std::unique_ptr<Ort::Session>()> &create);
+
+/**
+  * @brief Lock a session's run mutex for one Session::Run, if it has one
+  *
+  * @param runMutex  The SharedOrtSession::runMutex of the session, may be null
+  * @return The lock, which owns nothing when runMutex is null
+*/
+std::unique_lock<std::mutex>
+lockOrtSessionRun(const std::shared_ptr<std::mutex> &runMutex);
+
+#endif /* ORT_SESSION_CACHE_H */
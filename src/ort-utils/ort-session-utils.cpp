@@ -1,6 +1,7 @@
 #include <onnxruntime_cxx_api.h>
 #include <cpu_provider_factory.h>
-#include <filesystem>
+#include <algorithm>
+#include <cstring>
 
 #if defined(__APPLE__)
 #include <coreml_provider_factory.h>
@@ -15,35 +16,98 @@
 #include <obs-module.h>
 
 #include "ort-session-utils.h"
+#include "ort-session-cache.h"
+#include "inference-batch.h"
+#include "ort-device-binding.h"
+#include "tensorrt-engines.h"
+#include "perf-utils/core-budget.h"
 #include "consts.h"
 #include "plugin-support.h"
 
-int createOrtSession(filter_data *tf)
+std::string selectModelVariant(const std::string &modelSelection,
+			       const std::string &provider)
 {
-	if (tf->model.get() == nullptr) {
-		obs_log(LOG_ERROR, "Model object is not initialized");
-		return OBS_BGREMOVAL_ORT_SESSION_ERROR_INVALID_MODEL;
+	const std::string extension = ".onnx";
+	if (modelSelection.size() <= extension.size() ||
+	    modelSelection.compare(modelSelection.size() - extension.size(),
+				   extension.size(), extension) != 0) {
+		return modelSelection;
+	}
+	std::string base = modelSelection.substr(
+		0, modelSelection.size() - extension.size());
+	for (const char *suffix : {"_fp32", "_fp16", "_qint8", "_int8"}) {
+		const size_t length = strlen(suffix);
+		if (base.size() > length &&
+		    base.compare(base.size() - length, length, suffix) == 0) {
+			base.resize(base.size() - length);
+			break;
+		}
+	}
+
+	std::vector<const char *> preferred;
+	if (provider == USEGPU_CPU) {
+		preferred = {"_int8", "_qint8"};
+	} else {
+		preferred = {"_fp16"};
 	}
+	for (const char *suffix : preferred) {
+		const std::string variant = base + suffix + extension;
+		if (variant == modelSelection) {
+			return modelSelection;
+		}
+		char *path = obs_module_file(variant.c_str());
+		if (path != nullptr) {
+			bfree(path);
+			obs_log(LOG_INFO, "Using the %s variant %s of %s",
+				provider.c_str(), variant.c_str(),
+				modelSelection.c_str());
+			return variant;
+		}
+	}
+	return modelSelection;
+}
 
+int openOrtSession(filter_data *tf, const OrtSessionConfig &config,
+		   OrtSessionBuild &build)
+{
 	Ort::SessionOptions sessionOptions;
 
 	sessionOptions.SetGraphOptimizationLevel(
 		GraphOptimizationLevel::ORT_ENABLE_ALL);
-	if (tf->useGPU != USEGPU_CPU) {
+	OrtSessionKey sessionKey;
+	sessionKey.provider = config.useGPU;
+	// The filter's numThreads, capped to its share of the CPU budget
+	const uint32_t numThreads =
+		grantCoreBudgetThreads(tf, config.useGPU, config.numThreads);
+	if (config.useGPU != USEGPU_CPU) {
 		sessionOptions.DisableMemPattern();
 		sessionOptions.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
+	} else if (numThreads == 0) {
+		// Run on the thread pools shared by all filters
+		sessionOptions.DisablePerSessionThreads();
 	} else {
-		sessionOptions.SetInterOpNumThreads(tf->numThreads);
-		sessionOptions.SetIntraOpNumThreads(tf->numThreads);
+		sessionOptions.SetInterOpNumThreads(numThreads);
+		sessionOptions.SetIntraOpNumThreads(numThreads);
+		// Idle threads should not spin and steal CPU from the encoder
+		sessionOptions.AddConfigEntry("session.intra_op.allow_spinning",
+					      "0");
+		const std::string affinity = coreBudgetAffinity(numThreads);
+		if (!affinity.empty()) {
+			sessionOptions.AddConfigEntry(
+				"session.intra_op_thread_affinities",
+				affinity.c_str());
+		}
+		sessionKey.numThreads = numThreads;
 	}
 
-	char *modelFilepath_rawPtr =
-		obs_module_file(tf->modelSelection.c_str());
+	const std::string modelFile =
+		selectModelVariant(config.modelSelection, config.useGPU);
+	char *modelFilepath_rawPtr = obs_module_file(modelFile.c_str());
 
 	if (modelFilepath_rawPtr == nullptr) {
 		obs_log(LOG_ERROR,
 			"Unable to get model filename %s from plugin.",
-			tf->modelSelection.c_str());
+			config.modelSelection.c_str());
 		return OBS_BGREMOVAL_ORT_SESSION_ERROR_FILE_NOT_FOUND;
 	}
 
@@ -52,70 +116,29 @@ int createOrtSession(filter_data *tf)
 #if _WIN32
 	int outLength = MultiByteToWideChar(
 		CP_ACP, MB_PRECOMPOSED, modelFilepath_rawPtr, -1, nullptr, 0);
-	tf->modelFilepath = std::wstring(outLength, L'\0');
+	build.modelFilepath = std::wstring(outLength, L'\0');
 	MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, modelFilepath_rawPtr, -1,
-			    tf->modelFilepath.data(), outLength);
+			    build.modelFilepath.data(), outLength);
 #else
-	tf->modelFilepath = std::string(modelFilepath_rawPtr);
+	build.modelFilepath = std::string(modelFilepath_rawPtr);
 #endif
 
 	bfree(modelFilepath_rawPtr);
+	sessionKey.modelFilepath = build.modelFilepath;
 
 	try {
 #if defined(__linux__) && defined(__x86_64__) && \
 	!defined(DISABLE_ONNXRUNTIME_GPU)
-		if (tf->useGPU == USEGPU_TENSORRT) {
-			const auto &api = Ort::GetApi();
-
-			// Folder in which TensorRT will place its cache
-			const char *tensorrt_cache_path =
-				"~/.cache/obs-backgroundremoval/tensorrt";
-
-			// Initialize TensorRT provider options
-			OrtTensorRTProviderOptionsV2 *tensorrt_options;
-			Ort::ThrowOnError(api.CreateTensorRTProviderOptions(
-				&tensorrt_options));
-
-			// Create cache folder if it does not exist
-			std::filesystem::path cache_folder(tensorrt_cache_path);
-			if (!std::filesystem::exists(cache_folder)) {
-				std::filesystem::create_directories(
-					cache_folder);
-			}
-
-			// Define TensorRT provider options
-			std::vector<const char *> option_keys = {
-				"device_id",
-				"trt_engine_cache_enable",
-				"trt_engine_cache_path",
-				"trt_timing_cache_enable",
-				"trt_timing_cache_path",
-			};
-
-			std::vector<const char *> option_values = {
-				"0",                 // Device ID 0
-				"1",                 // Enable engine cache
-				tensorrt_cache_path, // Engine cache path
-				"1",                 // Enable timing cache
-				tensorrt_cache_path, // Timing cache path
-			};
-
-			// Update provider options
-			Ort::ThrowOnError(api.UpdateTensorRTProviderOptions(
-				tensorrt_options, option_keys.data(),
-				option_values.data(), option_keys.size()));
-
-			// Append execution provider
-			sessionOptions.AppendExecutionProvider_TensorRT_V2(
-				*tensorrt_options);
-		} else if (tf->useGPU == USEGPU_CUDA) {
+		if (config.useGPU == USEGPU_TENSORRT) {
+			appendTensorRTProvider(sessionOptions, modelFile);
+		} else if (config.useGPU == USEGPU_CUDA) {
 			Ort::ThrowOnError(
 				OrtSessionOptionsAppendExecutionProvider_CUDA(
 					sessionOptions, 0));
 		}
 #endif
 #ifdef _WIN32
-		if (tf->useGPU == USEGPU_DML) {
+		if (config.useGPU == USEGPU_DML) {
 			auto &api = Ort::GetApi();
 			OrtDmlApi *dmlApi = nullptr;
 			Ort::ThrowOnError(api.GetExecutionProviderApi(
@@ -127,7 +150,7 @@ int createOrtSession(filter_data *tf)
 		}
 #endif
 #if defined(__APPLE__)
-		if (tf->useGPU == USEGPU_COREML) {
+		if (config.useGPU == USEGPU_COREML) {
 			uint32_t coreml_flags = 0;
 			coreml_flags |= COREML_FLAG_ENABLE_ON_SUBGRAPH;
 			Ort::ThrowOnError(
@@ -135,18 +158,100 @@ int createOrtSession(filter_data *tf)
 					sessionOptions, coreml_flags));
 		}
 #endif
-		tf->session.reset(new Ort::Session(
-			*tf->env, tf->modelFilepath.c_str(), sessionOptions));
+		SharedOrtSession shared =
+			getCachedOrtSession(sessionKey, [&] {
+				return createSessionFromModelFile(
+					build.modelFilepath, sessionOptions);
+			});
+		build.session = std::move(shared.session);
+		build.runMutex = std::move(shared.runMutex);
 	} catch (const std::exception &e) {
 		obs_log(LOG_ERROR, "%s", e.what());
 		return OBS_BGREMOVAL_ORT_SESSION_ERROR_STARTUP;
 	}
 
-	Ort::AllocatorWithDefaultOptions allocator;
+	return OBS_BGREMOVAL_ORT_SESSION_SUCCESS;
+}
+
+int installOrtSession(filter_data *tf, OrtSessionBuild &build)
+{
+	if (tf->model.get() == nullptr) {
+		obs_log(LOG_ERROR, "Model object is not initialized");
+		return OBS_BGREMOVAL_ORT_SESSION_ERROR_INVALID_MODEL;
+	}
+
+	// Nothing may hold on to the old session
+	leaveInferenceBatch(tf);
+	tf->deviceBinding.reset();
+	tf->session = std::move(build.session);
+	tf->sessionRunMutex = std::move(build.runMutex);
+	tf->modelFilepath = std::move(build.modelFilepath);
+	tf->stats.setSession(tf->modelSelection, tf->useGPU);
 
 	tf->model->populateInputOutputNames(tf->session, tf->inputNames,
 					    tf->outputNames);
 
+	return allocateOrtSessionTensors(tf);
+}
+
+int createOrtSession(filter_data *tf)
+{
+	if (tf->model.get() == nullptr) {
+		obs_log(LOG_ERROR, "Model object is not initialized");
+		return OBS_BGREMOVAL_ORT_SESSION_ERROR_INVALID_MODEL;
+	}
+
+	// Let go of the previous session so it is freed if no one else uses it
+	leaveInferenceBatch(tf);
+	tf->deviceBinding.reset();
+	tf->session.reset();
+	tf->sessionRunMutex.reset();
+
+	OrtSessionConfig config;
+	config.modelSelection = tf->modelSelection;
+	config.useGPU = tf->useGPU;
+	config.numThreads = tf->numThreads;
+	OrtSessionBuild build;
+	const int result = openOrtSession(tf, config, build);
+	if (result != OBS_BGREMOVAL_ORT_SESSION_SUCCESS) {
+		return result;
+	}
+	return installOrtSession(tf, build);
+}
+
+/**
+  * @brief Record the bytes of the tensors and the reused output buffer for the
+  * stats, see FilterStats::tensorBytes
+*/
+static void recordTensorBytes(filter_data *tf)
+{
+	uint64_t bytes = 0;
+	for (const std::vector<float> &values : tf->inputTensorValues) {
+		bytes += values.size() * sizeof(float);
+	}
+	for (const std::vector<float> &values : tf->outputTensorValues) {
+		bytes += values.size() * sizeof(float);
+	}
+	for (const auto &values : tf->inputTensorHalfValues) {
+		bytes += values.size() * sizeof(Ort::Float16_t);
+	}
+	for (const auto &values : tf->outputTensorHalfValues) {
+		bytes += values.size() * sizeof(Ort::Float16_t);
+	}
+	if (tf->scratch.output.u) {
+		// Not a view of an output tensor
+		bytes += tf->scratch.output.total() *
+			 tf->scratch.output.elemSize();
+	}
+	tf->stats.tensorBytes = bytes;
+}
+
+int allocateOrtSessionTensors(filter_data *tf)
+{
+	// Nothing may hold on to the old tensors
+	leaveInferenceBatch(tf);
+	tf->deviceBinding.reset();
+
 	if (!tf->model->populateInputOutputShapes(tf->session, tf->inputDims,
 						  tf->outputDims)) {
 		obs_log(LOG_ERROR,
@@ -192,12 +297,93 @@ int createOrtSession(filter_data *tf)
 					 tf->outputTensorValues,
 					 tf->inputTensorValues, tf->inputTensor,
 					 tf->outputTensor);
+	tf->model->allocateHalfTensorBuffers(
+		tf->session, tf->inputDims, tf->outputDims,
+		tf->outputTensorHalfValues, tf->inputTensorHalfValues,
+		tf->inputTensor, tf->outputTensor);
+
+	setupDeviceBinding(tf);
+
+	// Build what the runs reuse once
+	tf->scratch.inputNames.clear();
+	for (const Ort::AllocatedStringPtr &name : tf->inputNames) {
+		tf->scratch.inputNames.push_back(name.get());
+	}
+	tf->scratch.outputNames.clear();
+	for (const Ort::AllocatedStringPtr &name : tf->outputNames) {
+		tf->scratch.outputNames.push_back(name.get());
+	}
+	tf->scratch.output.release();
+	recordTensorBytes(tf);
+
+	// Frames only need to be read back at the size the model consumes
+	uint32_t inputWidth, inputHeight;
+	tf->model->getNetworkInputSize(tf->inputDims, inputWidth, inputHeight);
+	tf->readbackWidth = inputWidth;
+	tf->readbackHeight = inputHeight;
+
+	updateInferenceBatch(tf);
 
 	return OBS_BGREMOVAL_ORT_SESSION_SUCCESS;
 }
 
-bool runFilterModelInference(filter_data *tf, const cv::Mat &imageBGRA,
-			     cv::Mat &output)
+void feedBackRecurrentState(filter_data *tf)
+{
+	for (size_t i = 0; i < tf->outputTensor.size(); i++) {
+		const int input = tf->model->getRecurrentInputIndex(i);
+		if (input < 0 || (size_t)input >= tf->inputTensor.size()) {
+			continue;
+		}
+		// Swap the buffers: this run's output is the next run's input, and the
+		// old input is overwritten by the next run
+		std::swap(tf->inputTensor[input], tf->outputTensor[i]);
+		std::swap(tf->inputTensorValues[input],
+			  tf->outputTensorValues[i]);
+		std::swap(tf->inputTensorHalfValues[input],
+			  tf->outputTensorHalfValues[i]);
+	}
+}
+
+void resetRecurrentState(filter_data *tf)
+{
+	tf->recurrentStateResetPending = true;
+}
+
+/**
+  * @brief Zero the recurrent state if a reset was requested
+*/
+static void applyRecurrentStateReset(filter_data *tf)
+{
+	if (!tf->recurrentStateResetPending.exchange(false)) {
+		return;
+	}
+
+	bool hasRecurrentState = false;
+	for (size_t i = 0; i < tf->outputTensor.size(); i++) {
+		const int input = tf->model->getRecurrentInputIndex(i);
+		if (input < 0 || (size_t)input >= tf->inputTensor.size()) {
+			continue;
+		}
+		std::fill(tf->inputTensorValues[input].begin(),
+			  tf->inputTensorValues[input].end(), 0.0f);
+		std::fill(tf->inputTensorHalfValues[input].begin(),
+			  tf->inputTensorHalfValues[input].end(),
+			  Ort::Float16_t(0.0f));
+		if (tf->deviceBinding) {
+			// Bind the zeroed CPU tensor again on the next run
+			tf->deviceBinding->recurrentState[i] =
+				Ort::Value(nullptr);
+		}
+		hasRecurrentState = true;
+	}
+
+	if (hasRecurrentState) {
+		obs_log(LOG_INFO, "Recurrent state of %s reset",
+			tf->modelSelection.c_str());
+	}
+}
+
+bool loadNetworkInput(filter_data *tf, const cv::Mat &imageBGRA)
 {
 	if (tf->session.get() == nullptr) {
 		// Onnx runtime session is not initialized. Problem in initialization
@@ -208,46 +394,104 @@ bool runFilterModelInference(filter_data *tf, const cv::Mat &imageBGRA,
 		return false;
 	}
 
-	// To RGB
-	cv::Mat imageRGB;
-	cv::cvtColor(imageBGRA, imageRGB, cv::COLOR_BGRA2RGB);
+	applyRecurrentStateReset(tf);
 
-	// Resize to network input size
+	// Resize, normalize and lay out the frame straight into the input tensor
 	uint32_t inputWidth, inputHeight;
 	tf->model->getNetworkInputSize(tf->inputDims, inputWidth, inputHeight);
 
-	cv::Mat resizedImageRGB;
-	cv::resize(imageRGB, resizedImageRGB,
-		   cv::Size(inputWidth, inputHeight));
+	tf->model->loadInputToTensor(imageBGRA, inputWidth, inputHeight,
+				     tf->inputTensorValues);
+	tf->model->convertInputsToHalf(tf->inputTensorValues,
+				       tf->outputNames.size(),
+				       tf->inputTensorHalfValues);
+	return true;
+}
+
+void runLoadedNetwork(filter_data *tf)
+{
+	if (tf->deviceBinding) {
+		// Recurrent state stays on the device between frames
+		runNetworkOnDevice(tf);
+		tf->model->convertOutputsFromHalf(tf->outputTensorHalfValues,
+						  tf->outputTensorValues);
+		return;
+	}
 
-	// Prepare input to nework
-	cv::Mat resizedImage, preprocessedImage;
-	resizedImageRGB.convertTo(resizedImage, CV_32F);
+	// Run network inference
+	{
+		std::unique_lock<std::mutex> runLock =
+			lockOrtSessionRun(tf->sessionRunMutex);
+		tf->model->runNetworkInference(
+			tf->session, tf->scratch.inputNames,
+			tf->scratch.outputNames, tf->inputTensor,
+			tf->outputTensor);
+	}
+	tf->model->convertOutputsFromHalf(tf->outputTensorHalfValues,
+					  tf->outputTensorValues);
 
-	tf->model->prepareInputToNetwork(resizedImage, preprocessedImage);
+	// Feed the recurrent outputs back in models that have temporal information
+	feedBackRecurrentState(tf);
+}
 
-	tf->model->loadInputToTensor(preprocessedImage, inputWidth, inputHeight,
-				     tf->inputTensorValues);
+/**
+  * @brief Load a frame into the input tensor and run the model on it
+  *
+  * @return true  if the output tensors hold the result for this frame
+*/
+static bool runNetwork(filter_data *tf, const cv::Mat &imageBGRA)
+{
+	if (!loadNetworkInput(tf, imageBGRA)) {
+		return false;
+	}
+	runLoadedNetwork(tf);
+	return true;
+}
 
-	// Run network inference
-	tf->model->runNetworkInference(tf->session, tf->inputNames,
-				       tf->outputNames, tf->inputTensor,
-				       tf->outputTensor);
+bool runFilterModelInference(filter_data *tf, const cv::Mat &imageBGRA,
+			     cv::Mat &output)
+{
+	if (!runNetwork(tf, imageBGRA)) {
+		return false;
+	}
 
 	// Get output
-	// Map network output to cv::Mat
-	cv::Mat outputImage = tf->model->getNetworkOutput(
+	// Map network output to cv::Mat, a view of the output tensor
+	const cv::Mat networkOutput = tf->model->getNetworkOutput(
 		tf->outputDims, tf->outputTensorValues);
 
-	// Assign output to input in some models that have temporal information
-	tf->model->assignOutputToInput(tf->outputTensorValues,
-				       tf->inputTensorValues);
-
 	// Post-process output. The image will now be in [0,1] float, BHWC format
-	tf->model->postprocessOutput(outputImage);
+	const uchar *scratchData = tf->scratch.output.data;
+	tf->model->postprocessOutput(networkOutput, tf->scratch.output);
+	if (tf->scratch.output.data != scratchData) {
+		recordTensorBytes(tf);
+	}
 
 	// Convert [0,1] float to CV_8U [0,255]
-	outputImage.convertTo(output, CV_8U, 255.0);
+	tf->scratch.output.convertTo(output, CV_8U, 255.0);
 
 	return true;
 }
+
+bool runFilterModelInferenceToMask(filter_data *tf, const cv::Mat &imageBGRA,
+				   bool enableThreshold, uint8_t threshold,
+				   cv::Mat &backgroundMask)
+{
+	if (tf->inferenceBatchMember) {
+		// Run together with the other sources on this session
+		return runBatchedInferenceToMask(tf, imageBGRA, enableThreshold,
+						 threshold, backgroundMask);
+	}
+
+	if (!runNetwork(tf, imageBGRA)) {
+		return false;
+	}
+
+	// Read the mask channel straight from the output tensor into CV_8U
+	postprocessTensorToMask(tf->outputTensorValues[0].data(),
+				tf->model->getOutputPostprocessing(
+					tf->outputDims),
+				enableThreshold, threshold, backgroundMask);
+
+	return !backgroundMask.empty();
+}
@@ -3,6 +3,10 @@
 
 #include <opencv2/core/types.hpp>
 
+#include <memory>
+#include <mutex>
+#include <string>
+
 #include "FilterData.h"
 
 #define OBS_BGREMOVAL_ORT_SESSION_ERROR_FILE_NOT_FOUND 1
@@ -11,9 +15,140 @@
 #define OBS_BGREMOVAL_ORT_SESSION_ERROR_STARTUP 5
 #define OBS_BGREMOVAL_ORT_SESSION_SUCCESS 0
 
+/**
+  * @brief The variant of a model that runs best on a provider
+  *
+  * Variants are shipped next to the model, named after it with another
+  * precision suffix: models/rvm_mobilenetv3_fp32.onnx has its FP16 variant in
+  * models/rvm_mobilenetv3_fp16.onnx. The CPU provider prefers INT8 (QDQ)
+  * variants, the GPU providers FP16 ones.
+  *
+  * @param modelSelection  The model file, relative to the plugin data
+  * @param provider  The useGPU provider
+  * @return The file to load, modelSelection if it has no better variant
+*/
+std::string selectModelVariant(const std::string &modelSelection,
+			       const std::string &provider);
+
+/**
+  * @brief A session built by openOrtSession, not yet used by the filter
+*/
+struct OrtSessionBuild {
+	std::shared_ptr<Ort::Session> session;
+	std::shared_ptr<std::mutex> runMutex;
+#if _WIN32
+	std::wstring modelFilepath;
+#else
+	std::string modelFilepath;
+#endif
+};
+
+/**
+  * @brief Build the session for a configuration, or share an identical one
+  *
+  * The slow part of createOrtSession: the model is loaded and compiled for the
+  * device. Only the filter's CPU budget grant is touched, so it may run while
+  * the filter keeps inferring with its current session.
+  *
+  * @param tf  The filter the session is for
+  * @param config  The model and device to build for
+  * @param build  The session and its model file (output)
+  * @return OBS_BGREMOVAL_ORT_SESSION_SUCCESS or an error code
+*/
+int openOrtSession(filter_data *tf, const OrtSessionConfig &config,
+		   OrtSessionBuild &build);
+
+/**
+  * @brief Make a built session the filter's session and allocate its tensors
+  *
+  * Call with modelMutex held, with tf->model already the model the session was
+  * built for.
+  *
+  * @return OBS_BGREMOVAL_ORT_SESSION_SUCCESS or an error code
+*/
+int installOrtSession(filter_data *tf, OrtSessionBuild &build);
+
+/**
+  * @brief Build and install the session for the filter's modelSelection,
+  * useGPU and numThreads, releasing the current one first
+  *
+  * Call with modelMutex held.
+*/
 int createOrtSession(filter_data *tf);
 
+/**
+  * @brief Query the tensor shapes from the model and (re)allocate the tensors
+  *
+  * Called by createOrtSession. Call it again with modelMutex held after
+  * Model::setInputResolution to resize the tensors of the current session.
+  *
+  * @param tf  The filter data, with a session
+  * @return OBS_BGREMOVAL_ORT_SESSION_SUCCESS or an error code
+*/
+int allocateOrtSessionTensors(filter_data *tf);
+
+/**
+  * @brief Feed the recurrent outputs of the last run back as inputs
+  *
+  * Swaps each recurrent output with the input it feeds, tensors and buffers
+  * both, so no state is copied. Does nothing for models without recurrent
+  * state. Called by the inference functions after every run.
+  *
+  * @param tf  The filter data
+*/
+void feedBackRecurrentState(filter_data *tf);
+
+/**
+  * @brief Start the next frame from an empty recurrent state
+  *
+  * For scene cuts, where the state of the previous shot would otherwise take a
+  * few frames to wash out. Safe to call from any thread; the state is cleared
+  * before the next inference.
+  *
+  * @param tf  The filter data
+*/
+void resetRecurrentState(filter_data *tf);
+
+/**
+  * @brief Load a frame into the model's input tensors
+  *
+  * The first half of the inference functions: resets the recurrent state if
+  * requested, then resizes, normalizes and converts the frame for the model,
+  * to half precision for fp16 variants.
+  *
+  * @return false  if the filter has no session or model
+*/
+bool loadNetworkInput(filter_data *tf, const cv::Mat &imageBGRA);
+
+/**
+  * @brief Run the model on the loaded input tensors
+  *
+  * The second half of the inference functions: runs the session on the device
+  * binding or the CPU tensors, converts half precision outputs to float and
+  * feeds back the recurrent state. Throws on inference errors.
+*/
+void runLoadedNetwork(filter_data *tf);
+
+/**
+  * @brief Run an image model and produce its 8-bit output
+  *
+  * @param output  The model output (output), CV_8U HWC at the model output
+  * size. Pass the same Mat every frame to reuse its buffer.
+*/
 bool runFilterModelInference(filter_data *tf, const cv::Mat &imageBGRA,
 			     cv::Mat &output);
 
+/**
+  * @brief Run a segmentation model and produce the 8-bit background mask
+  *
+  * @param enableThreshold  Binarize the mask at threshold instead of inverting
+  * the foreground probability
+  * @param threshold  The threshold in [0, 255]
+  * @param backgroundMask  The background mask (output), CV_8UC1 at the model
+  * output size
+*/
+bool runFilterModelInferenceToMask(filter_data *tf, const cv::Mat &imageBGRA,
+				   bool enableThreshold, uint8_t threshold,
+				   cv::Mat &backgroundMask);
+
 #endif /* ORT_SESSION_UTILS_H */
@@ -0,0 +1,184 @@
+#include "tensorrt-engines.h"
+
+#include <obs-module.h>
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ort-session-cache.h"
+#include "ort-session-utils.h"
+#include "consts.h"
+#include "plugin-support.h"
+
+#if defined(__linux__) && defined(__x86_64__) && \
+	!defined(DISABLE_ONNXRUNTIME_GPU)
+
+namespace {
+
+std::mutex prebuildMutex;
+std::thread prebuildThread;
+std::atomic<bool> prebuildStop{false};
+
+/**
+  * @brief The engine and timing cache directory, created if needed
+*/
+std::string getTensorRTCachePath()
+{
+	char *path = obs_module_config_path("tensorrt");
+	if (path == nullptr) {
+		return std::string();
+	}
+	std::string cachePath(path);
+	bfree(path);
+
+	std::error_code error;
+	std::filesystem::create_directories(cachePath, error);
+	if (error) {
+		obs_log(LOG_WARNING,
+			"Failed to create the TensorRT cache %s: %s",
+			cachePath.c_str(), error.message().c_str());
+	}
+	return cachePath;
+}
+
+/**
+  * @brief Create a session of one model, which builds and caches its engine
+*/
+void prebuildEngine(const std::string &modelSelection)
+{
+	const std::string modelFile =
+		selectModelVariant(modelSelection, USEGPU_TENSORRT);
+	char *modelFilepath = obs_module_file(modelFile.c_str());
+	if (modelFilepath == nullptr) {
+		return;
+	}
+	const std::string path(modelFilepath);
+	bfree(modelFilepath);
+
+	// The same options as createOrtSession, so the engine matches
+	Ort::SessionOptions sessionOptions;
+	sessionOptions.SetGraphOptimizationLevel(
+		GraphOptimizationLevel::ORT_ENABLE_ALL);
+	sessionOptions.DisableMemPattern();
+	sessionOptions.SetExecutionMode(ExecutionMode::ORT_SEQUENTIAL);
+	appendTensorRTProvider(sessionOptions, modelFile);
+	// Building the session writes its engine to the cache
+	createSessionFromModelFile(path, sessionOptions);
+}
+
+} // namespace
+
+void appendTensorRTProvider(Ort::SessionOptions &sessionOptions,
+			    const std::string &modelFile)
+{
+	const auto &api = Ort::GetApi();
+
+	// Folder in which TensorRT will place its cache
+	const std::string cachePath = getTensorRTCachePath();
+	// QDQ models carry their own scales
+	const bool int8 = modelFile.find("int8") != std::string::npos;
+
+	OrtTensorRTProviderOptionsV2 *tensorrtOptions;
+	Ort::ThrowOnError(api.CreateTensorRTProviderOptions(&tensorrtOptions));
+
+	std::vector<const char *> optionKeys = {
+		"device_id",
+		"trt_fp16_enable",
+		"trt_int8_enable",
+	};
+	std::vector<const char *> optionValues = {
+		"0", // Device ID 0
+		"1", // Allow FP16 kernels
+		int8 ? "1" : "0",
+	};
+	if (!cachePath.empty()) {
+		optionKeys.insert(optionKeys.end(),
+				  {"trt_engine_cache_enable",
+				   "trt_engine_cache_path",
+				   "trt_timing_cache_enable",
+				   "trt_timing_cache_path"});
+		optionValues.insert(optionValues.end(),
+				    {"1", cachePath.c_str(), "1",
+				     cachePath.c_str()});
+	}
+
+	try {
+		Ort::ThrowOnError(api.UpdateTensorRTProviderOptions(
+			tensorrtOptions, optionKeys.data(),
+			optionValues.data(), optionKeys.size()));
+		sessionOptions.AppendExecutionProvider_TensorRT_V2(
+			*tensorrtOptions);
+	} catch (...) {
+		api.ReleaseTensorRTProviderOptions(tensorrtOptions);
+		throw;
+	}
+	// The session options keep their own copy
+	api.ReleaseTensorRTProviderOptions(tensorrtOptions);
+}
+
+void prebuildTensorRTEngines()
+{
+	std::lock_guard<std::mutex> lock(prebuildMutex);
+	if (prebuildThread.joinable() || prebuildStop) {
+		// Already built, building, or unloading
+		return;
+	}
+
+	prebuildThread = std::thread([] {
+		const std::vector<const char *> models = {
+			MODEL_MEDIAPIPE,
+			MODEL_SELFIE,
+			MODEL_SINET,
+			MODEL_PPHUMANSEG,
+			MODEL_RVM,
+			MODEL_RMBG,
+			MODEL_DEPTH_TCMONODEPTH,
+			MODEL_ENHANCE_TBEFN,
+			MODEL_ENHANCE_ZERODCE,
+			MODEL_ENHANCE_URETINEX,
+			MODEL_ENHANCE_SGLLIE,
+		};
+		for (size_t i = 0; i < models.size() && !prebuildStop; i++) {
+			obs_log(LOG_INFO,
+				"Building TensorRT engine %d of %d: %s",
+				(int)i + 1, (int)models.size(), models[i]);
+			try {
+				prebuildEngine(models[i]);
+			} catch (const std::exception &e) {
+				obs_log(LOG_WARNING,
+					"TensorRT engine for %s not built: %s",
+					models[i], e.what());
+			}
+		}
+		if (!prebuildStop) {
+			obs_log(LOG_INFO, "TensorRT engines are built");
+		}
+	});
+}
+
+void shutdown_tensorrt_prebuild(void)
+{
+	std::lock_guard<std::mutex> lock(prebuildMutex);
+	prebuildStop = true;
+	if (prebuildThread.joinable()) {
+		prebuildThread.join();
+	}
+}
+
+#else
+
+void appendTensorRTProvider(Ort::SessionOptions &sessionOptions,
+			    const std::string &modelFile)
+{
+	UNUSED_PARAMETER(sessionOptions);
+	UNUSED_PARAMETER(modelFile);
+}
+
+void prebuildTensorRTEngines() {}
+
+void shutdown_tensorrt_prebuild(void) {}
+
+#endif
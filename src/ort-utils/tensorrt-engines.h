@@ -0,0 +1,47 @@
+#ifndef TENSORRT_ENGINES_H
+#define TENSORRT_ENGINES_H
+
+#ifdef __cplusplus
+
+#include <onnxruntime_cxx_api.h>
+
+#include <string>
+
+/**
+  * @brief Append the TensorRT provider, with its engine and timing caches in
+  * the plugin's per-user config directory
+  *
+  * FP16 kernels are always allowed. INT8 is enabled for the INT8 (QDQ) model
+  * variants, whose scales come from the model, so no calibration is needed.
+  *
+  * @param sessionOptions  The options of the session being created
+  * @param modelFile  The model file, relative to the plugin data
+*/
+void appendTensorRTProvider(Ort::SessionOptions &sessionOptions,
+			    const std::string &modelFile);
+
+/**
+  * @brief Build the TensorRT engines of all models in the background
+  *
+  * Starts once per process, the first time a filter runs on TensorRT. Each
+  * model gets a session, which builds its engine into the cache, so the next
+  * switch to it loads the cached engine instead of building one. Progress is
+  * logged. Models with dynamic input shapes build their engine on the first
+  * run instead.
+*/
+void prebuildTensorRTEngines();
+
+extern "C" {
+#endif
+
+/**
+  * @brief Stop the engine prebuild after the current model and wait for it.
+  * Call when the module unloads.
+*/
+void shutdown_tensorrt_prebuild(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TENSORRT_ENGINES_H */
@@ -0,0 +1,70 @@
+#include "allocation-counter.h"
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <mutex>
+
+static std::atomic<int> countingUsers{0};
+static std::atomic<uint64_t> allocationCount{0};
+static thread_local uint64_t threadAllocationCount = 0;
+
+namespace {
+
+/**
+  * @brief Counts the buffers of cv::Mat, which OpenCV allocates with its own
+  * aligned malloc instead of operator new
+*/
+class CountingMatAllocator : public cv::MatAllocator {
+public:
+	cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+			       size_t *step, cv::AccessFlag flags,
+			       cv::UMatUsageFlags usageFlags) const override
+	{
+		if (data == nullptr &&
+		    countingUsers.load(std::memory_order_relaxed) > 0) {
+			allocationCount.fetch_add(1, std::memory_order_relaxed);
+			threadAllocationCount++;
+		}
+		return cv::Mat::getStdAllocator()->allocate(
+			dims, sizes, type, data, step, flags, usageFlags);
+	}
+
+	bool allocate(cv::UMatData *data, cv::AccessFlag accessFlags,
+		      cv::UMatUsageFlags usageFlags) const override
+	{
+		return cv::Mat::getStdAllocator()->allocate(data, accessFlags,
+							    usageFlags);
+	}
+
+	void deallocate(cv::UMatData *data) const override
+	{
+		cv::Mat::getStdAllocator()->deallocate(data);
+	}
+};
+
+} // namespace
+
+void setAllocationCounting(bool enable)
+{
+	static CountingMatAllocator countingAllocator;
+	static std::once_flag installed;
+	if (enable) {
+		std::call_once(installed, [] {
+			cv::Mat::setDefaultAllocator(&countingAllocator);
+		});
+		countingUsers.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		countingUsers.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+uint64_t getAllocationCount()
+{
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+uint64_t getThreadAllocationCount()
+{
+	return threadAllocationCount;
+}
@@ -0,0 +1,33 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+/**
+  * A debug counter of the pixel buffers OpenCV allocates, to check that the
+  * steady-state frame loop runs out of the filters' scratch buffers.
+  *
+  * While any user has counting enabled, a cv::Mat allocator that counts every
+  * buffer it hands out is OpenCV's default. Once installed it stays, since
+  * the buffers remember their allocator, and only forwards to the standard
+  * allocator while counting is off. cv::Mat headers over existing data, such
+  * as the tensor views of the models, allocate nothing and are not counted.
+*/
+
+/**
+  * @brief Start or stop counting for one user. Counting runs while any user
+  * has it enabled.
+*/
+void setAllocationCounting(bool enable);
+
+/**
+  * @brief Buffers allocated in the whole process while counting
+*/
+uint64_t getAllocationCount();
+
+/**
+  * @brief Buffers allocated by the calling thread while counting
+*/
+uint64_t getThreadAllocationCount();
+
+#endif /* ALLOCATION_COUNTER_H */
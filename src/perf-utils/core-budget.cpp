@@ -0,0 +1,204 @@
+#include "core-budget.h"
+
+#include <obs-module.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "FilterData.h"
+#include "consts.h"
+#include "obs-utils/obs-config-utils.h"
+#include "plugin-support.h"
+
+namespace {
+
+struct CoreBudgetConfig {
+	uint32_t cores;
+	uint32_t reserved;
+	uint32_t budget;
+	bool pin;
+};
+
+/**
+  * @brief What the budget knows of a filter, so it never reads the filter's
+  * settings from another thread
+*/
+struct CoreBudgetMember {
+	bool active = false;
+	// Runs a CPU session with its own threads
+	bool ownThreads = false;
+	uint32_t requested = 0;
+	uint32_t granted = 0;
+};
+
+std::mutex budgetMutex;
+std::map<filter_data *, CoreBudgetMember> members;
+
+const CoreBudgetConfig &getBudgetConfig()
+{
+	static const CoreBudgetConfig config = [] {
+		CoreBudgetConfig c;
+		c.cores = std::max(1u, std::thread::hardware_concurrency());
+
+		int reserved = 0;
+		int budget = 0;
+		getIntFromConfig("reserved_encoder_cores", &reserved, 0);
+		getIntFromConfig("cpu_core_budget", &budget, 0);
+		getFlagFromConfig("pin_inference_threads", &c.pin, false);
+
+		c.reserved =
+			(uint32_t)std::clamp(reserved, 0, (int)c.cores - 1);
+		const uint32_t available = c.cores - c.reserved;
+		c.budget = budget > 0 ? std::min((uint32_t)budget, available)
+				      : available;
+		c.pin = c.pin && c.reserved > 0;
+
+		obs_log(LOG_INFO,
+			"CPU budget: %u of %u cores, %u reserved for encoding%s",
+			c.budget, c.cores, c.reserved,
+			c.pin ? ", inference threads pinned" : "");
+		return c;
+	}();
+	return config;
+}
+
+// Call with budgetMutex held
+uint32_t shareLocked()
+{
+	uint32_t sharing = 0;
+	for (const auto &entry : members) {
+		if (entry.second.active && entry.second.ownThreads) {
+			sharing++;
+		}
+	}
+	return std::max(1u,
+			getBudgetConfig().budget / std::max(1u, sharing));
+}
+
+// Call with budgetMutex held
+void rebalanceLocked()
+{
+	const uint32_t share = shareLocked();
+	for (auto &entry : members) {
+		CoreBudgetMember &member = entry.second;
+		// Inactive filters are rebalanced when they are activated again
+		if (!member.active || !member.ownThreads) {
+			continue;
+		}
+		if (std::min(member.requested, share) != member.granted) {
+			entry.first->coreBudgetChanged = true;
+		}
+	}
+}
+
+} // namespace
+
+uint32_t getCoreBudget()
+{
+	return getBudgetConfig().budget;
+}
+
+void joinCoreBudget(filter_data *tf, bool active)
+{
+	std::lock_guard<std::mutex> lock(budgetMutex);
+	// A session may already have been granted threads
+	members[tf].active = active;
+	rebalanceLocked();
+}
+
+void leaveCoreBudget(filter_data *tf)
+{
+	std::lock_guard<std::mutex> lock(budgetMutex);
+	members.erase(tf);
+	rebalanceLocked();
+}
+
+void setCoreBudgetActive(filter_data *tf, bool active)
+{
+	std::lock_guard<std::mutex> lock(budgetMutex);
+	auto member = members.find(tf);
+	if (member == members.end() || member->second.active == active) {
+		return;
+	}
+	member->second.active = active;
+	rebalanceLocked();
+}
+
+bool isCoreBudgetActive(filter_data *tf)
+{
+	std::lock_guard<std::mutex> lock(budgetMutex);
+	auto member = members.find(tf);
+	return member != members.end() && member->second.active;
+}
+
+uint32_t grantCoreBudgetThreads(filter_data *tf, const std::string &useGPU,
+				uint32_t numThreads)
+{
+	std::lock_guard<std::mutex> lock(budgetMutex);
+	CoreBudgetMember &member = members[tf];
+	member.ownThreads = useGPU == USEGPU_CPU && numThreads > 0;
+	member.requested = member.ownThreads ? numThreads : 0;
+	member.granted = std::min(member.requested, shareLocked());
+	tf->coreBudgetChanged = false;
+
+	// A new thread count changes the share of the others
+	rebalanceLocked();
+	return member.granted;
+}
+
+std::string coreBudgetAffinity(uint32_t threads)
+{
+	const CoreBudgetConfig &config = getBudgetConfig();
+	if (!config.pin || threads <= 1) {
+		return std::string();
+	}
+	const std::string cores =
+		"1-" + std::to_string(config.cores - config.reserved);
+	std::string affinity = cores;
+	for (uint32_t i = 2; i < threads; i++) {
+		affinity += ";" + cores;
+	}
+	return affinity;
+}
+
+void pinThreadToCoreBudget()
+{
+	const CoreBudgetConfig &config = getBudgetConfig();
+	if (!config.pin) {
+		return;
+	}
+	const uint32_t allowed = config.cores - config.reserved;
+#ifdef _WIN32
+	// Only the first processor group
+	DWORD_PTR mask = 0;
+	for (uint32_t i = 0; i < allowed && i < sizeof(mask) * 8; i++) {
+		mask |= (DWORD_PTR)1 << i;
+	}
+	if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+		obs_log(LOG_WARNING, "Failed to pin the thread to %u cores",
+			allowed);
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (uint32_t i = 0; i < allowed && i < CPU_SETSIZE; i++) {
+		CPU_SET(i, &set);
+	}
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+		obs_log(LOG_WARNING, "Failed to pin the thread to %u cores",
+			allowed);
+	}
+#else
+	// macOS has no thread affinity, only affinity tags
+	UNUSED_PARAMETER(allowed);
+#endif
+}
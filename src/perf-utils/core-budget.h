@@ -0,0 +1,88 @@
+#ifndef CORE_BUDGET_H
+#define CORE_BUDGET_H
+
+#include <cstdint>
+#include <string>
+
+struct filter_data;
+
+/**
+  * The plugin-wide CPU budget the ONNX Runtime threads of all filters share.
+  *
+  * Read once from the module config.ini, section [config]:
+  *   cpu_core_budget        Logical cores inference may use, 0 for all of the
+  *                          cores not reserved
+  *   reserved_encoder_cores Logical cores kept free for encoding, the highest
+  *                          numbered ones
+  *   pin_inference_threads  Keep the inference threads off the reserved cores
+  *
+  * The shared ORT pools are sized to the budget. Filters with their own
+  * threads split it: each active CPU filter gets at most budget / active
+  * filters. When filters are activated or deactivated the share changes, and
+  * the filters whose sessions no longer fit it rebuild them on their
+  * inference worker.
+*/
+
+/**
+  * @brief Logical cores the inference and post-processing threads may use
+*/
+uint32_t getCoreBudget();
+
+/**
+  * @brief Add a filter to the budget. Call before its first session.
+  *
+  * Filters join inactive and count once their activate callback runs, since
+  * OBS never activates nor deactivates the filters of sources that are not
+  * shown, such as those in other scenes at load.
+  *
+  * @param active  Whether the filter counts toward the split right away
+*/
+void joinCoreBudget(filter_data *tf, bool active);
+
+/**
+  * @brief Remove a filter from the budget and rebalance the others
+*/
+void leaveCoreBudget(filter_data *tf);
+
+/**
+  * @brief Mark a filter active or inactive and rebalance
+  *
+  * Only active filters count toward the split. Filters whose session threads
+  * no longer match their share get coreBudgetChanged set.
+*/
+void setCoreBudgetActive(filter_data *tf, bool active);
+
+/**
+  * @brief Whether a filter counts toward the split
+*/
+bool isCoreBudgetActive(filter_data *tf);
+
+/**
+  * @brief The intra-op threads for a new session of a filter
+  *
+  * Called when the session is built. Records the grant, so the filter is only
+  * rebuilt again when its share changes.
+  *
+  * @param useGPU  The provider of the session
+  * @param numThreads  The threads the filter asks for, 0 for the shared pools
+  * @return numThreads capped to the filter's share, or 0 for the shared pools
+*/
+uint32_t grantCoreBudgetThreads(filter_data *tf, const std::string &useGPU,
+				uint32_t numThreads);
+
+/**
+  * @brief The ORT thread affinity string for a pool of threads
+  *
+  * ORT pins every thread but the calling one, so the string has threads - 1
+  * entries, each allowing all the unreserved cores (1-based).
+  *
+  * @return The affinity string, empty when pinning is off
+*/
+std::string coreBudgetAffinity(uint32_t threads);
+
+/**
+  * @brief Keep the calling thread off the reserved cores, if pinning is on
+*/
+void pinThreadToCoreBudget();
+
+#endif /* CORE_BUDGET_H */
@@ -0,0 +1,55 @@
+#include "filter-stats.h"
+
+#include <algorithm>
+
+void FilterStats::addInference()
+{
+	inferences.fetch_add(1, std::memory_order_relaxed);
+
+	const std::chrono::steady_clock::time_point now =
+		std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (lastInference.time_since_epoch().count() != 0) {
+		const double seconds =
+			std::chrono::duration<double>(now - lastInference)
+				.count();
+		if (intervalSeconds <= 0.0) {
+			intervalSeconds = seconds;
+		} else {
+			intervalSeconds +=
+				(seconds - intervalSeconds) * RATE_SMOOTHING;
+		}
+	}
+	lastInference = now;
+}
+
+double FilterStats::inferenceRate() const
+{
+	const std::chrono::steady_clock::time_point now =
+		std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (intervalSeconds <= 0.0) {
+		return 0.0;
+	}
+	// Past the usual interval the rate drops with the time since the last
+	// inference, down to 0 when they have stopped
+	const double sinceLast =
+		std::chrono::duration<double>(now - lastInference).count();
+	const double interval = std::max(intervalSeconds, sinceLast);
+	return interval > 0.0 ? 1.0 / interval : 0.0;
+}
+
+void FilterStats::setSession(const std::string &model,
+			     const std::string &provider)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	sessionModel = model;
+	sessionProvider = provider;
+}
+
+void FilterStats::getSession(std::string &model, std::string &provider) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	model = sessionModel;
+	provider = sessionProvider;
+}
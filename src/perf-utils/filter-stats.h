@@ -0,0 +1,65 @@
+#ifndef FILTER_STATS_H
+#define FILTER_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+  * @brief Counters of one filter's frame pipeline, for monitoring
+  *
+  * Written from the video and inference threads and read by the stats
+  * handler, see obs-utils/stats-handler.h. Counters only grow; scrapers take
+  * the differences.
+*/
+struct FilterStats {
+	// Frames taken from the readback ring
+	std::atomic<uint64_t> frames{0};
+	// Frames dropped by the similarity check
+	std::atomic<uint64_t> similaritySkips{0};
+	// Frames the mask scheduler kept the previous mask for
+	std::atomic<uint64_t> scheduledSkips{0};
+	std::atomic<uint64_t> inferences{0};
+	// CPU sessions installed after the GPU provider failed
+	std::atomic<uint64_t> cpuFallbacks{0};
+	// Frames each mask is currently used for, see MaskScheduler
+	std::atomic<int> maskInterval{1};
+	// Bytes of the input and output tensors and the output buffer reused
+	// between runs, 0 while the session is released
+	std::atomic<uint64_t> tensorBytes{0};
+
+	/**
+	  * @brief Count an inference that produced an output
+	*/
+	void addInference();
+
+	/**
+	  * @brief The recent inferences per second, falling off once they stop
+	*/
+	double inferenceRate() const;
+
+	/**
+	  * @brief Record the model and provider of the installed session
+	*/
+	void setSession(const std::string &model, const std::string &provider);
+
+	/**
+	  * @brief The model and provider of the last installed session
+	*/
+	void getSession(std::string &model, std::string &provider) const;
+
+private:
+	// Weight of the newest interval in the average
+	static constexpr double RATE_SMOOTHING = 0.1;
+
+	mutable std::mutex mutex;
+	std::chrono::steady_clock::time_point lastInference;
+	// Exponential moving average, in seconds
+	double intervalSeconds = 0.0;
+	std::string sessionModel;
+	std::string sessionProvider;
+};
+
+#endif /* FILTER_STATS_H */
@@ -0,0 +1,92 @@
+#include "mask-scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+void MaskScheduler::setBudget(float fraction)
+{
+	budget.store(std::clamp(fraction, 0.0f, 1.0f),
+		     std::memory_order_relaxed);
+}
+
+void MaskScheduler::setFixedInterval(int frames)
+{
+	fixedInterval.store(std::max(frames, 1), std::memory_order_relaxed);
+}
+
+void MaskScheduler::addFrameInterval(float seconds)
+{
+	applyPendingReset();
+	if (seconds <= 0.0f) {
+		return;
+	}
+	frameSeconds = (frameSeconds == 0.0)
+			       ? seconds
+			       : frameSeconds * 0.9 + seconds * 0.1;
+}
+
+void MaskScheduler::addInferenceLatency(std::chrono::nanoseconds latency)
+{
+	// Only the inference thread writes the latency
+	const double seconds = (double)latency.count() / 1e9;
+	const double previous = latencySeconds.load(std::memory_order_relaxed);
+	latencySeconds.store((previous == 0.0) ? seconds
+					       : previous * 0.9 + seconds * 0.1,
+			     std::memory_order_relaxed);
+}
+
+int MaskScheduler::currentInterval() const
+{
+	const float fraction = budget.load(std::memory_order_relaxed);
+	if (fraction <= 0.0f) {
+		return fixedInterval.load(std::memory_order_relaxed);
+	}
+
+	const double latency = latencySeconds.load(std::memory_order_relaxed);
+	if (latency <= 0.0 || frameSeconds <= 0.0) {
+		// Nothing measured yet
+		return 1;
+	}
+	const int frames = (int)std::ceil(latency / (fraction * frameSeconds));
+	return std::clamp(frames, 1, MAX_INTERVAL);
+}
+
+bool MaskScheduler::shouldRecompute(double psnr)
+{
+	applyPendingReset();
+	bool motionSpike = false;
+	if (std::isfinite(psnr) &&
+	    budget.load(std::memory_order_relaxed) > 0.0f) {
+		// Identical frames have a huge PSNR, don't let them skew the average
+		psnr = std::min(psnr, 60.0);
+		motionSpike = psnrAverage > 0.0 &&
+			      psnr < psnrAverage - MOTION_SPIKE_DB;
+		psnrAverage = (psnrAverage == 0.0)
+				      ? psnr
+				      : psnrAverage * 0.9 + psnr * 0.1;
+	}
+
+	if (framesUntilMask > 0 && !motionSpike) {
+		framesUntilMask--;
+		return false;
+	}
+	framesUntilMask = currentInterval() - 1;
+	return true;
+}
+
+void MaskScheduler::reset()
+{
+	latencySeconds.store(0.0, std::memory_order_relaxed);
+	// The rest belongs to the video thread, which clears it itself
+	resetPending.store(true, std::memory_order_release);
+}
+
+void MaskScheduler::applyPendingReset()
+{
+	if (!resetPending.exchange(false, std::memory_order_acquire)) {
+		return;
+	}
+	frameSeconds = 0.0;
+	psnrAverage = 0.0;
+	framesUntilMask = 0;
+}
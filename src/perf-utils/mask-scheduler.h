@@ -0,0 +1,73 @@
+#ifndef MASK_SCHEDULER_H
+#define MASK_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+
+/**
+  * @brief Decides on which frames the background mask is recomputed
+  *
+  * With a budget set, the scheduler measures the inference latency and the OBS
+  * frame interval and recomputes the mask every N frames, the smallest N that
+  * keeps inference within budget x the frame interval on average. A sudden drop
+  * in frame-to-frame PSNR (a motion spike) recomputes immediately. Without a
+  * budget, the mask is recomputed every fixed interval frames.
+  *
+  * Latency is reported from the inference thread, the settings and reset may
+  * be changed from any thread, everything else is called from the video
+  * thread.
+*/
+class MaskScheduler {
+public:
+	/**
+	  * @brief Share of each frame interval inference may use, in (0, 1]
+	  *
+	  * @param fraction  The budget, or 0 to use the fixed interval
+	*/
+	void setBudget(float fraction);
+	void setFixedInterval(int frames);
+
+	void addFrameInterval(float seconds);
+	void addInferenceLatency(std::chrono::nanoseconds latency);
+
+	/**
+	  * @brief Whether the mask should be recomputed for this frame
+	  *
+	  * Call once per frame that could be processed.
+	  *
+	  * @param psnr  PSNR of the frame against the previous one, infinity if
+	  * there is no previous frame
+	*/
+	bool shouldRecompute(double psnr);
+
+	/**
+	  * @brief The number of frames each mask is currently used for
+	*/
+	int currentInterval() const;
+
+	/**
+	  * @brief Forget the measurements. Applied on the video thread before the
+	  * next frame interval or recompute decision.
+	*/
+	void reset();
+
+private:
+	static const int MAX_INTERVAL = 10;
+	// A frame this many dB below the running PSNR is a motion spike
+	static constexpr double MOTION_SPIKE_DB = 6.0;
+
+	// Clear the video thread's state, see reset
+	void applyPendingReset();
+
+	std::atomic<float> budget{0.0f};
+	std::atomic<int> fixedInterval{1};
+	// Exponential moving averages, in seconds
+	std::atomic<double> latencySeconds{0.0};
+	std::atomic<bool> resetPending{false};
+	// Only used by the video thread
+	double frameSeconds = 0.0;
+	double psnrAverage = 0.0;
+	int framesUntilMask = 0;
+};
+
+#endif /* MASK_SCHEDULER_H */
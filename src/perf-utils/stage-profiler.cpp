@@ -0,0 +1,112 @@
+#include "stage-profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static const char *const STAGE_NAMES[PROFILER_STAGE_COUNT] = {
+	"readback",
+	"inference",
+	"refinement",
+	"blur",
+};
+
+void StageProfiler::setEnabled(bool enable)
+{
+	if (enable && !isEnabled()) {
+		// Start from a clean window so old numbers are not mixed in
+		reset();
+	}
+	if (enabled.exchange(enable, std::memory_order_relaxed) != enable) {
+		setAllocationCounting(enable);
+	}
+}
+
+void StageProfiler::addSample(ProfilerStage stage,
+			      std::chrono::nanoseconds duration,
+			      uint64_t allocations)
+{
+	const double ms = (double)duration.count() / 1e6;
+	std::lock_guard<std::mutex> lock(mutex);
+	Stage &s = stages[stage];
+	s.samples[s.next] = (float)ms;
+	s.allocations[s.next] = (uint32_t)std::min<uint64_t>(allocations,
+							     UINT32_MAX);
+	s.next = (s.next + 1) % WINDOW;
+	s.count = std::min(s.count + 1, WINDOW);
+	s.average = (s.count == 1) ? ms : s.average * 0.95 + ms * 0.05;
+}
+
+std::string StageProfiler::summary(const char *separator) const
+{
+	std::string result;
+	std::vector<float> sorted;
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < PROFILER_STAGE_COUNT; i++) {
+		const Stage &s = stages[i];
+		if (s.count == 0) {
+			continue;
+		}
+		sorted.assign(s.samples.begin(), s.samples.begin() + s.count);
+		std::sort(sorted.begin(), sorted.end());
+		const float p50 = sorted[(s.count - 1) / 2];
+		const float p95 = sorted[(s.count - 1) * 95 / 100];
+		const uint32_t allocations = *std::max_element(
+			s.allocations.begin(), s.allocations.begin() + s.count);
+
+		char buffer[160];
+		snprintf(buffer, sizeof(buffer),
+			 "%s avg %.2f p50 %.2f p95 %.2f ms, %u allocs max",
+			 STAGE_NAMES[i], s.average, p50, p95,
+			 (unsigned)allocations);
+		if (!result.empty()) {
+			result += separator;
+		}
+		result += buffer;
+	}
+	return result;
+}
+
+bool StageProfiler::getLatency(ProfilerStage stage, float &p50,
+			       float &p99) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const Stage &s = stages[stage];
+	if (s.count == 0) {
+		return false;
+	}
+	std::array<float, WINDOW> sorted = s.samples;
+	std::sort(sorted.begin(), sorted.begin() + s.count);
+	p50 = sorted[(s.count - 1) / 2];
+	p99 = sorted[(s.count - 1) * 99 / 100];
+	return true;
+}
+
+const char *StageProfiler::getStageName(ProfilerStage stage)
+{
+	return STAGE_NAMES[stage];
+}
+
+bool StageProfiler::shouldLog()
+{
+	if (!isEnabled()) {
+		return false;
+	}
+	const std::chrono::steady_clock::time_point now =
+		std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mutex);
+	if (now - lastLog < std::chrono::seconds(LOG_INTERVAL_SECONDS)) {
+		return false;
+	}
+	lastLog = now;
+	return true;
+}
+
+void StageProfiler::reset()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Stage &s : stages) {
+		s = Stage();
+	}
+	lastLog = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,137 @@
+#ifndef STAGE_PROFILER_H
+#define STAGE_PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "perf-utils/allocation-counter.h"
+
+enum ProfilerStage {
+	PROFILER_STAGE_READBACK,
+	PROFILER_STAGE_INFERENCE,
+	PROFILER_STAGE_REFINEMENT,
+	PROFILER_STAGE_BLUR,
+	PROFILER_STAGE_COUNT,
+};
+
+/**
+  * @brief Rolling per-stage timings of one filter instance
+  *
+  * Stages are timed from the render and inference threads and read from the UI.
+  * While disabled, timers cost one relaxed atomic load. While enabled, the
+  * cv::Mat buffers each stage allocates are counted too, see
+  * allocation-counter.h.
+*/
+class StageProfiler {
+public:
+	~StageProfiler() { setEnabled(false); }
+
+	void setEnabled(bool enable);
+	bool isEnabled() const
+	{
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	/**
+	  * @brief Time the stages from now on even while disabled, without the
+	  * log line and allocation counts. For the stats handler.
+	*/
+	void keepSampling() { sampling.store(true, std::memory_order_relaxed); }
+	bool isSampling() const
+	{
+		return isEnabled() || sampling.load(std::memory_order_relaxed);
+	}
+
+	/**
+	  * @param allocations  The buffers the stage allocated this time
+	*/
+	void addSample(ProfilerStage stage, std::chrono::nanoseconds duration,
+		       uint64_t allocations = 0);
+
+	/**
+	  * @brief Average and percentiles of every stage that has samples, and
+	  * the most buffers one run of it allocated
+	  *
+	  * @param separator  The text between stages
+	*/
+	std::string summary(const char *separator = " | ") const;
+
+	/**
+	  * @brief The median and 99th percentile of a stage, in milliseconds
+	  *
+	  * @return false  if the stage has no samples
+	*/
+	bool getLatency(ProfilerStage stage, float &p50, float &p99) const;
+
+	static const char *getStageName(ProfilerStage stage);
+
+	/**
+	  * @brief Whether the periodic log line is due. Always false while disabled.
+	*/
+	bool shouldLog();
+
+	void reset();
+
+private:
+	static const size_t WINDOW = 128;
+	static const int LOG_INTERVAL_SECONDS = 10;
+
+	struct Stage {
+		std::array<float, WINDOW> samples{};
+		std::array<uint32_t, WINDOW> allocations{};
+		size_t count = 0;
+		size_t next = 0;
+		// Exponential moving average, in milliseconds
+		double average = 0.0;
+	};
+
+	mutable std::mutex mutex;
+	std::array<Stage, PROFILER_STAGE_COUNT> stages;
+	std::atomic<bool> enabled{false};
+	std::atomic<bool> sampling{false};
+	std::chrono::steady_clock::time_point lastLog;
+};
+
+/**
+  * @brief Times the enclosing scope into a StageProfiler stage
+*/
+class ScopedStageTimer {
+public:
+	ScopedStageTimer(StageProfiler &profiler, ProfilerStage stage)
+		: profiler(profiler),
+		  stage(stage),
+		  active(profiler.isSampling())
+	{
+		if (active) {
+			start = std::chrono::steady_clock::now();
+			startAllocations = getThreadAllocationCount();
+		}
+	}
+
+	~ScopedStageTimer()
+	{
+		if (active) {
+			profiler.addSample(stage,
+					   std::chrono::steady_clock::now() -
+						   start,
+					   getThreadAllocationCount() -
+						   startAllocations);
+		}
+	}
+
+	ScopedStageTimer(const ScopedStageTimer &) = delete;
+	ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+private:
+	StageProfiler &profiler;
+	ProfilerStage stage;
+	bool active;
+	std::chrono::steady_clock::time_point start;
+	uint64_t startAllocations = 0;
+};
+
+#endif /* STAGE_PROFILER_H */
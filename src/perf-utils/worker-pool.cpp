@@ -0,0 +1,196 @@
+#include "worker-pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "core-budget.h"
+
+namespace {
+
+// Tiles smaller than this cost more to hand out than they save
+const int MIN_TILE_ROWS = 16;
+// Tiles per thread, so early finishers can take over the rest
+const int TILES_PER_THREAD = 4;
+const uint32_t MAX_THREADS = 16;
+
+struct RowJob {
+	const std::function<void(int, int)> *body;
+	int rows;
+	int tileRows;
+	int tileCount;
+	std::atomic<int> nextTile{0};
+	std::atomic<int> doneTiles{0};
+	// Pool workers that may still join, and those that are running
+	int helperSlots;
+	int helpers = 0;
+	// The first exception a tile threw, rethrown on the calling thread
+	std::mutex errorMutex;
+	std::exception_ptr error;
+};
+
+void runTiles(RowJob &job)
+{
+	for (;;) {
+		const int tile = job.nextTile.fetch_add(1);
+		if (tile >= job.tileCount) {
+			return;
+		}
+		const int begin = tile * job.tileRows;
+		const int end = std::min(job.rows, begin + job.tileRows);
+		try {
+			(*job.body)(begin, end);
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(job.errorMutex);
+			if (!job.error) {
+				job.error = std::current_exception();
+			}
+		}
+		job.doneTiles.fetch_add(1);
+	}
+}
+
+class WorkerPool {
+public:
+	void run(RowJob &job)
+	{
+		int helperSlots;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (stopped) {
+				job.helperSlots = 0;
+			}
+			startThreads((size_t)job.helperSlots);
+			if (job.helperSlots > 0) {
+				jobs.push_back(&job);
+			}
+			helperSlots = job.helperSlots;
+		}
+		for (int i = 0; i < helperSlots; i++) {
+			wake.notify_one();
+		}
+
+		runTiles(job);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		jobs.erase(std::remove(jobs.begin(), jobs.end(), &job),
+			   jobs.end());
+		done.wait(lock, [&job] {
+			return job.helpers == 0 &&
+			       job.doneTiles.load() == job.tileCount;
+		});
+		if (job.error) {
+			std::rethrow_exception(job.error);
+		}
+	}
+
+	void shutdown()
+	{
+		std::vector<std::thread> joining;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+			joining.swap(threads);
+		}
+		wake.notify_all();
+		for (std::thread &thread : joining) {
+			thread.join();
+		}
+	}
+
+private:
+	// Call with mutex held
+	void startThreads(size_t count)
+	{
+		count = std::min<size_t>(count, MAX_THREADS - 1);
+		while (threads.size() < count) {
+			threads.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	void workerLoop()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			wake.wait(lock,
+				  [this] { return stopped || !jobs.empty(); });
+			if (stopped) {
+				return;
+			}
+			RowJob *job = jobs.front();
+			if (--job->helperSlots == 0) {
+				jobs.pop_front();
+			}
+			job->helpers++;
+
+			lock.unlock();
+			runTiles(*job);
+			lock.lock();
+
+			job->helpers--;
+			done.notify_all();
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	std::deque<RowJob *> jobs;
+	std::vector<std::thread> threads;
+	bool stopped = false;
+};
+
+WorkerPool &getWorkerPool()
+{
+	// Never destroyed: its threads are joined by shutdown_worker_pool while
+	// the module unloads, not by static destruction
+	static WorkerPool *pool = new WorkerPool();
+	return *pool;
+}
+
+} // namespace
+
+uint32_t resolvePostProcessThreads(uint32_t setting, uint32_t ortThreads)
+{
+	if (setting > 0) {
+		return std::min(setting, MAX_THREADS);
+	}
+	const uint32_t cores = getCoreBudget();
+	// The shared ORT pools span the budget, count the physical cores of it
+	const uint32_t ort = ortThreads > 0 ? ortThreads
+					    : std::max(1u, cores / 2);
+	return std::clamp(cores > ort ? cores - ort : 1u, 1u, MAX_THREADS);
+}
+
+void parallelForRows(int rows, uint32_t threads,
+		     const std::function<void(int begin, int end)> &body)
+{
+	if (rows <= 0) {
+		return;
+	}
+	const int maxTiles = rows / MIN_TILE_ROWS;
+	if (threads <= 1 || maxTiles < 2) {
+		body(0, rows);
+		return;
+	}
+
+	RowJob job;
+	job.body = &body;
+	job.rows = rows;
+	const int tileCount =
+		std::min(maxTiles, (int)threads * TILES_PER_THREAD);
+	job.tileRows = (rows + tileCount - 1) / tileCount;
+	job.tileCount = (rows + job.tileRows - 1) / job.tileRows;
+	job.helperSlots = std::min((int)threads, job.tileCount) - 1;
+	getWorkerPool().run(job);
+}
+
+void shutdown_worker_pool(void)
+{
+	getWorkerPool().shutdown();
+}
@@ -0,0 +1,45 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#ifdef __cplusplus
+
+#include <cstdint>
+#include <functional>
+
+/**
+  * @brief The post-processing threads for a setting
+  *
+  * @param setting  The post-process threads setting, 0 for automatic: the
+  * cores of the CPU budget left over by the ONNX Runtime threads, at least 1
+  * @param ortThreads  The filter's numThreads, 0 for the shared ORT pools
+*/
+uint32_t resolvePostProcessThreads(uint32_t setting, uint32_t ortThreads);
+
+/**
+  * @brief Run body over row tiles of [0, rows) on the plugin's worker pool
+  *
+  * The calling thread and up to threads - 1 pool workers take tiles from the
+  * same counter until none are left, so a worker that is done early takes over
+  * the remaining tiles. Returns once every tile ran. With threads <= 1 or few
+  * rows, body runs once over all rows on the calling thread.
+  *
+  * @param rows  The number of rows
+  * @param threads  The number of threads to use, including the caller
+  * @param body  Called with [begin, end) row ranges, from several threads
+*/
+void parallelForRows(int rows, uint32_t threads,
+		     const std::function<void(int begin, int end)> &body);
+
+extern "C" {
+#endif
+
+/**
+  * @brief Stop and join the worker pool threads. Call when the module unloads.
+*/
+void shutdown_worker_pool(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKER_POOL_H */
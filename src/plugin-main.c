@@ -21,6 +21,9 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include "plugin-support.h"
 
 #include "update-checker/update-checker.h"
+#include "perf-utils/worker-pool.h"
+#include "ort-utils/tensorrt-engines.h"
+#include "obs-utils/stats-handler.h"
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
@@ -37,6 +40,7 @@ bool obs_module_load(void)
 {
 	obs_register_source(&background_removal_filter_info);
 	obs_register_source(&enhance_filter_info);
+	register_plugin_stats_handler();
 	obs_log(LOG_INFO, "Plugin loaded successfully (version %s)",
 		PLUGIN_VERSION);
 
@@ -47,5 +51,7 @@ bool obs_module_load(void)
 
 void obs_module_unload()
 {
+	shutdown_tensorrt_prebuild();
+	shutdown_worker_pool();
 	obs_log(LOG_INFO, "plugin unloaded");
 }